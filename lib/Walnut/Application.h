@@ -51,6 +51,8 @@ namespace Walnut {
 		static VkInstance GetInstance();
 		static VkPhysicalDevice GetPhysicalDevice();
 		static VkDevice GetDevice();
+		static VkQueue GetQueue();
+		static uint32_t GetQueueFamily();
 
 		static VkCommandBuffer GetCommandBuffer(bool begin);
 		static void FlushCommandBuffer(VkCommandBuffer commandBuffer);
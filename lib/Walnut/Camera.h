@@ -1,15 +1,22 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <vector>
+#include <cstdint>
 
 class Camera
 {
 public:
+	// Camera rays in world space : the ray through (x, y), in pixels from the corner of the
+	// image, goes along Corner + x * StepX + y * StepY (see CameraRays.h)
+	struct RayBasis {
+		glm::vec3 Corner{ 0.0f }, StepX{ 0.0f }, StepY{ 0.0f };
+	};
+
 	Camera(float verticalFOV, float nearClip, float farClip);
 
-	bool OnUpdate(float ts);
+	bool OnUpdate(float ts); // Always false in headless builds (no input)
 	void OnResize(uint32_t width, uint32_t height);
+	void SetView(const glm::vec3& position, const glm::vec3& direction);
 
 	const glm::mat4& GetProjection() const { return m_Projection; }
 	const glm::mat4& GetInverseProjection() const { return m_InverseProjection; }
@@ -19,7 +26,9 @@ public:
 	const glm::vec3& GetPosition() const { return m_Position; }
 	const glm::vec3& GetDirection() const { return m_ForwardDirection; }
 
-	const std::vector<glm::vec3>& GetRayDirections() const { return m_RayDirections; }
+	const RayBasis& GetRayBasis() const { return m_RayBasis; }
+	uint32_t GetViewportWidth() const { return m_ViewportWidth; }
+	uint32_t GetViewportHeight() const { return m_ViewportHeight; }
 
 	float GetRotationSpeed();
 	const void SetCameraControl(bool val) { cameraControl = val;}
@@ -28,7 +37,7 @@ public:
 private:
 	void RecalculateProjection();
 	void RecalculateView();
-	void RecalculateRayDirections();
+	void RecalculateRayBasis();
 private:
 	glm::mat4 m_Projection{ 1.0f };
 	glm::mat4 m_View{ 1.0f };
@@ -42,8 +51,7 @@ private:
 	glm::vec3 m_Position{0.0f, 0.0f, 0.0f};
 	glm::vec3 m_ForwardDirection{0.0f, 0.0f, 0.0f};
 
-	// Cached ray directions
-	std::vector<glm::vec3> m_RayDirections;
+	RayBasis m_RayBasis;
 
 	glm::vec2 m_LastMousePosition{ 0.0f, 0.0f };
 
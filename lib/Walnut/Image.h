@@ -1,6 +1,8 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <array>
 
 #include "vulkan/vulkan.h"
 
@@ -13,6 +15,12 @@ namespace Walnut {
 		RGBA32F
 	};
 
+	// Rectangle of an image, in pixels
+	struct ImageRegion
+	{
+		uint32_t X = 0, Y = 0, Width = 0, Height = 0;
+	};
+
 	class Image
 	{
 	public:
@@ -21,6 +29,9 @@ namespace Walnut {
 		~Image();
 
 		void SetData(const void* data);
+		// Only the regions of data (laid out as the whole image) are uploaded, the rest of the
+		// image keeps its previous content
+		void SetData(const void* data, const std::vector<ImageRegion>& regions);
 
 		VkDescriptorSet GetDescriptorSet() const { return m_DescriptorSet; }
 
@@ -30,7 +41,21 @@ namespace Walnut {
 		uint32_t GetHeight() const { return m_Height; }
 	private:
 		void AllocateMemory(uint64_t size);
+		void AllocateStagingBuffers();
 		void Release();
+	private:
+		// Persistently mapped, used in turn : an upload only waits for the copy submitted
+		// STAGING_BUFFER_COUNT uploads earlier
+		static constexpr uint32_t STAGING_BUFFER_COUNT = 3;
+
+		struct StagingBuffer
+		{
+			VkBuffer Buffer = nullptr;
+			VkDeviceMemory Memory = nullptr;
+			void* Mapped = nullptr;
+			VkCommandBuffer CommandBuffer = nullptr;
+			VkFence Fence = nullptr; // Signaled once its last copy is done
+		};
 	private:
 		uint32_t m_Width = 0, m_Height = 0;
 
@@ -41,10 +66,10 @@ namespace Walnut {
 
 		ImageFormat m_Format = ImageFormat::None;
 
-		VkBuffer m_StagingBuffer = nullptr;
-		VkDeviceMemory m_StagingBufferMemory = nullptr;
-
-		size_t m_AlignedSize = 0;
+		std::array<StagingBuffer, STAGING_BUFFER_COUNT> m_StagingBuffers;
+		VkCommandPool m_CommandPool = nullptr;
+		uint32_t m_NextStagingBuffer = 0;
+		bool m_Uploaded = false; // The image holds data (else its layout is undefined)
 
 		VkDescriptorSet m_DescriptorSet = nullptr;
 
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+
+enum class AccumulationFormat {
+    RGB32F = 0, // Sums of the samples, 12 B per pixel
+    RGB16F,     // Means in half floats, with 5 more bits of mantissa as compensation, 8 B per pixel
+    RGB9E5      // Means with a shared exponent, 4 B per pixel (short accumulations)
+};
+
+
+// Pixels of the accumulation buffer. Compact formats hold the running mean of the samples :
+// their rounding is stochastic so that it is unbiased, the error then grows as the square
+// root of the samples instead of stalling the mean once the samples are too small to move it
+namespace AccumulationUtils {
+
+    inline uint32_t PixelSize(AccumulationFormat format) {
+        switch (format) {
+            case AccumulationFormat::RGB16F: return 8;
+            case AccumulationFormat::RGB9E5: return 4;
+            default:                         return 12;
+        }
+    }
+
+    inline uint32_t FloatBits(float f) {uint32_t x; memcpy(&x, &f, 4); return x;}
+    inline float BitsFloat(uint32_t x) {float f; memcpy(&f, &x, 4); return f;}
+
+    // Of a non negative half
+    inline float HalfToFloat(uint16_t h) {
+        uint32_t exponent = h >> 10, mantissa = h & 0x3ff;
+        if (exponent == 0) return mantissa * 0x1p-24f;
+        return BitsFloat(((exponent + 112) << 23) | (mantissa << 13));
+    }
+
+    // Of a value in [0, 65504], rounded toward zero
+    inline uint16_t FloatToHalf(float f) {
+        uint32_t x = FloatBits(f);
+        if (x < 0x38800000u) return (uint16_t)(f * 0x1p24f);
+        return (uint16_t)((x - 0x38000000u) >> 13);
+    }
+
+    // Distance from a non negative half to the next one
+    inline float HalfUlp(uint16_t h) {
+        uint32_t exponent = h >> 10;
+        return exponent == 0 ? 0x1p-24f : BitsFloat((exponent + 102) << 23);
+    }
+
+
+    // RGB16F : 3 halves truncated from the mean, then the 3 x 5 bits of what they lost in
+    // 1/32 of their ulp (Kahan-style compensation, 15 bits of mantissa in total)
+    inline glm::vec3 DecodeRGB16F(const uint16_t* p) {
+        glm::vec3 c;
+        for (int k = 0; k < 3; k++) c[k] = HalfToFloat(p[k]) + ((p[3] >> (5*k)) & 31) * (HalfUlp(p[k]) * (1.0f / 32.0f));
+        return c;
+    }
+
+    inline void EncodeRGB16F(glm::vec3 c, uint16_t* p, uint32_t random) {
+        uint16_t compensation = 0;
+        for (int k = 0; k < 3; k++) {
+            float v = c[k] > 0.0f ? glm::min(c[k], 65504.0f) : 0.0f; // NaN are 0
+            uint16_t h = FloatToHalf(v);
+            float u = ((random >> (10*k)) & 1023) * (1.0f / 1024.0f);
+            uint32_t lost = (uint32_t)glm::min((v - HalfToFloat(h)) / HalfUlp(h) * 32.0f + u, 32.0f);
+            if (lost == 32) {
+                if (h < 0x7bff) {h++; lost = 0;}
+                else lost = 31;
+            }
+            p[k] = h;
+            compensation |= lost << (5*k);
+        }
+        p[3] = compensation;
+    }
+
+
+    // RGB9E5 (EXT_texture_shared_exponent) : 9 bits mantissas, 5 bits exponent biased by 15
+    inline glm::vec3 DecodeRGB9E5(uint32_t v) {
+        float scale = std::ldexp(1.0f, (int)(v >> 27) - 24);
+        return glm::vec3(v & 511, (v >> 9) & 511, (v >> 18) & 511) * scale;
+    }
+
+    inline uint32_t EncodeRGB9E5(glm::vec3 c, uint32_t random) {
+        for (int k = 0; k < 3; k++) c[k] = c[k] > 0.0f ? glm::min(c[k], 65408.0f) : 0.0f; // NaN are 0
+        float maxChannel = glm::max(c.r, glm::max(c.g, c.b));
+
+        int exponent;
+        std::frexp(maxChannel, &exponent);
+        exponent = glm::max(exponent, -15) + 15;
+        float scale = std::ldexp(1.0f, 24 - exponent);
+        if ((uint32_t)(maxChannel * scale + .5f) == 512) {exponent++; scale *= .5f;}
+
+        uint32_t v = (uint32_t)exponent << 27;
+        for (int k = 0; k < 3; k++) {
+            float u = ((random >> (10*k)) & 1023) * (1.0f / 1024.0f);
+            v |= glm::min((uint32_t)(c[k] * scale + u), 511u) << (9*k);
+        }
+        return v;
+    }
+
+
+    // Adds the sampleCount-th sample to a pixel. random feeds the stochastic rounding
+    inline void Accumulate(AccumulationFormat format, uint8_t* pixel, glm::vec3 color, uint32_t sampleCount, uint32_t random) {
+        switch (format) {
+            case AccumulationFormat::RGB16F: {
+                glm::vec3 mean = DecodeRGB16F((const uint16_t*)pixel);
+                EncodeRGB16F(mean + (color - mean) / (float)sampleCount, (uint16_t*)pixel, random);
+                break;
+            }
+            case AccumulationFormat::RGB9E5: {
+                uint32_t v;
+                memcpy(&v, pixel, 4);
+                glm::vec3 mean = DecodeRGB9E5(v);
+                v = EncodeRGB9E5(mean + (color - mean) / (float)sampleCount, random);
+                memcpy(pixel, &v, 4);
+                break;
+            }
+            default: {
+                float* sum = (float*)pixel;
+                for (int k = 0; k < 3; k++) sum[k] += color[k];
+            }
+        }
+    }
+
+    // Mean of the sampleCount samples of a pixel
+    inline glm::vec3 Mean(AccumulationFormat format, const uint8_t* pixel, uint32_t sampleCount) {
+        switch (format) {
+            case AccumulationFormat::RGB16F: return DecodeRGB16F((const uint16_t*)pixel);
+            case AccumulationFormat::RGB9E5: {
+                uint32_t v;
+                memcpy(&v, pixel, 4);
+                return DecodeRGB9E5(v);
+            }
+            default: {
+                const float* sum = (const float*)pixel;
+                return glm::vec3(sum[0], sum[1], sum[2]) / (float)sampleCount;
+            }
+        }
+    }
+
+    // Means of count pixels of a compact format, as 4 floats per pixel (the fourth one unused)
+    inline void DecodeMeans(AccumulationFormat format, const uint8_t* in, float* out, uint32_t count) {
+
+        uint32_t i = 0;
+#if defined(__AVX2__)
+        //2 pixels at a time, one per 128 bits lane : RGB then the unused channel
+        const __m256i shifts16 = _mm256_setr_epi32(0, 5, 10, 0, 0, 5, 10, 0);
+        const __m256i shifts9e5 = _mm256_setr_epi32(0, 9, 18, 0, 0, 9, 18, 0);
+        for (; i + 2 <= count; i += 2) {
+            __m256 mean;
+            if (format == AccumulationFormat::RGB16F) {
+                __m256i h = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(in + 8*i)));
+                __m256i lost = _mm256_and_si256(_mm256_srlv_epi32(_mm256_shuffle_epi32(h, 0xff), shifts16), _mm256_set1_epi32(31));
+                __m256i exponent = _mm256_srli_epi32(h, 10);
+                __m256i subnormal = _mm256_cmpeq_epi32(exponent, _mm256_setzero_si256());
+
+                //Half to float, and 1/32 of the ulp of the half
+                __m256 normal = _mm256_castsi256_ps(_mm256_add_epi32(_mm256_slli_epi32(h, 13), _mm256_set1_epi32(112 << 23)));
+                __m256 high = _mm256_blendv_ps(normal, _mm256_mul_ps(_mm256_cvtepi32_ps(h), _mm256_set1_ps(0x1p-24f)), _mm256_castsi256_ps(subnormal));
+                __m256 step = _mm256_blendv_ps(_mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(exponent, _mm256_set1_epi32(97)), 23)),
+                    _mm256_set1_ps(0x1p-29f), _mm256_castsi256_ps(subnormal));
+                mean = _mm256_add_ps(high, _mm256_mul_ps(_mm256_cvtepi32_ps(lost), step));
+            } else {
+                uint32_t v[2];
+                memcpy(v, in + 4*i, 8);
+                __m256i packed = _mm256_setr_epi32(v[0], v[0], v[0], v[0], v[1], v[1], v[1], v[1]);
+                __m256i mantissa = _mm256_and_si256(_mm256_srlv_epi32(packed, shifts9e5), _mm256_set1_epi32(511));
+                __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_srli_epi32(packed, 27), _mm256_set1_epi32(103)), 23));
+                mean = _mm256_mul_ps(_mm256_cvtepi32_ps(mantissa), scale);
+            }
+            _mm256_storeu_ps(out + 4*i, mean);
+        }
+#endif
+        uint32_t pixelSize = PixelSize(format);
+        for (; i < count; i++) {
+            glm::vec3 mean = Mean(format, in + i*pixelSize, 1);
+            for (int k = 0; k < 3; k++) out[4*i + k] = mean[k];
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include <cstdlib>
+#include <new>
+
+#define CACHE_LINE_SIZE 64
+
+
+//Allocator returning cache line aligned blocks (SoA arrays, SIMD loads)
+template<typename T>
+struct AlignedAllocator {
+
+    using value_type = T;
+
+    AlignedAllocator() = default;
+    template<typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        size_t size = (n * sizeof(T) + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+        void* ptr = std::aligned_alloc(CACHE_LINE_SIZE, size);
+        if (!ptr) throw std::bad_alloc();
+        return (T*)ptr;
+    }
+
+    void deallocate(T* ptr, size_t) { std::free(ptr); }
+
+    template<typename U> bool operator==(const AlignedAllocator<U>&) const { return true; }
+    template<typename U> bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+
+//Read only view of a contiguous array owned elsewhere (a vector, a memory mapped file)
+template<typename T>
+struct ArrayView {
+
+    const T* Data = nullptr;
+    size_t Size = 0;
+
+    ArrayView() = default;
+    ArrayView(const T* data, size_t size) : Data(data), Size(size) {}
+    template<typename Container>
+    ArrayView(const Container& container) : Data(container.data()), Size(container.size()) {}
+
+    const T& operator[](size_t i) const { return Data[i]; }
+    const T* data() const { return Data; }
+    size_t size() const { return Size; }
+    bool empty() const { return Size == 0; }
+    const T* begin() const { return Data; }
+    const T* end() const { return Data + Size; }
+};
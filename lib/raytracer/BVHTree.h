@@ -1,50 +1,74 @@
 #pragma once
 #include <glm/glm.hpp>
 #include <vector>
+#include <atomic>
 #include <cstdio>
 
 #include "Shape.h"
+#include "RayPacket.h"
 
 
 #define BINS 100
+#define PARALLEL_BUILD_MIN_SHAPES 1024      // Subtrees smaller than this are built serially
+#define PARALLEL_BINNING_MIN_SHAPES 65536   // Nodes bigger than this bin their shapes in parallel
+#define REBUILD_SAH_RATIO 1.5f              // Refitted trees (or nodes) this much worse than when built get rebuilt
+#define COMPACT_DEAD_RATIO 0.25f            // Trees with this share of unused nodes (left by partial rebuilds) get compacted
 
 
 //Node of a BVH Tree
 struct BVHNode {
     glm::vec3 aabbMin, aabbMax;
-    uint nbShape;   
+    uint nbShape;
     uint LeftFirst; // if (nbShape == 0) : contains the index of the leftChildNode
-                    // else :              contains the index of the first shape index         
+                    // else :              contains the index of the first shape index
 };
 
 
 //Axis-Aligned Bounding Box
-struct AABB { 
+struct AABB {
 
     glm::vec3 bmin{FLT_MAX}, bmax{-FLT_MAX};
 
     void grow(glm::vec3 p) {
         bmin = glm::min(bmin, p);
-        bmax = glm::max(bmax, p); 
+        bmax = glm::max(bmax, p);
     }
 
-    void grow(AABB& b) {
+    void grow(const AABB& b) {
         if (b.bmin.x != FLT_MAX) {
             grow(b.bmin);
             grow(b.bmax);
         }
     }
 
-    float area() { 
+    float area() const {
         glm::vec3 e = bmax - bmin;
-        return e.x*e.y + e.y*e.z + e.z*e.x; 
+        return e.x*e.y + e.y*e.z + e.z*e.x;
     }
 };
 
-//Bounds of subdivised intervals 
-struct Bin { 
+// Slab test of a box, branchless : the near and far planes of each axis come from the octant
+// of the ray instead of a min/max of both. A NaN slab (0 * inf, origin on a plane parallel to
+// the ray) leaves the interval unchanged. Returns the entry distance (clamped to ray.TMin),
+// FLT_MAX when the box is missed or entered past tMax
+inline float IntersectAABB(const TraversalRay& ray, const glm::vec3& bmin, const glm::vec3& bmax, float tMax) {
+
+    const glm::vec3* planes[2] = { &bmin, &bmax };
+    float tNear = ray.TMin, tFar = tMax;
+    for (int a = 0; a < 3; a++) {
+        float t0 = ((*planes[ray.Sign[a]])[a] - ray.Origin[a]) * ray.InvDirection[a];
+        float t1 = ((*planes[1 - ray.Sign[a]])[a] - ray.Origin[a]) * ray.InvDirection[a];
+        tNear = t0 > tNear ? t0 : tNear; // false for NaN
+        tFar = t1 < tFar ? t1 : tFar;
+    }
+    return tNear <= tFar ? tNear : FLT_MAX;
+}
+
+
+//Bounds of subdivised intervals
+struct Bin {
     AABB bounds;
-    int nbShape = 0; 
+    int nbShape = 0;
 };
 
 
@@ -57,22 +81,213 @@ class BVHTree {
 
         void BuildBVH(const std::vector<Shape*>& shapes);
 
+        // Builds over raw primitive bounds and centroids (static geometry such as meshes),
+        // no refit data is kept
+        void BuildBVH(std::vector<AABB> bounds, std::vector<glm::vec3> centroids);
+
+        // Updates the bounds of one edited shape and of the nodes above it, the tree is
+        // only rebuilt (partially or fully) once its SAH cost degraded past REBUILD_SAH_RATIO
+        void Refit(const std::vector<Shape*>& shapes, int shapeIndex);
+
+        // SAH cost of the tree, relative to the surface area of the root
+        float SAHCost() const;
+
         void Intersect(const Ray& ray, const std::vector<Shape*>& shapes, HitPayLoad& payload) const;
 
+        // Visits the leaves hit by the ray front to back (within [ray.TMin, ray.TMax]).
+        // leaf(first, nbShape) intersects the shapes [first, first + nbShape[ of the leaf
+        // and narrows payload.HitDistance
+        template<typename LeafIntersect>
+        void Traverse(const TraversalRay& ray, HitPayLoad& payload, LeafIntersect&& leaf) const;
+
+        // Whether the ray hits a shape closer than tMax (shadow rays), the traversal stops at
+        // the first hit found. The shape which blocked the previous shadow ray of the thread is
+        // tested first : neighbour rays are mostly blocked by the same one
+        bool Occluded(const Ray& ray, const std::vector<Shape*>& shapes, float tMax) const;
+
+        // Visits the leaves hit by the ray within [ray.TMin, ray.TMax] in no particular order,
+        // until leaf(first, nbShape) returns true (a hit). Returns whether it did
+        template<typename LeafOccluded>
+        bool TraverseAny(const TraversalRay& ray, LeafOccluded&& leaf) const;
+
+        // Closest hits of the rays of a packet (their HitShape is set)
+        void IntersectPacket(RayPacket& packet, const std::vector<Shape*>& shapes) const;
+
+        // Visits the leaves hit by some rays of the packet, culling whole subtrees with
+        // interval arithmetic. leaf(first, nbShape, groups) intersects the groups of rays
+        // still active and narrows their packet.HitDistance
+        template<typename LeafIntersect>
+        void TraversePacket(RayPacket& packet, uint32_t groups, LeafIntersect&& leaf) const;
+
     private:
 
-        void UpdateNodeBounds(uint nodeId, const std::vector<Shape*>& shapes);
+        void Build();
 
-        float FindBestSplitPlane(BVHNode& node, int& axis, float& splitPos, const std::vector<Shape*>& shapes);
+        void UpdateNodeBounds(uint nodeId);
+
+        float FindBestSplitPlane(const BVHNode& node, int& axis, float& splitPos) const;
 
         float CalcNodeCost(BVHNode& node);
 
-        void Subdivide(int nodeId, const std::vector<Shape*>& shapes);
+        void Subdivide(int nodeId, std::atomic<int>& nodeCounter);
+
+        float EvaluateSAH(BVHNode& node, int axis, float pos);
+
+        void RefitPath(int nodeId);
 
-        float EvaluateSAH(BVHNode& node, int axis, float pos, const std::vector<Shape*>& shapes);
+        void RebuildSubtree(int nodeId);
 
-        void IntersectBVH(const Ray& ray, const std::vector<Shape*>& shapes, const uint nodeId, HitPayLoad& payload) const;
+        void LinkSubtree(int nodeId, int parentId);
+
+        void Compact();
+
+        void ComputeCost();
+
+    private:
+        // Bounds and centroids of the shapes, gathered once before the build so that
+        // the (parallel) subdivision never goes through the Shape virtual calls
+        std::vector<AABB> m_ShapeBounds;
+        std::vector<glm::vec3> m_ShapeCentroids;
+
+        // Refit data
+        std::vector<int> m_Parent;       // Parent of each node (-1 for the root)
+        std::vector<int> m_ShapeLeaf;    // Leaf node holding each shape
+        std::vector<float> m_BuildArea;  // Surface area of each node when it was built
+        int m_NbDeadNode = 0;            // Nodes below nodesUsed no longer in the tree
+        double m_InteriorCost = 0.0, m_LeafCost = 0.0;
+        float m_BuildCost = 0.0f;
+
+        // Index in the shapes of the last occluder found by the thread (only a hint, it is
+        // checked against the shapes of the query)
+        static thread_local uint32_t s_LastOccluder;
+
+};
+
+
+template<typename LeafIntersect>
+void BVHTree::Traverse(const TraversalRay& ray, HitPayLoad& payload, LeafIntersect&& leaf) const {
+
+    if (nodes.empty()) return;
+
+    const BVHNode* node = &nodes[rootNodeId];
+    const BVHNode* stack[64]; //Stack to visit node front to back
+    uint stackPtr = 0;
+
+    if (IntersectAABB(ray, node->aabbMin, node->aabbMax, glm::min(payload.HitDistance, ray.TMax)) == FLT_MAX) return;
+
+    while(true) {
+        if (node->nbShape > 0) {
+            leaf(node->LeftFirst, node->nbShape);
+            if (stackPtr == 0) break;
+            else node = stack[--stackPtr];
+            continue;
+        }
 
-        float IntersectAABB(const Ray& ray, const glm::vec3& bmin, const glm::vec3& bmax, float tMax) const;
+        const BVHNode* child1 = &nodes[node->LeftFirst];
+        const BVHNode* child2 = &nodes[node->LeftFirst + 1];
 
-};
\ No newline at end of file
+        float tMax = glm::min(payload.HitDistance, ray.TMax);
+        float dist1 = IntersectAABB(ray, child1->aabbMin, child1->aabbMax, tMax);
+        float dist2 = IntersectAABB(ray, child2->aabbMin, child2->aabbMax, tMax);
+        if (dist1 > dist2) {
+            std::swap( dist1, dist2);
+            std::swap( child1, child2);
+        }
+        if (dist1 == FLT_MAX) { //miss
+            if (stackPtr == 0) break;
+            else node = stack[--stackPtr];
+        } else {
+            node = child1;
+            if (dist2 != FLT_MAX) stack[stackPtr++] = child2;
+        }
+
+    }
+}
+
+
+template<typename LeafOccluded>
+bool BVHTree::TraverseAny(const TraversalRay& ray, LeafOccluded&& leaf) const {
+
+    if (nodes.empty()) return false;
+
+    const BVHNode* node = &nodes[rootNodeId];
+    const BVHNode* stack[64];
+    uint stackPtr = 0;
+
+    if (IntersectAABB(ray, node->aabbMin, node->aabbMax, ray.TMax) == FLT_MAX) return false;
+
+    //Nearest child first, as the occluder is often the first surface on the way. Any hit ends
+    //the query, so the distance never narrows
+    while (true) {
+        if (node->nbShape > 0) {
+            if (leaf(node->LeftFirst, node->nbShape)) return true;
+        } else {
+            const BVHNode* child1 = &nodes[node->LeftFirst];
+            const BVHNode* child2 = child1 + 1;
+            float dist1 = IntersectAABB(ray, child1->aabbMin, child1->aabbMax, ray.TMax);
+            float dist2 = IntersectAABB(ray, child2->aabbMin, child2->aabbMax, ray.TMax);
+            if (dist1 > dist2) {
+                std::swap(dist1, dist2);
+                std::swap(child1, child2);
+            }
+            if (dist1 != FLT_MAX) {
+                if (dist2 != FLT_MAX) stack[stackPtr++] = child2;
+                node = child1;
+                continue;
+            }
+        }
+        if (stackPtr == 0) return false;
+        node = stack[--stackPtr];
+    }
+}
+
+
+template<typename LeafIntersect>
+void BVHTree::TraversePacket(RayPacket& packet, uint32_t groups, LeafIntersect&& leaf) const {
+
+    if (nodes.empty()) return;
+
+    struct StackEntry {
+        uint nodeId;
+        uint32_t groups;
+    };
+    StackEntry stack[64];
+    uint stackPtr = 0;
+
+    const BVHNode& root = nodes[rootNodeId];
+    groups = IntersectPacketGroups(packet, root.aabbMin, root.aabbMax, groups);
+    if (groups) stack[stackPtr++] = {(uint)rootNodeId, groups};
+
+    while (stackPtr > 0) {
+
+        const StackEntry entry = stack[--stackPtr];
+        const BVHNode& node = nodes[entry.nodeId];
+
+        if (node.nbShape > 0) {
+            leaf(node.LeftFirst, node.nbShape, entry.groups);
+            continue;
+        }
+
+        float maxHitDistance = packet.MaxHitDistance(entry.groups);
+
+        StackEntry children[2];
+        float dist[2];
+        int nbHit = 0;
+        for (uint c = 0; c < 2; c++) {
+            const BVHNode& child = nodes[node.LeftFirst + c];
+
+            float tNear;
+            if (!IntersectPacketInterval(packet, child.aabbMin, child.aabbMax, maxHitDistance, tNear)) continue;
+
+            uint32_t childGroups = IntersectPacketGroups(packet, child.aabbMin, child.aabbMax, entry.groups);
+            if (!childGroups) continue;
+
+            children[nbHit] = {node.LeftFirst + c, childGroups};
+            dist[nbHit++] = tNear;
+        }
+
+        //Push the farthest child first
+        if (nbHit == 2 && dist[1] < dist[0]) std::swap(children[0], children[1]);
+        for (int i = nbHit - 1; i >= 0; i--) stack[stackPtr++] = children[i];
+    }
+}
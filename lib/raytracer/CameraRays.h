@@ -0,0 +1,34 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cmath>
+
+#include "Walnut/Camera.h"
+#include "raytracer/Simd.h"
+
+
+// Camera rays are generated where they are traced, from the basis of the camera. The scalar
+// and SIMD versions do the same operations so that every trace mode gets the same rays.
+
+
+// Direction of the ray through (x, y), in pixels from the corner of the image
+inline glm::vec3 CameraRayDirection(const Camera::RayBasis& basis, float x, float y) {
+
+    float d[3];
+    for (int a = 0; a < 3; a++) d[a] = (basis.Corner[a] + basis.StepX[a] * x) + basis.StepY[a] * y;
+
+    float invLength = 1.0f / std::sqrt((d[0] * d[0] + d[1] * d[1]) + d[2] * d[2]);
+    return glm::vec3(d[0] * invLength, d[1] * invLength, d[2] * invLength);
+}
+
+
+// Directions of the W rays through (x[i], y[i])
+template<int W>
+inline void CameraRayDirections(const Camera::RayBasis& basis, vfloat<W> x, vfloat<W> y, vfloat<W> direction[3]) {
+
+    for (int a = 0; a < 3; a++)
+        direction[a] = (vfloat<W>(basis.Corner[a]) + vfloat<W>(basis.StepX[a]) * x) + vfloat<W>(basis.StepY[a]) * y;
+
+    vfloat<W> invLength = vfloat<W>(1.0f) / sqrt((direction[0] * direction[0] + direction[1] * direction[1]) + direction[2] * direction[2]);
+    for (int a = 0; a < 3; a++) direction[a] = direction[a] * invLength;
+}
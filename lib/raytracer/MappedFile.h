@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+
+//Read only memory mapping of a whole file, throws std::runtime_error if it cannot be opened
+class MappedFile {
+
+public:
+    // sequential : hints the kernel that the file is read once from start to end (parsers),
+    // otherwise the whole file is prefetched (data used in place)
+    MappedFile(const std::string& path, bool sequential = true);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* Data() const { return m_Data; }
+    size_t Size() const { return m_Size; }
+
+private:
+    int m_File = -1;
+    const char* m_Data = nullptr;
+    size_t m_Size = 0;
+};
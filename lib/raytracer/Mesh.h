@@ -0,0 +1,135 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <memory>
+#include "raytracer/Shape.h"
+#include "raytracer/BVHTree.h"
+#include "raytracer/WideBVH.h"
+#include "raytracer/AlignedVector.h"
+#include "raytracer/ArrayView.h"
+#include "raytracer/MappedFile.h"
+
+#define MESH_TRIANGLE_PADDING 8 // Degenerate triangles after the last one, leaves are tested SIMD_WIDTH triangles at a time
+
+
+// Geometry of a triangle mesh : a vertex/index buffer shared by the triangles, plus their
+// intersection data as a structure of arrays. Both are stored in BVH leaf order so that the
+// leaves of the mesh BVH index straight into them.
+// The arrays are views, either on the buffers built by the mesh or on a scene cache file
+// used in place (see SceneCache).
+struct MeshData {
+
+    ArrayView<glm::vec3> Vertices;
+    ArrayView<uint32_t> Indices;    // 3 vertex indices per triangle
+
+    // Vertices of each triangle (one array per axis) for the watertight test, followed by
+    // MESH_TRIANGLE_PADDING degenerate ones
+    ArrayView<float> V0[3];
+    ArrayView<float> V1[3];
+    ArrayView<float> V2[3];
+
+    AABB Bounds;
+    BVHTree bvh;            // Binary tree the wide one is collapsed from (nodes released after)
+    float SAHCost = 0.0f;   // Of the binary tree, kept once its nodes are released
+#if BVH_WIDTH > 2
+    WideBVH<BVH_WIDTH> wbvh;
+#endif
+
+    MeshData(std::vector<glm::vec3> vertices, std::vector<uint32_t> indices);
+
+    // Empty geometry whose views are set on the mapped file, which is kept alive with it
+    MeshData(std::shared_ptr<const MappedFile> file) : m_File(std::move(file)) {}
+
+    MeshData(const MeshData&) = delete;
+    MeshData& operator=(const MeshData&) = delete;
+
+    template<typename LeafIntersect>
+    void Traverse(const TraversalRay& ray, HitPayLoad& payload, LeafIntersect&& leaf) const {
+#if BVH_WIDTH > 2
+        wbvh.Traverse(ray, payload, leaf);
+#else
+        bvh.Traverse(ray, payload, leaf);
+#endif
+    }
+
+    template<typename LeafOccluded>
+    bool TraverseAny(const TraversalRay& ray, LeafOccluded&& leaf) const {
+#if BVH_WIDTH > 2
+        return wbvh.TraverseAny(ray, leaf);
+#else
+        return bvh.TraverseAny(ray, leaf);
+#endif
+    }
+
+    template<typename LeafIntersect>
+    void TraversePacket(RayPacket& packet, uint32_t groups, LeafIntersect&& leaf) const {
+#if BVH_WIDTH > 2
+        wbvh.TraversePacket(packet, groups, leaf);
+#else
+        bvh.TraversePacket(packet, groups, leaf);
+#endif
+    }
+
+    size_t TriangleCount() const { return Indices.size() / 3; }
+    size_t MemoryUsage() const;
+
+private:
+    std::vector<glm::vec3> m_Vertices;
+    std::vector<uint32_t> m_Indices;
+    AlignedVector<float> m_Triangles[9]; // V0, V1, V2
+    std::shared_ptr<const MappedFile> m_File;
+};
+
+
+// Instance of a mesh geometry with its own affine transform : the geometry and its BVH are
+// in object space and shared, the rays are moved to object space to be intersected.
+class Mesh : public Shape {
+
+public:
+    Mesh(std::vector<glm::vec3> vertices, std::vector<uint32_t> indices, int materialIndex = 0);
+    Mesh(std::shared_ptr<const MeshData> data, int materialIndex = 0);
+
+    glm::vec3 GetAABBMin() const override;
+    glm::vec3 GetAABBMax() const override;
+
+    Shape* Clone() const override { return new Mesh(*this); }
+
+    virtual bool intersect(const Ray& ray, float& intersectT) const;
+    virtual bool intersect(const Ray& ray, HitPayLoad& payload) const;
+    uint64_t IntersectPacket(RayPacket& packet, uint32_t groups) const override;
+    bool Occluded(const TraversalRay& ray) const override;
+    bool SampleLight(const glm::vec3& p, glm::vec2 u, LightSample& sample) const override;
+    float LightPdf(const Ray& ray, const HitPayLoad& payload) const override;
+    virtual void ClosestHit(const Ray& ray, HitPayLoad& payload);
+
+    bool RenderUiSettings(int index, Scene& scene) override;
+
+    // Updates the transform (and the world bounds) from Position, Rotation and Scale, to call
+    // once they changed
+    void UpdateTransform();
+
+public:
+    std::shared_ptr<const MeshData> Data; // Geometry, shared between the instances
+    glm::vec3 Rotation{0.0f};             // Euler angles in degrees, around Position
+    glm::vec3 Scale{1.0f};
+
+private:
+    bool IntersectObject(const Ray& ray, HitPayLoad& payload) const;
+    uint64_t IntersectPacketObject(RayPacket& packet, uint32_t groups) const;
+    bool OccludedObject(const TraversalRay& ray) const;
+    void GetWorldTriangle(uint32_t i, glm::vec3 p[3]) const;
+
+private:
+    // Position is the center of the geometry in the world, an instance left where the mesh was
+    // built has no transform and its rays are not moved
+    bool m_Transformed = false;
+    glm::mat4 m_ObjectToWorld{1.0f};
+    glm::mat4 m_WorldToObject{1.0f};
+    glm::mat3 m_NormalToWorld{1.0f};      // Inverse transpose of the linear part
+    AABB m_Bounds;                        // In world space
+
+    // First triangle of the SIMD_WIDTH ones which blocked the last shadow ray of the thread,
+    // tested before the traversal (only a hint, it is checked against the size of the mesh)
+    static thread_local uint32_t s_LastOccluder;
+};
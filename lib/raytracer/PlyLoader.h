@@ -0,0 +1,24 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define PLY_CHUNK_SIZE (1 << 20) // Bytes of ASCII data parsed per task
+
+
+// PLY reader for the startup path : the file is memory mapped and parsed in parallel chunks
+// (ASCII, binary little and big endian) straight into flat buffers.
+// Only the vertex positions and the faces are read, polygons are split in triangle fans.
+// ASCII elements are one per line, blank lines are skipped.
+// Throws std::runtime_error on unreadable or malformed files.
+namespace PlyLoader {
+
+    void Load(const std::string& path, std::vector<glm::vec3>& vertices, std::vector<uint32_t>& indices);
+
+    // Parses a decimal float ([+-]digits[.digits][(e|E)[+-]digits]), returns the first
+    // character after it. Returns str itself when there is none or when it is not finite as a
+    // float (inf, nan, out of range)
+    const char* ParseFloat(const char* str, const char* end, float& value);
+}
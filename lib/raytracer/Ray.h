@@ -1,6 +1,8 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <cfloat>
+#include <utility>
 
 class Shape;
 
@@ -9,10 +11,43 @@ struct Ray {
     glm::vec3 Direction;
 };
 
+//Ray prepared once for a traversal : reciprocal direction and octant for the slab tests of
+//the boxes, interval of the hits searched, and shear of the watertight triangle test
+struct TraversalRay : Ray {
+
+    glm::vec3 InvDirection;
+    int Sign[3];        // Octant : 1 where the direction is negative, the near plane of a box is then its max
+    float TMin, TMax;
+
+    int kx, ky, kz;     // The dominant axis of the direction becomes z
+    float Sx, Sy, Sz;   // Shear bringing the direction onto z
+
+    TraversalRay() = default;
+    TraversalRay(const Ray& ray, float tMin = 0.0f, float tMax = FLT_MAX) : Ray(ray), TMin(tMin), TMax(tMax) {
+
+        for (int a = 0; a < 3; a++) {
+            InvDirection[a] = 1.0f / Direction[a];
+            Sign[a] = InvDirection[a] < 0.0f;
+        }
+
+        glm::vec3 d = glm::abs(Direction);
+        kz = d.x > d.y ? (d.x > d.z ? 0 : 2) : (d.y > d.z ? 1 : 2);
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        if (Direction[kz] < 0.0f) std::swap(kx, ky); //Keeps the winding
+
+        Sx = Direction[kx] / Direction[kz];
+        Sy = Direction[ky] / Direction[kz];
+        Sz = 1.0f / Direction[kz];
+    }
+};
+
 struct HitPayLoad {
     float HitDistance;
     glm::vec3 WorldPosition;
     glm::vec3 WorldNormal;
 
     Shape* HitShape;
-};
\ No newline at end of file
+    uint32_t PrimitiveId;   // Triangle hit inside a Mesh
+    glm::vec2 Barycentric;  // Weights of the 2nd and 3rd vertices of the triangle hit
+};
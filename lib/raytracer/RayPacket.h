@@ -0,0 +1,161 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cfloat>
+#include <cstdint>
+
+#include "raytracer/Ray.h"
+#include "raytracer/Simd.h"
+#include "raytracer/AlignedVector.h"
+#include "raytracer/TriangleKernel.h"
+
+
+#define PACKET_WIDTH 8                              // Packets cover 8x8 pixels
+#define PACKET_SIZE (PACKET_WIDTH * PACKET_WIDTH)
+#define PACKET_GROUPS (PACKET_SIZE / SIMD_WIDTH)    // Rays are tested SIMD_WIDTH at a time
+
+#define ALL_GROUPS ((uint32_t)((1ull << PACKET_GROUPS) - 1))
+
+
+// Coherent rays sharing their origin (primary rays of a block of pixels). Groups of
+// SIMD_WIDTH rays are tracked with a bit mask, and a hit mask has one bit per ray.
+struct alignas(CACHE_LINE_SIZE) RayPacket {
+
+    glm::vec3 Origin;
+    alignas(32) float Direction[3][PACKET_SIZE];
+    alignas(32) float InvDirection[3][PACKET_SIZE];
+
+    //Watertight triangle test : shear of each ray (Sx, Sy, Sz), and the axes (kx, ky, kz)
+    //of each group when all its rays share them (kz = -1 otherwise)
+    alignas(32) float Shear[3][PACKET_SIZE];
+    int8_t GroupAxis[PACKET_GROUPS][3];
+
+    //Closest hit of each ray
+    alignas(32) float HitDistance[PACKET_SIZE];
+    uint32_t PrimitiveId[PACKET_SIZE];
+    Shape* HitShape[PACKET_SIZE];
+    alignas(32) float Barycentric[2][PACKET_SIZE];
+
+    //Bounds of the inverse directions, valid for interval culling when Coherent
+    //(the directions have the same sign on each axis)
+    glm::vec3 InvDirMin, InvDirMax;
+    bool Coherent;
+
+    // To call once Origin and Direction are filled
+    void Init() {
+
+        InvDirMin = glm::vec3(FLT_MAX);
+        InvDirMax = glm::vec3(-FLT_MAX);
+
+        for (int a = 0; a < 3; a++) {
+            for (int i = 0; i < PACKET_SIZE; i++) {
+                InvDirection[a][i] = 1.0f / Direction[a][i];
+                InvDirMin[a] = glm::min(InvDirMin[a], InvDirection[a][i]);
+                InvDirMax[a] = glm::max(InvDirMax[a], InvDirection[a][i]);
+            }
+        }
+
+        Coherent = true;
+        for (int a = 0; a < 3; a++)
+            Coherent &= (InvDirMin[a] > 0.0f || InvDirMax[a] < 0.0f) && InvDirMin[a] > -FLT_MAX && InvDirMax[a] < FLT_MAX;
+
+        for (int g = 0; g < PACKET_GROUPS; g++) {
+            bool uniform = true;
+            for (int i = g * SIMD_WIDTH; i < (g + 1) * SIMD_WIDTH; i++) {
+                TraversalRay ray(Ray{Origin, GetDirection(i)});
+                Shear[0][i] = ray.Sx;
+                Shear[1][i] = ray.Sy;
+                Shear[2][i] = ray.Sz;
+                if (i == g * SIMD_WIDTH) {
+                    GroupAxis[g][0] = ray.kx;
+                    GroupAxis[g][1] = ray.ky;
+                    GroupAxis[g][2] = ray.kz;
+                }
+                uniform &= GroupAxis[g][0] == ray.kx && GroupAxis[g][1] == ray.ky && GroupAxis[g][2] == ray.kz;
+            }
+            if (!uniform) GroupAxis[g][2] = -1;
+        }
+
+        for (int i = 0; i < PACKET_SIZE; i++) {
+            HitDistance[i] = FLT_MAX;
+            PrimitiveId[i] = 0;
+            HitShape[i] = nullptr;
+        }
+    }
+
+    glm::vec3 GetDirection(int i) const {
+        return glm::vec3(Direction[0][i], Direction[1][i], Direction[2][i]);
+    }
+
+    float MaxHitDistance(uint32_t groups) const {
+        vfloatN maxDist(-FLT_MAX);
+        for (int g = 0; g < PACKET_GROUPS; g++)
+            if (groups & (1u << g)) maxDist = max(maxDist, vfloatN::load(&HitDistance[g * SIMD_WIDTH]));
+
+        alignas(32) float lanes[SIMD_WIDTH];
+        maxDist.store(lanes);
+        float result = lanes[0];
+        for (int i = 1; i < SIMD_WIDTH; i++) result = glm::max(result, lanes[i]);
+        return result;
+    }
+};
+
+
+// Conservative test of the whole packet against a box, with interval arithmetic over the
+// inverse directions. Always passes for incoherent packets.
+inline bool IntersectPacketInterval(const RayPacket& packet, const glm::vec3& bmin, const glm::vec3& bmax, float maxHitDistance, float& tNear) {
+
+    if (!packet.Coherent) {
+        tNear = 0.0f;
+        return true;
+    }
+
+    float nearLo = -FLT_MAX, farHi = FLT_MAX;
+    for (int a = 0; a < 3; a++) {
+        bool positive = packet.InvDirMin[a] > 0.0f;
+        float nearPlane = (positive ? bmin[a] : bmax[a]) - packet.Origin[a];
+        float farPlane = (positive ? bmax[a] : bmin[a]) - packet.Origin[a];
+
+        //Bound of the interval picked from the sign of the plane rather than with min/max of
+        //both products, and compared so that a NaN leaves the interval unchanged, as in IntersectAABB
+        float tNearPlane = nearPlane * (nearPlane >= 0.0f ? packet.InvDirMin[a] : packet.InvDirMax[a]);
+        float tFarPlane = farPlane * (farPlane >= 0.0f ? packet.InvDirMax[a] : packet.InvDirMin[a]);
+        nearLo = tNearPlane > nearLo ? tNearPlane : nearLo;
+        farHi = tFarPlane < farHi ? tFarPlane : farHi;
+    }
+
+    tNear = nearLo;
+    return nearLo <= farHi && farHi > 0.0f && nearLo < maxHitDistance;
+}
+
+
+// Slab test of each ray of the given groups, returns the groups with at least one hit
+inline uint32_t IntersectPacketGroups(const RayPacket& packet, const glm::vec3& bmin, const glm::vec3& bmax, uint32_t groups) {
+
+    vfloatN toMin[3], toMax[3];
+    for (int a = 0; a < 3; a++) {
+        toMin[a] = vfloatN(bmin[a] - packet.Origin[a]);
+        toMax[a] = vfloatN(bmax[a] - packet.Origin[a]);
+    }
+
+    uint32_t hitGroups = 0;
+    for (int g = 0; g < PACKET_GROUPS; g++) {
+        if (!(groups & (1u << g))) continue;
+
+        //Near and far planes of each ray from the sign of its inverse direction. max/min return
+        //their second operand when the first is NaN (0 * inf, origin on a plane of the box), so
+        //a NaN slab leaves the interval unchanged
+        vfloatN tMin(-FLT_MAX), tMax(FLT_MAX);
+        for (int a = 0; a < 3; a++) {
+            vfloatN inv = vfloatN::load(&packet.InvDirection[a][g * SIMD_WIDTH]);
+            vfloatN negative = inv < vfloatN(0.0f);
+            tMin = max(select(negative, toMax[a], toMin[a]) * inv, tMin);
+            tMax = min(select(negative, toMin[a], toMax[a]) * inv, tMax);
+        }
+
+        vfloatN hitDist = vfloatN::load(&packet.HitDistance[g * SIMD_WIDTH]);
+        if (movemask((tMax >= tMin) & (tMin < hitDist) & (tMax > vfloatN(0.0f))))
+            hitGroups |= 1u << g;
+    }
+    return hitGroups;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "raytracer/Renderer.h"
+#include "Walnut/Camera.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <utility>
+
+#define NEW_FRAME_BIT 0x4 // Set on the shared frame index when it was not acquired yet
+
+
+//Finished frame handed over from the render thread to the UI
+struct RenderFrame {
+    std::vector<uint32_t> Pixels; // RGBA8
+    uint32_t Width = 0, Height = 0;
+    uint32_t Index = 0;       // Frames published before it
+    std::vector<Renderer::Region> Regions; // Of the pixels that changed since the previous frame published
+    uint32_t Version = 0;     // Version of the commands it was rendered with
+    uint32_t SampleCount = 0; // Frames accumulated in it
+    float RenderTime = 0.0f;  // ms
+    Renderer::TileStats TileStats;
+    Renderer::FrameStats FrameStats;
+    std::vector<float> TileTimes;
+};
+
+
+// Runs a Renderer on its own thread, which owns the accumulation. The UI posts its edits as
+// versioned commands and picks the last finished frame without ever waiting for the renderer
+class RenderThread {
+
+public:
+    RenderThread();
+    ~RenderThread();
+
+    // Every post gets a new version : the frame being rendered is cancelled at the next
+    // tile and the accumulation restarts with the edit.
+    // PostScene copies the whole scene (loads, shapes added or removed). Edits of one shape
+    // or of the materials post only what changed, the render thread refits its own tree
+    void PostScene(const Scene& scene);
+    void PostShape(uint32_t index, const Shape& shape);
+    void PostMaterials(const std::vector<Material>& materials);
+    void PostCamera(const Camera& camera);
+    void PostSettings(const Renderer::Settings& settings);
+    void PostResize(uint32_t width, uint32_t height);
+    void PostReset();
+
+    void SetPaused(bool paused);
+    bool IsPaused() const { return m_Paused; }
+
+    // Last finished frame, or nullptr when none was published since the previous call.
+    // The frame stays valid until the next call. When it directly follows the previous one
+    // (Index), only its Regions need to be uploaded
+    const RenderFrame* AcquireFrame();
+
+private:
+    void Run();
+    bool CanRender() const;
+    void Publish(uint32_t version, float renderTime);
+
+    //Edits not picked by the render thread yet, the later ones replace the earlier ones.
+    //The shapes are applied in order over the scene (a new scene drops them)
+    struct Command {
+        std::unique_ptr<Scene> NewScene;
+        std::vector<std::pair<uint32_t, std::unique_ptr<Shape>>> NewShapes;
+        std::unique_ptr<std::vector<Material>> NewMaterials;
+        std::unique_ptr<Camera> NewCamera;
+        std::unique_ptr<Renderer::Settings> NewSettings;
+        uint32_t Width = 0, Height = 0;
+        bool Resize = false;
+        bool Pending = false;
+    };
+    void Apply(Command& command);
+
+private:
+    //Render thread state
+    Renderer m_Renderer;
+    std::unique_ptr<Scene> m_Scene;
+    std::unique_ptr<Camera> m_Camera;
+
+    std::mutex m_CommandMutex;
+    std::condition_variable m_CommandPosted;
+    Command m_Command;
+    std::atomic<uint32_t> m_Version{0};
+    std::atomic<bool> m_Stop{false}, m_Paused{false};
+
+    //Triple buffer : the render thread fills the back frame then swaps it with the shared one,
+    //the UI swaps its front frame with the shared one when it holds a new frame
+    RenderFrame m_Frames[3];
+    std::atomic<uint32_t> m_SharedFrame{1};
+    uint32_t m_BackFrame = 0, m_FrontFrame = 2;
+    uint32_t m_NbPublished = 0;
+
+    //Regions of the image each frame misses since it was last published, only copied when it
+    //is published again (render thread)
+    std::vector<Renderer::Region> m_StaleRegions[3];
+    uint64_t m_StalePixels[3] = {};
+
+    std::thread m_Thread;
+};
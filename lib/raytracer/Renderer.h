@@ -1,51 +1,230 @@
 #pragma once
 
-#include "Walnut/Image.h"
 #include "Walnut/Camera.h"
 #include "raytracer/Ray.h"
+#include "raytracer/AlignedVector.h"
+#include "raytracer/Sampler.h"
+#include "raytracer/Tonemap.h"
+#include "raytracer/Accumulation.h"
 #include "Scene.h"
-#include <memory>
+#include <functional>
+#include <atomic>
 
 #include <glm/glm.hpp>
+#include <tbb/task_arena.h>
 
+#define MAX_PREVIEW_LEVEL 2 // Preview passes render 1/16 of the pixels at least
  
 class Renderer {
 
 public:
+    enum class TraceMode {
+        Pixel = 0,  // Depth first path per pixel
+        Packet,     // Primary rays traced as 8x8 packets, then depth first per pixel
+        Wavefront   // All the paths advance one bounce at a time, stage by stage
+    };
+
     struct Settings {
         bool Accumulate = true;
+        TraceMode Mode = TraceMode::Packet;
+        uint32_t TileSize = 32; // Side of the tiles in pixels, rounded up to a multiple of the packet width
+        bool LightSampling = true; // Next event estimation toward the emissive shapes, weighted (MIS) with the bounces
+        uint32_t MaxDepth = 5;      // Rays traced per path at most
+        uint32_t RouletteDepth = 3; // Rays traced before Russian roulette may end a path (>= MaxDepth disables it)
+        bool Adaptive = true;       // Converged tiles are no longer rendered (when accumulating)
+        float AdaptiveThreshold = 0.01f;  // Relative standard error of the luminance under which a pixel has converged
+        uint32_t AdaptiveMinSamples = 32; // Samples before a tile may converge
+        uint32_t AdaptiveMaxSamples = 4;  // Samples per frame at most of a tile above the threshold, in proportion to its error
+        SamplerType Sampling = SamplerType::Sobol;
+        bool Jitter = true;         // Camera rays through a random point of their pixel (anti-aliasing), else its center
+        Tonemap Tonemapping = Tonemap::Clamp;
+        bool SRGB = true;           // Output encoded in sRGB, else linear
+        AccumulationFormat Accumulation = AccumulationFormat::RGB32F;
+        float PreviewBudgetMs = 33.0f; // Frame time aimed at while the first sample is refined after a reset (0 renders it at once)
     };
 
+    //Render time of the tiles of the last frame
+    struct TileStats {
+        uint32_t NbTile = 0;
+        float MinMs = 0.0f, AvgMs = 0.0f, MaxMs = 0.0f;
+    };
+
+    struct FrameStats {
+        float AvgPathLength = 0.0f; // Rays traced per pixel rendered, camera ray included
+        uint32_t NbConvergedTile = 0;
+        float ResolveMs = 0.0f;     // Accumulation to RGBA8
+        float Coverage = 1.0f;      // Fraction of the pixels that have their first sample
+    };
+
+    //Rectangle of the image, in pixels
+    struct Region {
+        uint32_t x, y, width, height;
+    };
+
+
+    // Polled between tiles (and wavefront stages), a frame stops as soon as it returns true
+    using CancelCallback = std::function<bool()>;
 
     Renderer() = default;
 
     void OnResize(u_int32_t width, uint32_t height);
-    void Render(const Scene& scene, const Camera& camera);
-    std::shared_ptr<Walnut::Image> GetFinalImage() const {return m_FinalImage; };
+    // Returns false when the frame was cancelled, its samples must then be reset
+    bool Render(const Scene& scene, const Camera& camera, const CancelCallback& cancelled = {});
 
-    void ResetFrameIndex() { m_FrameIndex = 1;};
+    uint32_t GetWidth() const {return m_Width;}
+    uint32_t GetHeight() const {return m_Height;}
+    const uint32_t* GetImageData() const {return m_ImageData;} // RGBA8, written by Render
+    uint32_t GetFrameIndex() const {return m_FrameIndex;}
+
+    void ResetFrameIndex() { m_FrameIndex = 1; m_NbConvergedTile = 0; m_PreviewPass = 0;};
+    // Every tile has converged, rendering more frames changes nothing
+    bool IsConverged() const {return m_NbConvergedTile > 0 && m_NbConvergedTile == m_Tiles.size();}
     Settings& GetSettings(){return m_Settings;}
+    const std::vector<float>& GetTileTimes() const {return m_TileTimes;} // In ms, in the tile order
+    const TileStats& GetTileStats() const {return m_TileStats;}
+    const FrameStats& GetFrameStats() const {return m_FrameStats;}
+    // Of the image data resolved by the last Render, the rest of it did not change
+    const std::vector<Region>& GetResolvedRegions() const {return m_ResolvedRegions;}
 
     ~Renderer() {
         delete[] m_AccumulationData;
+        delete[] m_SquaredLuminance;
         delete[] m_ImageData;
     }
 
 private:
 
-    glm::vec4 PerPixel(uint32_t x, uint32_t y); //Raygen
+    // Raygen, adds the rays traced to pathLength
+    glm::vec4 PerPixel(uint32_t x, uint32_t y, uint32_t& pathLength, const HitPayLoad* primaryHit = nullptr);
+    // Point of the pixel the camera ray goes through, in pixels
+    glm::vec2 CameraSample(uint32_t x, uint32_t y) const;
+    // Of the sample being rendered at a pixel : the samples its tile already has
+    uint32_t SampleIndex(uint32_t x, uint32_t y) const {return m_Tiles[m_TileGrid[x / m_TileSize + y / m_TileSize * m_NbTileX]].NbSample;}
     HitPayLoad TraceRay(const Ray& ray);
+    void ResolveHit(const Ray& ray, HitPayLoad& payload);
+
+    //Path state carried from a bounce to the next
+    struct PathState {
+        glm::vec3 Throughput{1.0f};
+        float BsdfPdf = 0.0f;               // Solid angle pdf of the last bounce (0 for camera rays)
+        const Shape* LastShape = nullptr;   // Shape the last bounce left from
+    };
+
+    // Light of a bounce, its light sample only counts once its shadow ray is found unoccluded
+    // (wavefront connect stage)
+    struct BounceLight {
+        glm::vec3 Light;            // Emission or sky
+        glm::vec3 SampleLight;
+        Ray Shadow;
+        float ShadowDistance = 0.0f; // 0 : no shadow ray
+        uint32_t Pixel;
+    };
+
+    // Light gathered at a hit (its emission and a light sample), then the ray and the state
+    // move on to the next bounce. With deferred, the light sample and its shadow ray go there
+    // instead of being traced
+    glm::vec3 ShadeHit(Ray& ray, const HitPayLoad& payload, PathState& state, Sampler& sampler, BounceLight* deferred = nullptr) const;
+    // Whether the path goes on after its ray of the given depth (0 for the camera one) was
+    // shaded : stops at MaxDepth, then Russian roulette on the throughput
+    bool ContinuePath(PathState& state, uint32_t depth, Sampler& sampler) const;
+    void UpdateLights();
+
+    bool IsCancelled() const {return m_Cancelled && m_Cancelled();}
+
+    void UpdateTiles();
+    void RenderTile(uint32_t tileIndex);
+    void RenderBlock(uint32_t x0, uint32_t y0, uint32_t& pathLength);
+    // Allocates the accumulation buffer in the format of the settings when it changed
+    void UpdateAccumulation();
+    void AccumulatePixel(uint32_t x, uint32_t y, const glm::vec3& color);
+    // Image data of the tiles rendered since the last resolve
+    void Resolve();
+    void ResolveTile(uint32_t tileIndex);
+    template<int STRIDE>
+    void ResolveRow(const float* in, uint32_t* out, uint32_t count, float scale) const;
+    bool IsAdaptive() const {return m_Settings.Adaptive && m_Settings.Accumulate;}
+
+    // After a reset, the first sample may be rendered in passes over one pixel of each block of
+    // 2^level x 2^level, interleaved from the coarsest grid, as many per frame as the budget
+    // allows. The pixels still missing repeat the finest complete grid when resolving
+    void UpdatePreview();
+    bool IsPreview() const {return m_PreviewPassEnd > 0;} // The frame renders preview passes
+    glm::uvec2 PreviewOffset(uint32_t pass) const; // In its block, of the pixel rendered by a pass
+    // Once it has enough samples, whether every pixel of the tile is under the threshold, else
+    // the samples it gets in the next frame from its noisiest pixel
+    void UpdateTileSamples(uint32_t tileIndex);
+
+    //Wavefront stages
+    void RenderWavefront();
+    void WavefrontGenerate(uint32_t pass);
+    void WavefrontSort();
+    void WavefrontExtend(uint32_t bounce);
+    void WavefrontShade(uint32_t bounce);
+    void WavefrontConnect(size_t nbRay);
+    void WavefrontAccumulate(uint32_t pass);
+
+    // Rays of the wavefront mode as a structure of arrays
+    struct RayQueue {
+        AlignedVector<float> Origin[3], Direction[3], Throughput[3];
+        std::vector<float> BsdfPdf;
+        std::vector<const Shape*> LastShape;
+        std::vector<uint32_t> Pixel;
+        size_t Size = 0;
+
+        void Resize(size_t capacity);
+        void CopyRay(size_t dst, const RayQueue& src, size_t srcId);
+    };
 
     const Scene* m_ActiveScene = nullptr;
     const Camera* m_ActiveCamera = nullptr;
 
-    std::shared_ptr<Walnut::Image> m_FinalImage;
-    u_int32_t* m_ImageData = nullptr;
-    glm::vec4* m_AccumulationData = nullptr;
+    CancelCallback m_Cancelled;
+    std::vector<const Shape*> m_Lights; // Shapes of the active scene with an emissive material
+
+    uint32_t m_Width = 0, m_Height = 0;
+    u_int32_t* m_ImageData = nullptr;          // Resolved, only out of Render
+    uint8_t* m_AccumulationData = nullptr;     // Pixels in m_AccumulationFormat, of the samples of their tile
+    AccumulationFormat m_AccumulationFormat = AccumulationFormat::RGB32F;
+    float* m_SquaredLuminance = nullptr;       // Sum of the squared luminance of the samples
 
     uint32_t m_FrameIndex = 1;
+    uint32_t m_PreviewLevel = 0;
+    uint32_t m_PreviewPass = 0, m_PreviewPassEnd = 0; // Passes done, and done at the end of the frame
+    std::vector<uint32_t> m_PreviewOrder;              // Pass of each pixel of a block
+    float m_PixelCostMs = 0.0f;                        // Frame time per pixel rendered, of the last frame
     Settings m_Settings;
 
-    std::vector<uint32_t> m_ImageHorizontalIterator, m_ImageVerticalIterator;
+    //Tiles origins, ordered along a Hilbert curve
+    struct Tile {
+        uint32_t x, y;
+        bool Converged = false;
+        bool Dirty = false;     // Rendered since the last resolve
+        uint32_t NbSample = 0;  // Per pixel, complete ones
+        uint32_t NbPass = 1;    // Samples per pixel rendered by the next frame
+    };
+    std::vector<Tile> m_Tiles;
+    std::vector<uint32_t> m_TileGrid; // Index in m_Tiles of the tiles, row by row
+    uint32_t m_NbTileX = 0;
+    std::vector<uint32_t> m_ResolvedTiles;
+    std::vector<Region> m_ResolvedRegions;
+    uint32_t m_TileSize = 0;
+    uint32_t m_NbConvergedTile = 0;
+    std::vector<float> m_TileTimes;
+    TileStats m_TileStats;
+    FrameStats m_FrameStats;
+    std::atomic<uint64_t> m_PathSegments{0}; // Rays traced in the frame
+
+    tbb::task_arena m_Arena; //Persistent work stealing pool
+
+    //Wavefront buffers, preallocated for one ray per pixel
+    RayQueue m_RayQueues[2];
+    int m_CurrentQueue = 0;
+    AlignedVector<float> m_HitDistance;
+    std::vector<Shape*> m_HitShape;
+    std::vector<uint32_t> m_HitPrimitive;
+    std::vector<glm::vec2> m_HitBarycentric;
+    std::vector<BounceLight> m_BounceLights;
+    std::vector<uint64_t> m_SortKeys;
+    std::vector<glm::vec3> m_Radiance;
 
 };
\ No newline at end of file
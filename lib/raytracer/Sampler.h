@@ -0,0 +1,148 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+
+
+#define BLUE_NOISE_SIZE 64 // Side of the blue noise tile (its ranks take 12 bits)
+
+enum class SamplerType {
+    PCG = 0,    // Independent hashed random numbers
+    Sobol,      // Owen scrambled Sobol (0,2) sequence, padded by pairs of dimensions
+    BlueNoise   // Sobol sequence shared by the pixels, each shifted by a blue noise tile (toroidally)
+};
+
+
+// Random numbers of the sample sampleIndex of a pixel. They only depend on (pixel, sample,
+// dimension), so that the trace modes draw the same numbers whatever their order of work :
+// a path sets the first dimension of each bounce, then draws the following ones in order
+class Sampler {
+
+    public:
+        Sampler(SamplerType type, uint32_t pixel, uint32_t sampleIndex, uint32_t width);
+
+        void SetDimension(uint32_t dimension) {m_Dimension = dimension;}
+
+        // In [0, 1)
+        float Get1D();
+        glm::vec2 Get2D();
+
+        // Ranks of the pixels of the tile, in [0, BLUE_NOISE_SIZE^2), built at the first call
+        static const uint16_t* BlueNoiseTile();
+
+    private:
+        uint32_t BlueNoiseShift(uint32_t dimension) const;
+
+    private:
+        SamplerType m_Type;
+        uint32_t m_Pixel, m_SampleIndex, m_Dimension = 0;
+        uint32_t m_X, m_Y;                      // Of the pixel, for the blue noise
+        const uint16_t* m_BlueNoise = nullptr;
+};
+
+
+namespace SamplerUtils {
+
+    inline uint32_t PCG_Hash(uint32_t input) {
+        uint32_t state = input  * 747796405u + 2891336453u;
+        uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return (word >> 22u) ^ word;
+    }
+
+    inline uint32_t Hash(uint32_t a, uint32_t b, uint32_t c) {
+        return PCG_Hash(a ^ PCG_Hash(b ^ PCG_Hash(c)));
+    }
+
+    inline float ToFloat(uint32_t x) {
+        return (x >> 8) * 0x1p-24f;
+    }
+
+    inline uint32_t ReverseBits(uint32_t x) {
+        x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+        x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+        x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+        return __builtin_bswap32(x);
+    }
+
+    // Owen scrambling of the bits of x from the highest one (Laine-Karras hash, Burley 2020)
+    inline uint32_t NestedUniformScramble(uint32_t x, uint32_t seed) {
+        x = ReverseBits(x);
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return ReverseBits(x);
+    }
+
+    // Second dimension of the Sobol sequence, the first one is the bit reversed index
+    inline uint32_t Sobol1(uint32_t index) {
+        uint32_t result = 0;
+        for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+            if (index & 1) result ^= v;
+        return result;
+    }
+
+    // Dimension 0 or 1 of the Sobol sequence in 0.32 fixed point, Owen scrambled. The index is
+    // shuffled the same way for both, so that a pair stays stratified together
+    inline uint32_t ScrambledSobol(uint32_t sampleIndex, uint32_t seed, int dimension) {
+        uint32_t index = NestedUniformScramble(sampleIndex, seed);
+        uint32_t x = dimension == 0 ? ReverseBits(index) : Sobol1(index);
+        return NestedUniformScramble(x, PCG_Hash(seed + dimension));
+    }
+}
+
+
+inline Sampler::Sampler(SamplerType type, uint32_t pixel, uint32_t sampleIndex, uint32_t width)
+    : m_Type(type), m_Pixel(pixel), m_SampleIndex(sampleIndex), m_X(pixel % width), m_Y(pixel / width) {
+
+    if (type == SamplerType::BlueNoise) m_BlueNoise = BlueNoiseTile();
+}
+
+
+inline float Sampler::Get1D() {
+
+    using namespace SamplerUtils;
+    uint32_t dimension = m_Dimension++;
+
+    switch (m_Type) {
+        case SamplerType::Sobol:
+            return ToFloat(ScrambledSobol(m_SampleIndex, Hash(m_Pixel, dimension, 0x5eed), 0));
+        case SamplerType::BlueNoise:
+            return ToFloat(ScrambledSobol(m_SampleIndex, Hash(dimension, 0x5eed, 0), 0) + BlueNoiseShift(dimension));
+        default:
+            return ToFloat(Hash(m_Pixel, m_SampleIndex, dimension));
+    }
+}
+
+
+inline glm::vec2 Sampler::Get2D() {
+
+    using namespace SamplerUtils;
+    if (m_Type == SamplerType::PCG) {
+        float u = Get1D();
+        return glm::vec2(u, Get1D());
+    }
+
+    uint32_t dimension = m_Dimension;
+    m_Dimension += 2;
+
+    if (m_Type == SamplerType::Sobol) {
+        uint32_t seed = Hash(m_Pixel, dimension, 0x5eed);
+        return glm::vec2(ToFloat(ScrambledSobol(m_SampleIndex, seed, 0)), ToFloat(ScrambledSobol(m_SampleIndex, seed, 1)));
+    }
+
+    uint32_t seed = Hash(dimension, 0x5eed, 0);
+    return glm::vec2(ToFloat(ScrambledSobol(m_SampleIndex, seed, 0) + BlueNoiseShift(dimension)),
+                     ToFloat(ScrambledSobol(m_SampleIndex, seed, 1) + BlueNoiseShift(dimension + 1)));
+}
+
+
+inline uint32_t Sampler::BlueNoiseShift(uint32_t dimension) const {
+
+    //Each dimension reads the tile at its own offset, the rank is turned into 0.32 fixed point
+    uint32_t offset = SamplerUtils::Hash(dimension, 0xb1e, 0x5eed);
+    uint32_t x = (m_X + offset) & (BLUE_NOISE_SIZE - 1);
+    uint32_t y = (m_Y + (offset >> 16)) & (BLUE_NOISE_SIZE - 1);
+    return ((uint32_t)m_BlueNoise[x + y * BLUE_NOISE_SIZE] << 20) + (1u << 19);
+}
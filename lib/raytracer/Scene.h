@@ -18,6 +18,15 @@ public:
 
 
 
+    Scene() = default;
+
+    // Deep copy, the shapes are cloned (meshes still share their geometry)
+    Scene(const Scene& other) : Materials(other.Materials), bvh(other.bvh) {
+        Shapes.reserve(other.Shapes.size());
+        for (const Shape* shape : other.Shapes) Shapes.push_back(shape->Clone());
+    }
+    Scene& operator=(const Scene&) = delete;
+
     ~Scene() {
         for (Shape* shape : Shapes) delete shape; 
     }
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "raytracer/Mesh.h"
+#include <string>
+#include <memory>
+#include <cstdint>
+
+#define SCENE_CACHE_VERSION 3
+#define SCENE_CACHE_DIR "cache"
+#define SCENE_CACHE_HASH_CHUNK (1 << 20) // Bytes of source file hashed per task
+
+
+// Binary cache of the meshes built from the source files (PLY). The file holds the buffers
+// of MeshData in BVH leaf order (the shape ids are baked in) and the nodes of the mesh BVH,
+// each section aligned on a cache line so that the mapped file is used in place.
+// A cache is only used by the same build (version, BVH_WIDTH, node layout) for the same
+// source content.
+namespace SceneCache {
+
+    // 64 bits hash of the content of a file, throws std::runtime_error if it cannot be read
+    uint64_t HashFile(const std::string& path);
+
+    // Cache file of a source file with this content hash
+    std::string CachePath(const std::string& sourcePath, uint64_t sourceHash);
+
+    // Mesh data mapped from a cache file, nullptr if the file is missing or does not match
+    std::shared_ptr<const MeshData> Load(const std::string& cachePath, uint64_t sourceHash);
+
+    // Writes the cache of a mesh (through a temporary file), false on failure
+    bool Save(const std::string& cachePath, uint64_t sourceHash, const MeshData& data);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "raytracer/Scene.h"
+#include "raytracer/Mesh.h"
+#include <string>
+
+#define DEFAULT_PLY_PATH "ply/bunny.ply"
+
+
+//Scene setup shared by the editor and the headless renderer
+namespace SceneLoader {
+
+    // Vertices and triangles of a PLY file (see PlyLoader)
+    void ReadPLY(const std::string& path, std::vector<glm::vec3>& vertices, std::vector<uint32_t>& indices);
+
+    // Mesh of a PLY file, mapped from its scene cache when there is one for this content
+    // (see SceneCache), otherwise built and cached
+    Mesh* LoadPLY(const std::string& path, int materialIndex = 0, bool useCache = true);
+
+    // Two spheres (one of them the ground) and the mesh of the PLY file, the BVH is built
+    void LoadDefaultScene(Scene& scene, const std::string& plyPath = DEFAULT_PLY_PATH, bool useCache = true);
+}
@@ -5,16 +5,44 @@
 #include "raytracer/Material.h"
 
 struct HitPayLoad;
+struct RayPacket;
 struct Scene;
 
+//Point drawn on an emissive shape, seen from a shaded point
+struct LightSample {
+    glm::vec3 Direction;    // Normalized, from the shaded point
+    float Distance;
+    float Pdf;              // Per unit solid angle
+};
+
 
 class Shape {
     public:
 
         Shape();
         Shape(glm::vec3 pos, int i);
+        virtual ~Shape() = default;
+
+        // Copy of the shape (the render thread works on its own copy of the scene)
+        virtual Shape* Clone() const = 0;
 
         virtual bool intersect(const Ray& ray, float& intersectT) const = 0;
+        // Closest hit used by the BVH : true when the shape is hit before payload.HitDistance,
+        // which is then narrowed (meshes also fill payload.PrimitiveId)
+        virtual bool intersect(const Ray& ray, HitPayLoad& payload) const;
+        // Closest hit of the groups of rays of a packet, returns the rays (one bit each)
+        // whose HitDistance (and PrimitiveId) were narrowed
+        virtual uint64_t IntersectPacket(RayPacket& packet, uint32_t groups) const;
+        // Any hit within [ray.TMin, ray.TMax] (shadow rays), stops at the first one and
+        // fills nothing
+        virtual bool Occluded(const TraversalRay& ray) const;
+
+        // Light sampling : direction from p toward a point of the shape drawn from u (in [0, 1[²),
+        // false when the shape cannot be sampled from p
+        virtual bool SampleLight(const glm::vec3& p, glm::vec2 u, LightSample& sample) const;
+        // Solid angle pdf of SampleLight drawing the point hit by the ray, seen from its origin
+        // (the payload is resolved)
+        virtual float LightPdf(const Ray& ray, const HitPayLoad& payload) const;
 
         virtual void ClosestHit(const Ray& ray, HitPayLoad& payload) = 0;
         static void Miss(const Ray& ray, HitPayLoad& payload);
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <immintrin.h>
+#include <cstdint>
+
+
+//Thin wrappers over the SSE (4 lanes) and AVX (8 lanes) float registers, so that the
+//kernels are written once for both widths
+template<int W> struct vfloat;
+
+template<>
+struct vfloat<4> {
+
+    __m128 v;
+
+    vfloat() = default;
+    vfloat(__m128 x) : v(x) {}
+    explicit vfloat(float x) : v(_mm_set1_ps(x)) {}
+
+    static vfloat load(const float* p) { return _mm_load_ps(p); }   // 16 bytes aligned
+    static vfloat loadu(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_store_ps(p, v); }
+    void storeu(float* p) const { _mm_storeu_ps(p, v); }
+
+    friend vfloat operator+(vfloat a, vfloat b) { return _mm_add_ps(a.v, b.v); }
+    friend vfloat operator-(vfloat a, vfloat b) { return _mm_sub_ps(a.v, b.v); }
+    friend vfloat operator*(vfloat a, vfloat b) { return _mm_mul_ps(a.v, b.v); }
+    friend vfloat operator/(vfloat a, vfloat b) { return _mm_div_ps(a.v, b.v); }
+    friend vfloat operator&(vfloat a, vfloat b) { return _mm_and_ps(a.v, b.v); }
+    friend vfloat operator|(vfloat a, vfloat b) { return _mm_or_ps(a.v, b.v); }
+
+    friend vfloat operator<(vfloat a, vfloat b) { return _mm_cmplt_ps(a.v, b.v); }
+    friend vfloat operator<=(vfloat a, vfloat b) { return _mm_cmple_ps(a.v, b.v); }
+    friend vfloat operator>(vfloat a, vfloat b) { return _mm_cmpgt_ps(a.v, b.v); }
+    friend vfloat operator>=(vfloat a, vfloat b) { return _mm_cmpge_ps(a.v, b.v); }
+    friend vfloat operator==(vfloat a, vfloat b) { return _mm_cmpeq_ps(a.v, b.v); }
+    friend vfloat operator!=(vfloat a, vfloat b) { return _mm_cmpneq_ps(a.v, b.v); }
+
+    // Return b where a is NaN, so keep the value that must survive in b
+    friend vfloat min(vfloat a, vfloat b) { return _mm_min_ps(a.v, b.v); }
+    friend vfloat max(vfloat a, vfloat b) { return _mm_max_ps(a.v, b.v); }
+    friend vfloat sqrt(vfloat a) { return _mm_sqrt_ps(a.v); }
+    friend vfloat select(vfloat mask, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+
+    friend int movemask(vfloat mask) { return _mm_movemask_ps(mask.v); }
+};
+
+#if defined(__AVX__)
+template<>
+struct vfloat<8> {
+
+    __m256 v;
+
+    vfloat() = default;
+    vfloat(__m256 x) : v(x) {}
+    explicit vfloat(float x) : v(_mm256_set1_ps(x)) {}
+
+    static vfloat load(const float* p) { return _mm256_load_ps(p); } // 32 bytes aligned
+    static vfloat loadu(const float* p) { return _mm256_loadu_ps(p); }
+    void store(float* p) const { _mm256_store_ps(p, v); }
+    void storeu(float* p) const { _mm256_storeu_ps(p, v); }
+
+    friend vfloat operator+(vfloat a, vfloat b) { return _mm256_add_ps(a.v, b.v); }
+    friend vfloat operator-(vfloat a, vfloat b) { return _mm256_sub_ps(a.v, b.v); }
+    friend vfloat operator*(vfloat a, vfloat b) { return _mm256_mul_ps(a.v, b.v); }
+    friend vfloat operator/(vfloat a, vfloat b) { return _mm256_div_ps(a.v, b.v); }
+    friend vfloat operator&(vfloat a, vfloat b) { return _mm256_and_ps(a.v, b.v); }
+    friend vfloat operator|(vfloat a, vfloat b) { return _mm256_or_ps(a.v, b.v); }
+
+    friend vfloat operator<(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+    friend vfloat operator<=(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+    friend vfloat operator>(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+    friend vfloat operator>=(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+    friend vfloat operator==(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+    friend vfloat operator!=(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ); }
+
+    friend vfloat min(vfloat a, vfloat b) { return _mm256_min_ps(a.v, b.v); }
+    friend vfloat max(vfloat a, vfloat b) { return _mm256_max_ps(a.v, b.v); }
+    friend vfloat sqrt(vfloat a) { return _mm256_sqrt_ps(a.v); }
+    friend vfloat select(vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+
+    friend int movemask(vfloat mask) { return _mm256_movemask_ps(mask.v); }
+};
+#endif
+
+#if defined(__AVX__)
+    #define SIMD_WIDTH 8
+#else
+    #define SIMD_WIDTH 4
+#endif
+
+using vfloatN = vfloat<SIMD_WIDTH>;
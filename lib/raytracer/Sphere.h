@@ -18,7 +18,12 @@ public:
     glm::vec3 GetAABBMin() const override;
     glm::vec3 GetAABBMax() const override;
 
+    Shape* Clone() const override { return new Sphere(*this); }
+
     virtual bool intersect(const Ray& ray, float& intersectT) const;
+    uint64_t IntersectPacket(RayPacket& packet, uint32_t groups) const override;
+    bool SampleLight(const glm::vec3& p, glm::vec2 u, LightSample& sample) const override;
+    float LightPdf(const Ray& ray, const HitPayLoad& payload) const override;
     virtual void ClosestHit(const Ray& ray, HitPayLoad& payload);
 
     bool RenderUiSettings(int index, Scene& scene) override;
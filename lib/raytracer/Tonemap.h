@@ -0,0 +1,104 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cmath>
+#include <cstdint>
+
+#include "raytracer/Simd.h"
+
+
+#define SRGB_TABLE_SIZE 4096 // Entries of the sRGB encoding table over [0, 1]
+
+enum class Tonemap {
+    Clamp = 0,  // Radiance above 1 is clipped
+    Reinhard,   // c / (1 + c)
+    ACES        // Filmic curve (Narkowicz fit of the ACES one)
+};
+
+
+namespace TonemapUtils {
+
+    // sRGB bytes of the SRGB_TABLE_SIZE linear values evenly spread over [0, 1]
+    inline const uint8_t* SRGBTable() {
+        struct Table {
+            uint8_t values[SRGB_TABLE_SIZE];
+            Table() {
+                for (int i = 0; i < SRGB_TABLE_SIZE; i++) {
+                    float c = i / (float)(SRGB_TABLE_SIZE - 1);
+                    float encoded = c <= .0031308f ? 12.92f * c : 1.055f * std::pow(c, 1.0f / 2.4f) - .055f;
+                    values[i] = (uint8_t)(encoded * 255.0f + .5f);
+                }
+            }
+        };
+        static const Table table;
+        return table.values;
+    }
+
+    template<Tonemap T, int W>
+    inline vfloat<W> Apply(vfloat<W> c) {
+
+        vfloat<W> zero(0.0f), one(1.0f);
+        c = max(c, zero); // NaN are taken as black
+        if (T == Tonemap::Reinhard) c = c / (one + c);
+        if (T == Tonemap::ACES) c = (c * (vfloat<W>(2.51f) * c + vfloat<W>(.03f))) / (c * (vfloat<W>(2.43f) * c + vfloat<W>(.59f)) + vfloat<W>(.14f));
+        return min(c, one);
+    }
+
+    // SIMD_WIDTH/4 pixels of STRIDE floats (RGB first), the fourth channel is left unused
+    template<int STRIDE>
+    inline vfloatN LoadPixels(const float* p) {
+#if SIMD_WIDTH == 8
+        if (STRIDE != 4) return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p)), _mm_loadu_ps(p + STRIDE), 1);
+#endif
+        return vfloatN::loadu(p);
+    }
+
+    // Bytes of W/4 pixels whose channels are in [0, 1] : through the sRGB table, or truncated
+    // (linear) without one. Alpha is opaque
+    inline void StoreRGBA8(vfloat<4> c, uint32_t* out, const uint8_t* table) {
+        if (table) {
+            alignas(16) int32_t index[4];
+            _mm_store_si128((__m128i*)index, _mm_cvttps_epi32((c * vfloat<4>(SRGB_TABLE_SIZE - 1) + vfloat<4>(.5f)).v));
+            out[0] = table[index[0]] | (table[index[1]] << 8) | (table[index[2]] << 16) | 0xff000000u;
+        } else {
+            __m128i bytes = _mm_cvttps_epi32((c * vfloat<4>(255.0f)).v);
+            bytes = _mm_packs_epi32(bytes, bytes);
+            bytes = _mm_packus_epi16(bytes, bytes);
+            out[0] = (uint32_t)_mm_cvtsi128_si32(bytes) | 0xff000000u;
+        }
+    }
+
+#if defined(__AVX__)
+    inline void StoreRGBA8(vfloat<8> c, uint32_t* out, const uint8_t* table) {
+        if (table) {
+            alignas(32) int32_t index[8];
+            _mm256_store_si256((__m256i*)index, _mm256_cvttps_epi32((c * vfloat<8>(SRGB_TABLE_SIZE - 1) + vfloat<8>(.5f)).v));
+            out[0] = table[index[0]] | (table[index[1]] << 8) | (table[index[2]] << 16) | 0xff000000u;
+            out[1] = table[index[4]] | (table[index[5]] << 8) | (table[index[6]] << 16) | 0xff000000u;
+        } else {
+            __m256i words = _mm256_cvttps_epi32((c * vfloat<8>(255.0f)).v);
+            __m128i bytes = _mm_packs_epi32(_mm256_castsi256_si128(words), _mm256_extractf128_si256(words, 1));
+            bytes = _mm_or_si128(_mm_packus_epi16(bytes, bytes), _mm_set1_epi32((int)0xff000000u));
+            _mm_storel_epi64((__m128i*)out, bytes);
+        }
+    }
+#endif
+}
+
+
+// Resolves count accumulated pixels of STRIDE floats (RGB first, then padding) into RGBA8 :
+// scaled by the reciprocal of their sample count, tonemapped then encoded. SIMD_WIDTH / 4
+// pixels at a time, the last one may read up to 4 floats
+template<Tonemap T, int STRIDE>
+inline void ResolvePixels(const float* in, uint32_t* out, uint32_t count, float scale, bool srgb) {
+
+    using namespace TonemapUtils;
+    constexpr int PIXELS = SIMD_WIDTH / 4;
+    const uint8_t* table = srgb ? SRGBTable() : nullptr;
+
+    uint32_t i = 0;
+    for (; i + PIXELS <= count; i += PIXELS)
+        StoreRGBA8(Apply<T>(LoadPixels<STRIDE>(in + STRIDE*i) * vfloatN(scale)), out + i, table);
+    for (; i < count; i++)
+        StoreRGBA8(Apply<T>(vfloat<4>::loadu(in + STRIDE*i) * vfloat<4>(scale)), out + i, table);
+}
@@ -19,7 +19,12 @@ public:
     glm::vec3 GetAABBMin() const override;
     glm::vec3 GetAABBMax() const override;
     
+    Shape* Clone() const override { return new Triangle(*this); }
+
     virtual bool intersect(const Ray& ray, float& intersectT) const;
+    bool intersect(const Ray& ray, HitPayLoad& payload) const override;
+    bool SampleLight(const glm::vec3& p, glm::vec2 u, LightSample& sample) const override;
+    float LightPdf(const Ray& ray, const HitPayLoad& payload) const override;
     virtual void ClosestHit(const Ray& ray, HitPayLoad& payload);
     bool RenderUiSettings(int index, Scene& scene) override;
     void onVertexChange();
@@ -27,8 +32,6 @@ public:
 
 public:
     Vertex V[3]; //Vertex
-    glm::vec3 E[3]; //Edges
 
     glm::vec3 Normal;
-    float dPlane; //d parameter of triangle's plane (ax+by+cz+d = 0)
 };
\ No newline at end of file
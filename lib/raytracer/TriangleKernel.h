@@ -0,0 +1,200 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+
+#include "raytracer/Ray.h"
+#include "raytracer/Simd.h"
+
+
+// Watertight ray/triangle test (Woop, Benthin, Wald 2013) : the vertices are sheared into the
+// space of the ray (which runs along +z), where the two triangles sharing an edge evaluate
+// the same edge function, so that rays never slip between them. This only holds if the
+// compiler does not fuse a*b - c*d into an FMA (-ffp-contract=off, see the Makefile).
+// The shear of the ray is precomputed in TraversalRay.
+
+
+// Hit of the triangle (p0, p1, p2) between ray.TMin and tMax (both faces). barycentric holds the
+// weights of p1 and p2
+inline bool IntersectTriangleWatertight(const TraversalRay& ray, const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2,
+    float tMax, float& intersectT, glm::vec2& barycentric) {
+
+    glm::vec3 a = p0 - ray.Origin;
+    glm::vec3 b = p1 - ray.Origin;
+    glm::vec3 c = p2 - ray.Origin;
+
+    float ax = a[ray.kx] - ray.Sx * a[ray.kz];
+    float ay = a[ray.ky] - ray.Sy * a[ray.kz];
+    float bx = b[ray.kx] - ray.Sx * b[ray.kz];
+    float by = b[ray.ky] - ray.Sy * b[ray.kz];
+    float cx = c[ray.kx] - ray.Sx * c[ray.kz];
+    float cy = c[ray.ky] - ray.Sy * c[ray.kz];
+
+    //Edge functions, in double when the float ones land exactly on an edge
+    float u = cx * by - cy * bx;
+    float v = ax * cy - ay * cx;
+    float w = bx * ay - by * ax;
+    if (u == 0.0f || v == 0.0f || w == 0.0f) {
+        u = (float)((double)cx * by - (double)cy * bx);
+        v = (float)((double)ax * cy - (double)ay * cx);
+        w = (float)((double)bx * ay - (double)by * ax);
+    }
+
+    if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f)) return false;
+
+    float det = u + v + w;
+    if (det == 0.0f) return false;
+
+    float invDet = 1.0f / det;
+    float t = (u * a[ray.kz] + v * b[ray.kz] + w * c[ray.kz]) * ray.Sz * invDet;
+    if (!(t > ray.TMin && t < tMax)) return false;
+
+    intersectT = t;
+    barycentric = glm::vec2(v * invDet, w * invDet);
+    return true;
+}
+
+
+// Same test for W consecutive triangles of structure of arrays (p0[axis][i]...), with the
+// same operations as the scalar one so that both give the same hits. Returns the mask of
+// the triangles hit between ray.TMin and tMax.
+template<int W>
+inline int IntersectTrianglesWatertight(const TraversalRay& ray, const float* const p0[3], const float* const p1[3], const float* const p2[3],
+    float tMax, vfloat<W>& intersectT, vfloat<W>& baryU, vfloat<W>& baryV) {
+
+    vfloat<W> sx(ray.Sx), sy(ray.Sy);
+
+    vfloat<W> az = vfloat<W>::loadu(p0[ray.kz]) - vfloat<W>(ray.Origin[ray.kz]);
+    vfloat<W> bz = vfloat<W>::loadu(p1[ray.kz]) - vfloat<W>(ray.Origin[ray.kz]);
+    vfloat<W> cz = vfloat<W>::loadu(p2[ray.kz]) - vfloat<W>(ray.Origin[ray.kz]);
+
+    vfloat<W> ax = (vfloat<W>::loadu(p0[ray.kx]) - vfloat<W>(ray.Origin[ray.kx])) - sx * az;
+    vfloat<W> ay = (vfloat<W>::loadu(p0[ray.ky]) - vfloat<W>(ray.Origin[ray.ky])) - sy * az;
+    vfloat<W> bx = (vfloat<W>::loadu(p1[ray.kx]) - vfloat<W>(ray.Origin[ray.kx])) - sx * bz;
+    vfloat<W> by = (vfloat<W>::loadu(p1[ray.ky]) - vfloat<W>(ray.Origin[ray.ky])) - sy * bz;
+    vfloat<W> cx = (vfloat<W>::loadu(p2[ray.kx]) - vfloat<W>(ray.Origin[ray.kx])) - sx * cz;
+    vfloat<W> cy = (vfloat<W>::loadu(p2[ray.ky]) - vfloat<W>(ray.Origin[ray.ky])) - sy * cz;
+
+    vfloat<W> u = cx * by - cy * bx;
+    vfloat<W> v = ax * cy - ay * cx;
+    vfloat<W> w = bx * ay - by * ax;
+
+    vfloat<W> zero(0.0f);
+    vfloat<W> outside = ((u < zero) | (v < zero) | (w < zero)) & ((u > zero) | (v > zero) | (w > zero));
+    vfloat<W> det = u + v + w;
+    vfloat<W> invDet = vfloat<W>(1.0f) / det;
+    vfloat<W> t = (u * az + v * bz + w * cz) * vfloat<W>(ray.Sz) * invDet;
+
+    int hit = movemask((t > vfloat<W>(ray.TMin)) & (t < vfloat<W>(tMax)) & (det != zero)) & ~movemask(outside);
+
+    //Rays exactly on an edge of a triangle are decided by the scalar test (in double)
+    int onEdge = movemask((u == zero) | (v == zero) | (w == zero));
+    if (onEdge) {
+        alignas(32) float lanes[3][W];
+        t.store(lanes[0]);
+        (v * invDet).store(lanes[1]);
+        (w * invDet).store(lanes[2]);
+        for (int i = 0; i < W; i++) {
+            if (!(onEdge & (1 << i))) continue;
+            float triT = 0.0f;
+            glm::vec2 bary(0.0f);
+            bool triHit = IntersectTriangleWatertight(ray,
+                glm::vec3(p0[0][i], p0[1][i], p0[2][i]), glm::vec3(p1[0][i], p1[1][i], p1[2][i]), glm::vec3(p2[0][i], p2[1][i], p2[2][i]),
+                tMax, triT, bary);
+            hit = triHit ? hit | (1 << i) : hit & ~(1 << i);
+            lanes[0][i] = triT;
+            lanes[1][i] = bary.x;
+            lanes[2][i] = bary.y;
+        }
+        intersectT = vfloat<W>::load(lanes[0]);
+        baryU = vfloat<W>::load(lanes[1]);
+        baryV = vfloat<W>::load(lanes[2]);
+        return hit;
+    }
+
+    intersectT = t;
+    baryU = v * invDet;
+    baryV = w * invDet;
+    return hit;
+}
+
+
+// Whether one of the W triangles is hit between ray.TMin and ray.TMax (shadow rays) : same
+// operations as IntersectTrianglesWatertight, but no distance nor barycentrics are kept and
+// the first lane hit ends the test
+template<int W>
+inline bool OccludedTrianglesWatertight(const TraversalRay& ray, const float* const p0[3], const float* const p1[3], const float* const p2[3]) {
+
+    vfloat<W> sx(ray.Sx), sy(ray.Sy);
+
+    vfloat<W> az = vfloat<W>::loadu(p0[ray.kz]) - vfloat<W>(ray.Origin[ray.kz]);
+    vfloat<W> bz = vfloat<W>::loadu(p1[ray.kz]) - vfloat<W>(ray.Origin[ray.kz]);
+    vfloat<W> cz = vfloat<W>::loadu(p2[ray.kz]) - vfloat<W>(ray.Origin[ray.kz]);
+
+    vfloat<W> ax = (vfloat<W>::loadu(p0[ray.kx]) - vfloat<W>(ray.Origin[ray.kx])) - sx * az;
+    vfloat<W> ay = (vfloat<W>::loadu(p0[ray.ky]) - vfloat<W>(ray.Origin[ray.ky])) - sy * az;
+    vfloat<W> bx = (vfloat<W>::loadu(p1[ray.kx]) - vfloat<W>(ray.Origin[ray.kx])) - sx * bz;
+    vfloat<W> by = (vfloat<W>::loadu(p1[ray.ky]) - vfloat<W>(ray.Origin[ray.ky])) - sy * bz;
+    vfloat<W> cx = (vfloat<W>::loadu(p2[ray.kx]) - vfloat<W>(ray.Origin[ray.kx])) - sx * cz;
+    vfloat<W> cy = (vfloat<W>::loadu(p2[ray.ky]) - vfloat<W>(ray.Origin[ray.ky])) - sy * cz;
+
+    vfloat<W> u = cx * by - cy * bx;
+    vfloat<W> v = ax * cy - ay * cx;
+    vfloat<W> w = bx * ay - by * ax;
+
+    vfloat<W> zero(0.0f);
+    vfloat<W> outside = ((u < zero) | (v < zero) | (w < zero)) & ((u > zero) | (v > zero) | (w > zero));
+    vfloat<W> onEdgeLanes = (u == zero) | (v == zero) | (w == zero);
+    vfloat<W> det = u + v + w;
+    vfloat<W> t = (u * az + v * bz + w * cz) * vfloat<W>(ray.Sz) * (vfloat<W>(1.0f) / det);
+
+    //Lanes on an edge are left to the scalar test (in double), as in IntersectTrianglesWatertight
+    int hit = movemask((t > vfloat<W>(ray.TMin)) & (t < vfloat<W>(ray.TMax)) & (det != zero));
+    if (hit & ~movemask(outside | onEdgeLanes)) return true;
+
+    int onEdge = movemask(onEdgeLanes);
+    while (onEdge) {
+        int i = __builtin_ctz(onEdge);
+        onEdge &= onEdge - 1;
+        float triT;
+        glm::vec2 bary;
+        if (IntersectTriangleWatertight(ray, glm::vec3(p0[0][i], p0[1][i], p0[2][i]), glm::vec3(p1[0][i], p1[1][i], p1[2][i]),
+            glm::vec3(p2[0][i], p2[1][i], p2[2][i]), ray.TMax, triT, bary)) return true;
+    }
+    return false;
+}
+
+
+// Same test of one triangle for W rays sharing their origin (a, b, c are the vertices minus
+// that origin) and their axes, each with its own shear. Rays exactly on an edge are left to
+// the scalar test and returned in onEdge.
+template<int W>
+inline int IntersectTriangleRaysWatertight(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const int8_t axis[3],
+    vfloat<W> sx, vfloat<W> sy, vfloat<W> sz, vfloat<W> tMax, vfloat<W>& intersectT, vfloat<W>& baryU, vfloat<W>& baryV, int& onEdge) {
+
+    int kx = axis[0], ky = axis[1], kz = axis[2];
+    vfloat<W> az(a[kz]), bz(b[kz]), cz(c[kz]);
+
+    vfloat<W> ax = vfloat<W>(a[kx]) - sx * az;
+    vfloat<W> ay = vfloat<W>(a[ky]) - sy * az;
+    vfloat<W> bx = vfloat<W>(b[kx]) - sx * bz;
+    vfloat<W> by = vfloat<W>(b[ky]) - sy * bz;
+    vfloat<W> cx = vfloat<W>(c[kx]) - sx * cz;
+    vfloat<W> cy = vfloat<W>(c[ky]) - sy * cz;
+
+    vfloat<W> u = cx * by - cy * bx;
+    vfloat<W> v = ax * cy - ay * cx;
+    vfloat<W> w = bx * ay - by * ax;
+
+    vfloat<W> zero(0.0f);
+    vfloat<W> outside = ((u < zero) | (v < zero) | (w < zero)) & ((u > zero) | (v > zero) | (w > zero));
+    vfloat<W> det = u + v + w;
+    vfloat<W> invDet = vfloat<W>(1.0f) / det;
+    vfloat<W> t = (u * az + v * bz + w * cz) * sz * invDet;
+
+    onEdge = movemask((u == zero) | (v == zero) | (w == zero));
+    intersectT = t;
+    baryU = v * invDet;
+    baryV = w * invDet;
+    return movemask((t > zero) & (t < tMax) & (det != zero)) & ~movemask(outside) & ~onEdge;
+}
@@ -0,0 +1,400 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cfloat>
+#include <algorithm>
+
+#include "raytracer/BVHTree.h"
+#include "raytracer/AlignedVector.h"
+#include "raytracer/ArrayView.h"
+#include "raytracer/Simd.h"
+#include "raytracer/RayPacket.h"
+
+
+// Branching factor of the mesh BVH : 2 keeps the binary BVHTree, 4 (SSE) and 8 (AVX)
+// collapse it into a wide tree whose children are tested at once
+#ifndef BVH_WIDTH
+    #define BVH_WIDTH 4
+#endif
+
+#if BVH_WIDTH == 8 && !defined(__AVX__)
+    #error "BVH_WIDTH 8 needs AVX (-mavx2)"
+#endif
+
+
+//Node of a wide BVH, the bounds of the W children are stored per axis so that they load
+//in a single register. Unused slots have inverted (empty) bounds.
+template<int W>
+struct alignas(CACHE_LINE_SIZE) WideBVHNode {
+    float bounds[2][3][W];  // [min/max][axis][child]
+    uint32_t child[W];      // if (nbShape == 0) : index of the child node
+                            // else :              index of the first shape of the leaf
+    uint32_t nbShape[W];
+};
+
+
+template<int W>
+class WideBVH {
+
+    public:
+        ArrayView<WideBVHNode<W>> nodes; // Built ones, or attached from elsewhere
+
+        // Collapses a binary BVH, the leaves (and so the shape indices) are kept as is
+        void Build(const BVHTree& bvh);
+
+        // Traverses nodes stored elsewhere (memory mapped cache, see SceneCache), they must
+        // outlive the tree
+        void Attach(ArrayView<WideBVHNode<W>> attached);
+
+        // Bytes of the order axes, besides the nodes
+        size_t MemoryUsage() const { return m_OrderAxis.size(); }
+
+        // Same contract as BVHTree::Traverse
+        template<typename LeafIntersect>
+        void Traverse(const TraversalRay& ray, HitPayLoad& payload, LeafIntersect&& leaf) const;
+
+        // Same contract as BVHTree::TraverseAny
+        template<typename LeafOccluded>
+        bool TraverseAny(const TraversalRay& ray, LeafOccluded&& leaf) const;
+
+        // Same contract as BVHTree::TraversePacket
+        template<typename LeafIntersect>
+        void TraversePacket(RayPacket& packet, uint32_t groups, LeafIntersect&& leaf) const;
+
+    private:
+        uint32_t Collapse(const BVHTree& bvh, uint binaryId);
+
+        // Axis along which the centroids of the children of a node spread the most
+        static int OrderAxis(const WideBVHNode<W>& node, int nbChild);
+        static int ChildCount(const WideBVHNode<W>& node);
+
+        void SetOrderAxes();
+
+    private:
+        AlignedVector<WideBVHNode<W>> m_Nodes;
+
+        //Per node, the children are sorted along this axis : TraverseAny visits them in the
+        //order given by the sign of the ray on it, instead of sorting their distances
+        std::vector<uint8_t> m_OrderAxis;
+};
+
+
+template<int W>
+void WideBVH<W>::Build(const BVHTree& bvh) {
+
+    m_Nodes.clear();
+    if (!bvh.nodes.empty()) Collapse(bvh, bvh.rootNodeId);
+    nodes = m_Nodes;
+    SetOrderAxes();
+}
+
+
+template<int W>
+void WideBVH<W>::Attach(ArrayView<WideBVHNode<W>> attached) {
+
+    m_Nodes = AlignedVector<WideBVHNode<W>>();
+    nodes = attached;
+    SetOrderAxes();
+}
+
+
+template<int W>
+int WideBVH<W>::ChildCount(const WideBVHNode<W>& node) {
+
+    //The unused slots are the last ones
+    int nbChild = 0;
+    while (nbChild < W && node.bounds[0][0][nbChild] <= node.bounds[1][0][nbChild]) nbChild++;
+    return nbChild;
+}
+
+
+template<int W>
+int WideBVH<W>::OrderAxis(const WideBVHNode<W>& node, int nbChild) {
+
+    glm::vec3 cmin(FLT_MAX), cmax(-FLT_MAX);
+    for (int i = 0; i < nbChild; i++) {
+        for (int a = 0; a < 3; a++) {
+            float centroid = (node.bounds[0][a][i] + node.bounds[1][a][i]) * .5f;
+            cmin[a] = glm::min(cmin[a], centroid);
+            cmax[a] = glm::max(cmax[a], centroid);
+        }
+    }
+    glm::vec3 e = cmax - cmin;
+    return e.x >= e.y ? (e.x >= e.z ? 0 : 2) : (e.y >= e.z ? 1 : 2);
+}
+
+
+template<int W>
+void WideBVH<W>::SetOrderAxes() {
+
+    m_OrderAxis.resize(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) m_OrderAxis[i] = OrderAxis(nodes[i], ChildCount(nodes[i]));
+}
+
+
+template<int W>
+uint32_t WideBVH<W>::Collapse(const BVHTree& bvh, uint binaryId) {
+
+    //Gather up to W children by opening the biggest interior node first
+    uint children[W];
+    int nbChild = 0;
+
+    const BVHNode& binary = bvh.nodes[binaryId];
+    if (binary.nbShape > 0) {
+        children[nbChild++] = binaryId;
+    } else {
+        children[nbChild++] = binary.LeftFirst;
+        children[nbChild++] = binary.LeftFirst + 1;
+    }
+
+    while (nbChild < W) {
+        int best = -1;
+        float bestArea = -1.0f;
+        for (int i = 0; i < nbChild; i++) {
+            const BVHNode& node = bvh.nodes[children[i]];
+            if (node.nbShape > 0) continue;
+            glm::vec3 e = node.aabbMax - node.aabbMin;
+            float area = e.x * e.y + e.y * e.z + e.z * e.x;
+            if (area > bestArea) {
+                best = i;
+                bestArea = area;
+            }
+        }
+        if (best == -1) break;
+
+        uint opened = children[best];
+        children[best] = bvh.nodes[opened].LeftFirst;
+        children[nbChild++] = bvh.nodes[opened].LeftFirst + 1;
+    }
+
+    uint32_t nodeId = m_Nodes.size();
+    m_Nodes.emplace_back();
+
+    for (int i = 0; i < W; i++) {
+
+        uint32_t child = 0, nbShape = 0;
+        glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+
+        if (i < nbChild) {
+            const BVHNode& node = bvh.nodes[children[i]];
+            bmin = node.aabbMin;
+            bmax = node.aabbMax;
+            if (node.nbShape > 0) {
+                child = node.LeftFirst;
+                nbShape = node.nbShape;
+            } else {
+                child = Collapse(bvh, children[i]); // may reallocate m_Nodes
+            }
+        }
+
+        WideBVHNode<W>& node = m_Nodes[nodeId];
+        for (int a = 0; a < 3; a++) {
+            node.bounds[0][a][i] = bmin[a];
+            node.bounds[1][a][i] = bmax[a];
+        }
+        node.child[i] = child;
+        node.nbShape[i] = nbShape;
+    }
+
+    //Children sorted by centroid along their order axis
+    WideBVHNode<W>& node = m_Nodes[nodeId];
+    int axis = OrderAxis(node, nbChild);
+    int order[W];
+    for (int i = 0; i < nbChild; i++) order[i] = i;
+    std::sort(order, order + nbChild, [&](int i, int j) {
+        return node.bounds[0][axis][i] + node.bounds[1][axis][i] < node.bounds[0][axis][j] + node.bounds[1][axis][j];
+    });
+
+    WideBVHNode<W> sorted = node;
+    for (int i = 0; i < nbChild; i++) {
+        for (int m = 0; m < 2; m++)
+            for (int a = 0; a < 3; a++) sorted.bounds[m][a][i] = node.bounds[m][a][order[i]];
+        sorted.child[i] = node.child[order[i]];
+        sorted.nbShape[i] = node.nbShape[order[i]];
+    }
+    node = sorted;
+
+    return nodeId;
+}
+
+
+template<int W>
+template<typename LeafIntersect>
+void WideBVH<W>::Traverse(const TraversalRay& ray, HitPayLoad& payload, LeafIntersect&& leaf) const {
+
+    if (nodes.empty()) return;
+
+    struct StackEntry {
+        uint32_t child, nbShape;
+        float dist;
+    };
+    StackEntry stack[64 * (W - 1) + 1]; //Stack to visit node front to back
+    uint stackPtr = 0;
+    stack[stackPtr++] = {0, 0, -FLT_MAX};
+
+    vfloat<W> origin[3], inv[3];
+    for (int a = 0; a < 3; a++) {
+        origin[a] = vfloat<W>(ray.Origin[a]);
+        inv[a] = vfloat<W>(ray.InvDirection[a]);
+    }
+    vfloat<W> tMin(ray.TMin);
+    const int* sign = ray.Sign;
+
+    while (stackPtr > 0) {
+
+        const StackEntry entry = stack[--stackPtr];
+        if (entry.dist >= payload.HitDistance) continue; //A closer hit was found since the push
+
+        if (entry.nbShape > 0) {
+            leaf(entry.child, entry.nbShape);
+            continue;
+        }
+
+        const WideBVHNode<W>& node = nodes[entry.child];
+
+        //Near/far planes from the octant of the ray. max/min return their second operand
+        //when the first is NaN, so a NaN slab leaves the interval unchanged
+        vfloat<W> tNear = max((vfloat<W>::load(node.bounds[sign[0]][0]) - origin[0]) * inv[0],
+                          max((vfloat<W>::load(node.bounds[sign[1]][1]) - origin[1]) * inv[1],
+                          max((vfloat<W>::load(node.bounds[sign[2]][2]) - origin[2]) * inv[2], tMin)));
+        vfloat<W> tFar = min((vfloat<W>::load(node.bounds[1 - sign[0]][0]) - origin[0]) * inv[0],
+                         min((vfloat<W>::load(node.bounds[1 - sign[1]][1]) - origin[1]) * inv[1],
+                         min((vfloat<W>::load(node.bounds[1 - sign[2]][2]) - origin[2]) * inv[2],
+                             vfloat<W>(glm::min(payload.HitDistance, ray.TMax)))));
+
+        int hitMask = movemask(tNear <= tFar);
+        if (hitMask == 0) continue;
+
+        alignas(32) float dist[W];
+        tNear.store(dist);
+
+        //Sort the hit children by distance and push the farthest first
+        StackEntry hits[W];
+        int nbHit = 0;
+        while (hitMask) {
+            int i = __builtin_ctz(hitMask);
+            hitMask &= hitMask - 1;
+
+            StackEntry hit = {node.child[i], node.nbShape[i], dist[i]};
+            int j = nbHit++;
+            while (j > 0 && hits[j - 1].dist > hit.dist) {
+                hits[j] = hits[j - 1];
+                j--;
+            }
+            hits[j] = hit;
+        }
+        for (int i = nbHit - 1; i >= 0; i--) stack[stackPtr++] = hits[i];
+    }
+}
+
+
+template<int W>
+template<typename LeafOccluded>
+bool WideBVH<W>::TraverseAny(const TraversalRay& ray, LeafOccluded&& leaf) const {
+
+    if (nodes.empty()) return false;
+
+    struct StackEntry {
+        uint32_t child, nbShape;
+    };
+    StackEntry stack[64 * (W - 1) + 1];
+    uint stackPtr = 0;
+    stack[stackPtr++] = {0, 0};
+
+    vfloat<W> origin[3], inv[3];
+    for (int a = 0; a < 3; a++) {
+        origin[a] = vfloat<W>(ray.Origin[a]);
+        inv[a] = vfloat<W>(ray.InvDirection[a]);
+    }
+    vfloat<W> tMin(ray.TMin), tMax(ray.TMax);
+    const int* sign = ray.Sign;
+
+    while (stackPtr > 0) {
+
+        const StackEntry entry = stack[--stackPtr];
+
+        if (entry.nbShape > 0) {
+            if (leaf(entry.child, entry.nbShape)) return true;
+            continue;
+        }
+
+        const WideBVHNode<W>& node = nodes[entry.child];
+
+        //Same slab test as Traverse
+        vfloat<W> tNear = max((vfloat<W>::load(node.bounds[sign[0]][0]) - origin[0]) * inv[0],
+                          max((vfloat<W>::load(node.bounds[sign[1]][1]) - origin[1]) * inv[1],
+                          max((vfloat<W>::load(node.bounds[sign[2]][2]) - origin[2]) * inv[2], tMin)));
+        vfloat<W> tFar = min((vfloat<W>::load(node.bounds[1 - sign[0]][0]) - origin[0]) * inv[0],
+                         min((vfloat<W>::load(node.bounds[1 - sign[1]][1]) - origin[1]) * inv[1],
+                         min((vfloat<W>::load(node.bounds[1 - sign[2]][2]) - origin[2]) * inv[2], tMax)));
+
+        //Front to back along the order axis without any distance : going down the axis, the
+        //last children are the nearest ones and are pushed last, going up the first ones are
+        int hitMask = movemask(tNear <= tFar);
+        bool down = sign[m_OrderAxis[entry.child]];
+        while (hitMask) {
+            int i = down ? __builtin_ctz(hitMask) : 31 - __builtin_clz(hitMask);
+            hitMask &= ~(1 << i);
+            stack[stackPtr++] = {node.child[i], node.nbShape[i]};
+        }
+    }
+    return false;
+}
+
+
+template<int W>
+template<typename LeafIntersect>
+void WideBVH<W>::TraversePacket(RayPacket& packet, uint32_t groups, LeafIntersect&& leaf) const {
+
+    if (nodes.empty()) return;
+
+    struct StackEntry {
+        uint32_t child, nbShape;
+        uint32_t groups;
+    };
+    StackEntry stack[64 * (W - 1) + 1];
+    uint stackPtr = 0;
+    stack[stackPtr++] = {0, 0, groups};
+
+    while (stackPtr > 0) {
+
+        const StackEntry entry = stack[--stackPtr];
+
+        if (entry.nbShape > 0) {
+            leaf(entry.child, entry.nbShape, entry.groups);
+            continue;
+        }
+
+        const WideBVHNode<W>& node = nodes[entry.child];
+        float maxHitDistance = packet.MaxHitDistance(entry.groups);
+
+        StackEntry hits[W];
+        float dist[W];
+        int nbHit = 0;
+        for (int i = 0; i < W; i++) {
+            glm::vec3 bmin(node.bounds[0][0][i], node.bounds[0][1][i], node.bounds[0][2][i]);
+            glm::vec3 bmax(node.bounds[1][0][i], node.bounds[1][1][i], node.bounds[1][2][i]);
+            if (bmin.x > bmax.x) continue; //Unused slot
+
+            float tNear;
+            if (!IntersectPacketInterval(packet, bmin, bmax, maxHitDistance, tNear)) continue;
+
+            uint32_t childGroups = IntersectPacketGroups(packet, bmin, bmax, entry.groups);
+            if (!childGroups) continue;
+
+            //Sort the hit children by distance
+            int j = nbHit++;
+            while (j > 0 && dist[j - 1] > tNear) {
+                hits[j] = hits[j - 1];
+                dist[j] = dist[j - 1];
+                j--;
+            }
+            hits[j] = {node.child[i], node.nbShape[i], childGroups};
+            dist[j] = tNear;
+        }
+
+        //Push the farthest first
+        for (int i = nbHit - 1; i >= 0; i--) stack[stackPtr++] = hits[i];
+    }
+}
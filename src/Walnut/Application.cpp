@@ -707,6 +707,16 @@ namespace Walnut {
 		return g_Device;
 	}
 
+	VkQueue Application::GetQueue()
+	{
+		return g_Queue;
+	}
+
+	uint32_t Application::GetQueueFamily()
+	{
+		return g_QueueFamily;
+	}
+
 	VkCommandBuffer Application::GetCommandBuffer(bool begin)
 	{
 		ImGui_ImplVulkanH_Window* wd = &g_MainWindowData;
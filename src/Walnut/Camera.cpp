@@ -4,9 +4,11 @@
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+#ifndef WALNUT_HEADLESS
 #include "Walnut/Input.h"
 
 using namespace Walnut;
+#endif
 
 Camera::Camera(float verticalFOV, float nearClip, float farClip)
 	: m_VerticalFOV(verticalFOV), m_NearClip(nearClip), m_FarClip(farClip)
@@ -17,6 +19,9 @@ Camera::Camera(float verticalFOV, float nearClip, float farClip)
 
 bool Camera::OnUpdate(float ts)
 {
+#ifdef WALNUT_HEADLESS
+	return false;
+#else
 	glm::vec2 mousePos = Input::GetMousePosition();
 	glm::vec2 delta = (mousePos - m_LastMousePosition) * 0.002f;
 	m_LastMousePosition = mousePos;
@@ -83,10 +88,11 @@ bool Camera::OnUpdate(float ts)
 	if (moved)
 	{
 		RecalculateView();
-		RecalculateRayDirections();
+		RecalculateRayBasis();
 	}
 
 	return moved;
+#endif
 }
 
 void Camera::OnResize(uint32_t width, uint32_t height)
@@ -100,7 +106,16 @@ void Camera::OnResize(uint32_t width, uint32_t height)
 	m_ViewportHeight = height;
 
 	RecalculateProjection();
-	RecalculateRayDirections();
+	RecalculateRayBasis();
+}
+
+void Camera::SetView(const glm::vec3& position, const glm::vec3& direction)
+{
+	m_Position = position;
+	m_ForwardDirection = glm::normalize(direction);
+
+	RecalculateView();
+	RecalculateRayBasis();
 }
 
 float Camera::GetRotationSpeed()
@@ -120,20 +135,18 @@ void Camera::RecalculateView()
 	m_InverseView = glm::inverse(m_View);
 }
 
-void Camera::RecalculateRayDirections()
+void Camera::RecalculateRayBasis()
 {
-	m_RayDirections.resize(m_ViewportWidth * m_ViewportHeight);
+	if (m_ViewportWidth == 0 || m_ViewportHeight == 0)
+		return;
 
-	for (uint32_t y = 0; y < m_ViewportHeight; y++)
-	{
-		for (uint32_t x = 0; x < m_ViewportWidth; x++)
-		{	
-			glm::vec2 coord = { (float)x / (float)m_ViewportWidth, (float)y / (float)m_ViewportHeight };
-			coord = coord * 2.0f - 1.0f; // -1 -> 1
-
-			glm::vec4 target = m_InverseProjection * glm::vec4(coord.x, coord.y, 1, 1);
-			glm::vec3 rayDirection = glm::vec3(m_InverseView * glm::vec4(glm::normalize(glm::vec3(target) / target.w), 0)); // World space
-			m_RayDirections[x + y * m_ViewportWidth] = rayDirection;
-		}
-	}
+	// The target of a pixel is linear in its coordinates, up to the perspective divide that is
+	// the same for all of them
+	glm::vec4 corner = m_InverseProjection * glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f);
+	glm::vec4 stepX = m_InverseProjection * glm::vec4(2.0f / m_ViewportWidth, 0.0f, 0.0f, 0.0f);
+	glm::vec4 stepY = m_InverseProjection * glm::vec4(0.0f, 2.0f / m_ViewportHeight, 0.0f, 0.0f);
+
+	m_RayBasis.Corner = glm::vec3(m_InverseView * glm::vec4(glm::vec3(corner) / corner.w, 0)); // World space
+	m_RayBasis.StepX = glm::vec3(m_InverseView * glm::vec4(glm::vec3(stepX) / corner.w, 0));
+	m_RayBasis.StepY = glm::vec3(m_InverseView * glm::vec4(glm::vec3(stepY) / corner.w, 0));
 }
\ No newline at end of file
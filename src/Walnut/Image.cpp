@@ -161,7 +161,7 @@ namespace Walnut {
 	void Image::Release()
 	{
 		Application::SubmitResourceFree([sampler = m_Sampler, imageView = m_ImageView, image = m_Image,
-			memory = m_Memory, stagingBuffer = m_StagingBuffer, stagingBufferMemory = m_StagingBufferMemory]()
+			memory = m_Memory, stagingBuffers = m_StagingBuffers, commandPool = m_CommandPool]()
 		{
 			VkDevice device = Application::GetDevice();
 
@@ -169,19 +169,32 @@ namespace Walnut {
 			vkDestroyImageView(device, imageView, nullptr);
 			vkDestroyImage(device, image, nullptr);
 			vkFreeMemory(device, memory, nullptr);
-			vkDestroyBuffer(device, stagingBuffer, nullptr);
-			vkFreeMemory(device, stagingBufferMemory, nullptr);
+
+			for (const StagingBuffer& staging : stagingBuffers)
+			{
+				if (!staging.Buffer)
+					continue;
+				// Copies are not waited for when submitted
+				vkWaitForFences(device, 1, &staging.Fence, VK_TRUE, UINT64_MAX);
+				vkDestroyFence(device, staging.Fence, nullptr);
+				vkDestroyBuffer(device, staging.Buffer, nullptr);
+				vkFreeMemory(device, staging.Memory, nullptr);
+			}
+			if (commandPool)
+				vkDestroyCommandPool(device, commandPool, nullptr);
 		});
 
 		m_Sampler = nullptr;
 		m_ImageView = nullptr;
 		m_Image = nullptr;
 		m_Memory = nullptr;
-		m_StagingBuffer = nullptr;
-		m_StagingBufferMemory = nullptr;
+		m_StagingBuffers = {};
+		m_CommandPool = nullptr;
+		m_NextStagingBuffer = 0;
+		m_Uploaded = false;
 	}
 
-	void Image::SetData(const void* data)
+	void Image::AllocateStagingBuffers()
 	{
 		VkDevice device = Application::GetDevice();
 
@@ -189,56 +202,124 @@ namespace Walnut {
 
 		VkResult err;
 
-		if (!m_StagingBuffer)
 		{
-			// Create the Upload Buffer
+			VkCommandPoolCreateInfo info = {};
+			info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+			info.queueFamilyIndex = Application::GetQueueFamily();
+			err = vkCreateCommandPool(device, &info, nullptr, &m_CommandPool);
+			check_vk_result(err);
+		}
+
+		for (StagingBuffer& staging : m_StagingBuffers)
+		{
+			// Create the Upload Buffer, mapped for its whole life. Coherent memory needs no flush
 			{
 				VkBufferCreateInfo buffer_info = {};
 				buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 				buffer_info.size = upload_size;
 				buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 				buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-				err = vkCreateBuffer(device, &buffer_info, nullptr, &m_StagingBuffer);
+				err = vkCreateBuffer(device, &buffer_info, nullptr, &staging.Buffer);
 				check_vk_result(err);
 				VkMemoryRequirements req;
-				vkGetBufferMemoryRequirements(device, m_StagingBuffer, &req);
-				m_AlignedSize = req.size;
+				vkGetBufferMemoryRequirements(device, staging.Buffer, &req);
 				VkMemoryAllocateInfo alloc_info = {};
 				alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 				alloc_info.allocationSize = req.size;
-				alloc_info.memoryTypeIndex = Utils::GetVulkanMemoryType(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, req.memoryTypeBits);
-				err = vkAllocateMemory(device, &alloc_info, nullptr, &m_StagingBufferMemory);
+				alloc_info.memoryTypeIndex = Utils::GetVulkanMemoryType(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, req.memoryTypeBits);
+				err = vkAllocateMemory(device, &alloc_info, nullptr, &staging.Memory);
+				check_vk_result(err);
+				err = vkBindBufferMemory(device, staging.Buffer, staging.Memory, 0);
 				check_vk_result(err);
-				err = vkBindBufferMemory(device, m_StagingBuffer, m_StagingBufferMemory, 0);
+				err = vkMapMemory(device, staging.Memory, 0, VK_WHOLE_SIZE, 0, &staging.Mapped);
 				check_vk_result(err);
 			}
 
+			// Its command buffer, and a fence signaled as if a copy had already completed
+			{
+				VkCommandBufferAllocateInfo info = {};
+				info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+				info.commandPool = m_CommandPool;
+				info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+				info.commandBufferCount = 1;
+				err = vkAllocateCommandBuffers(device, &info, &staging.CommandBuffer);
+				check_vk_result(err);
+
+				VkFenceCreateInfo fence_info = {};
+				fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+				fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+				err = vkCreateFence(device, &fence_info, nullptr, &staging.Fence);
+				check_vk_result(err);
+			}
 		}
+	}
+
+	void Image::SetData(const void* data)
+	{
+		SetData(data, { ImageRegion{ 0, 0, m_Width, m_Height } });
+	}
+
+	void Image::SetData(const void* data, const std::vector<ImageRegion>& regions)
+	{
+		if (regions.empty())
+			return;
+
+		VkDevice device = Application::GetDevice();
+
+		uint32_t bytesPerPixel = Utils::BytesPerPixel(m_Format);
+
+		VkResult err;
 
-		// Upload to Buffer
+		if (!m_StagingBuffers[0].Buffer)
+			AllocateStagingBuffers();
+
+		// Wait for the copy that last used this buffer, long done unless uploads outpace the GPU
+		StagingBuffer& staging = m_StagingBuffers[m_NextStagingBuffer];
+		m_NextStagingBuffer = (m_NextStagingBuffer + 1) % STAGING_BUFFER_COUNT;
+		err = vkWaitForFences(device, 1, &staging.Fence, VK_TRUE, UINT64_MAX);
+		check_vk_result(err);
+		err = vkResetFences(device, 1, &staging.Fence);
+		check_vk_result(err);
+
+		// Upload to Buffer : the regions only, at their place in the image
+		std::vector<VkBufferImageCopy> copies;
+		copies.reserve(regions.size());
+		for (const ImageRegion& region : regions)
 		{
-			char* map = NULL;
-			err = vkMapMemory(device, m_StagingBufferMemory, 0, m_AlignedSize, 0, (void**)(&map));
-			check_vk_result(err);
-			memcpy(map, data, upload_size);
-			VkMappedMemoryRange range[1] = {};
-			range[0].sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-			range[0].memory = m_StagingBufferMemory;
-			range[0].size = m_AlignedSize;
-			err = vkFlushMappedMemoryRanges(device, 1, range);
-			check_vk_result(err);
-			vkUnmapMemory(device, m_StagingBufferMemory);
+			size_t rowSize = region.Width * bytesPerPixel;
+			size_t offset = ((size_t)region.Y * m_Width + region.X) * bytesPerPixel;
+			if (region.X == 0 && region.Width == m_Width)
+				memcpy((char*)staging.Mapped + offset, (const char*)data + offset, rowSize * region.Height);
+			else
+				for (uint32_t y = 0; y < region.Height; y++, offset += m_Width * bytesPerPixel)
+					memcpy((char*)staging.Mapped + offset, (const char*)data + offset, rowSize);
+
+			VkBufferImageCopy& copy = copies.emplace_back();
+			copy.bufferOffset = ((VkDeviceSize)region.Y * m_Width + region.X) * bytesPerPixel;
+			copy.bufferRowLength = m_Width;
+			copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			copy.imageSubresource.layerCount = 1;
+			copy.imageOffset = { (int32_t)region.X, (int32_t)region.Y, 0 };
+			copy.imageExtent = { region.Width, region.Height, 1 };
 		}
 
-
-		// Copy to Image
+		// Copy to Image, submitted without waiting : the fence tells when the buffer is free again
 		{
-			VkCommandBuffer command_buffer = Application::GetCommandBuffer(true);
+			VkCommandBuffer command_buffer = staging.CommandBuffer;
+
+			VkCommandBufferBeginInfo begin_info = {};
+			begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			err = vkBeginCommandBuffer(command_buffer, &begin_info);
+			check_vk_result(err);
 
+			// The content outside of the regions is kept, once there is one
 			VkImageMemoryBarrier copy_barrier = {};
 			copy_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			copy_barrier.srcAccessMask = m_Uploaded ? VK_ACCESS_SHADER_READ_BIT : 0;
 			copy_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			copy_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			copy_barrier.oldLayout = m_Uploaded ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
 			copy_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
 			copy_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 			copy_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -246,15 +327,10 @@ namespace Walnut {
 			copy_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 			copy_barrier.subresourceRange.levelCount = 1;
 			copy_barrier.subresourceRange.layerCount = 1;
-			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &copy_barrier);
+			vkCmdPipelineBarrier(command_buffer, m_Uploaded ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &copy_barrier);
 
-			VkBufferImageCopy region = {};
-			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			region.imageSubresource.layerCount = 1;
-			region.imageExtent.width = m_Width;
-			region.imageExtent.height = m_Height;
-			region.imageExtent.depth = 1;
-			vkCmdCopyBufferToImage(command_buffer, m_StagingBuffer, m_Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+			vkCmdCopyBufferToImage(command_buffer, staging.Buffer, m_Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)copies.size(), copies.data());
 
 			VkImageMemoryBarrier use_barrier = {};
 			use_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -270,8 +346,18 @@ namespace Walnut {
 			use_barrier.subresourceRange.layerCount = 1;
 			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &use_barrier);
 
-			Application::FlushCommandBuffer(command_buffer);
+			err = vkEndCommandBuffer(command_buffer);
+			check_vk_result(err);
+
+			VkSubmitInfo submit_info = {};
+			submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submit_info.commandBufferCount = 1;
+			submit_info.pCommandBuffers = &command_buffer;
+			err = vkQueueSubmit(Application::GetQueue(), 1, &submit_info, staging.Fence);
+			check_vk_result(err);
 		}
+
+		m_Uploaded = true;
 	}
 
 	void Image::Resize(uint32_t width, uint32_t height)
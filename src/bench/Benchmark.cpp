@@ -0,0 +1,945 @@
+#include "Walnut/Camera.h"
+#include "Walnut/Timer.h"
+
+#include "raytracer/Renderer.h"
+#include "raytracer/SceneLoader.h"
+#include "raytracer/Sphere.h"
+#include "raytracer/RayPacket.h"
+#include "raytracer/TriangleKernel.h"
+#include "raytracer/CameraRays.h"
+#include "raytracer/WideBVH.h"
+
+#include <tbb/global_control.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/info.h>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+
+
+//Reproducible benchmark : BVH build and trace throughput over fixed camera paths, printed as JSON
+
+struct Options {
+    uint32_t Width = 640, Height = 360;
+    uint32_t Frames = 8;             // Camera positions along the path
+    std::vector<int> ThreadCounts;   // Default : 1, 2, 4, ... up to all the cores
+    std::string OutputPath;          // Default : stdout
+    Renderer::Settings Settings;
+};
+
+struct ThreadResult {
+    int Threads;
+    float BuildMs;
+    double PrimaryMrays, PacketMrays, SecondaryMrays;
+    double ShadowMrays, ShadowClosestMrays;  // Visibility of a light from the primary hits : Occluded, closest hit path
+    float MsPerFrame;
+    float PathLength;                // Rays traced per pixel in the full frames
+    float MoveMs = 0.0f;             // Instance scenes : moving every instance once (top-level refits)
+};
+
+struct SceneResult {
+    std::string Name;
+    size_t Primitives = 0;
+    int BvhNodes = 0;
+    size_t WideNodes = 0;
+    float SAHCost = 0.0f;
+    std::vector<ThreadResult> Threads;
+};
+
+//Triangle tests per second of the intersection kernels, and rays lost between the triangles
+//of a closed mesh
+struct KernelResult {
+    size_t Triangles = 0;
+    double MollerTrumbore = 0.0, Watertight = 0.0, WatertightSimd = 0.0; // Mtests/s
+    size_t MollerTrumboreHits = 0, WatertightHits = 0;
+    size_t EdgeRays = 0;
+    size_t MollerTrumboreLeaks = 0, WatertightLeaks = 0;
+};
+
+//Interior node visits per second (slab tests of both children) of the binary BVH, with the
+//reciprocal direction recomputed at each box as before TraversalRay, and precomputed
+struct NodeResult {
+    size_t Nodes = 0;
+    double Reference = 0.0, Precomputed = 0.0; // Mvisits/s
+    size_t ReferenceHits = 0, PrecomputedHits = 0;
+};
+
+//Closest hits per second of the same rays through the binary BVH of a mesh and through its
+//collapses into 4 and 8 wide trees (8 needs AVX), in the same binary
+struct WidthResult {
+    std::string Name;
+    size_t Triangles = 0;
+    size_t Nodes[3] = {0, 0, 0};                   // Binary, BVH4, BVH8
+    double PrimaryMrays[3] = {0.0, 0.0, 0.0};      // Rays from around the mesh
+    double SecondaryMrays[3] = {0.0, 0.0, 0.0};    // Diffuse bounces from their hits
+    size_t Mismatches = 0;                         // Hits differing from the binary tree
+};
+
+//Camera rays of a 4K image on one thread : the whole buffer recomputed as the camera did on
+//each move, and generated SIMD_WIDTH at a time from the camera basis as the renderer does
+struct CameraResult {
+    uint32_t Width = 3840, Height = 2160;
+    float BufferMs = 0.0f, SimdMs = 0.0f;
+    float MaxError = 0.0f;  // Between the directions of both, through the same points
+};
+
+//Geometry of a benchmark scene, the scene itself is rebuilt for every thread count
+struct SceneSource {
+    std::string Name;
+    std::vector<glm::vec3> Vertices;  // Mesh scenes
+    std::vector<uint32_t> Indices;
+    uint32_t NbInstance = 0;          // Grid of instances of the mesh (0 : the mesh alone)
+    uint32_t NbSphere = 0;            // Sphere fields
+};
+
+
+namespace Utils {
+
+    static uint32_t PCG_Hash(uint32_t input) {
+        uint32_t state = input * 747796405u + 2891336453u;
+        uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return (word >> 22u) ^ word;
+    }
+
+    static float RandomFloat(uint32_t& seed) {
+        seed = PCG_Hash(seed);
+        return seed / (float)UINT32_MAX;
+    }
+}
+
+
+// Builds the scene and returns its build time (mesh and scene BVHs, file parsing excluded)
+static float BuildScene(const SceneSource& source, Scene& scene) {
+
+    scene.Materials.push_back(Material());
+
+    Walnut::Timer timer;
+
+    if (source.NbSphere > 0) {
+        //Spheres in a cube, about one sphere per unit of volume
+        uint32_t seed = 1;
+        float side = std::cbrt((float)source.NbSphere);
+        scene.Shapes.reserve(source.NbSphere);
+        for (uint32_t i = 0; i < source.NbSphere; i++) {
+            glm::vec3 position(Utils::RandomFloat(seed), Utils::RandomFloat(seed), Utils::RandomFloat(seed));
+            float radius = .2f + .3f * Utils::RandomFloat(seed);
+            scene.Shapes.push_back(new Sphere(position * side, 0, radius));
+        }
+    } else if (source.NbInstance > 0) {
+        //One geometry on a grid, each instance turned randomly around the vertical axis
+        auto data = std::make_shared<const MeshData>(source.Vertices, source.Indices);
+        glm::vec3 size = data->Bounds.bmax - data->Bounds.bmin;
+        float spacing = 1.5f * glm::max(size.x, size.z);
+        uint32_t side = (uint32_t)std::ceil(std::sqrt((float)source.NbInstance));
+        uint32_t seed = 1;
+        for (uint32_t i = 0; i < source.NbInstance; i++) {
+            Mesh* instance = new Mesh(data);
+            instance->Position += glm::vec3((i % side) * spacing, 0.0f, (i / side) * spacing);
+            instance->Rotation.y = 360.0f * Utils::RandomFloat(seed);
+            instance->UpdateTransform();
+            scene.Shapes.push_back(instance);
+        }
+    } else {
+        scene.Shapes.push_back(new Mesh(source.Vertices, source.Indices));
+    }
+
+    scene.bvh.BuildBVH(scene.Shapes);
+    return timer.ElapsedMillis();
+}
+
+
+// Moves every instance of the scene back and forth, the geometry is untouched and only the
+// top-level tree is refitted. Returns the time per move
+static float MoveInstances(Scene& scene) {
+
+    Walnut::Timer timer;
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < scene.Shapes.size(); i++) {
+            Mesh* instance = (Mesh*)scene.Shapes[i];
+            instance->Position.y += pass == 0 ? 0.1f : -0.1f;
+            instance->UpdateTransform();
+            scene.bvh.Refit(scene.Shapes, i);
+        }
+    }
+    return timer.ElapsedMillis() / (2 * scene.Shapes.size());
+}
+
+
+// Möller-Trumbore test the meshes used before the watertight kernel, kept as the reference
+static inline bool IntersectMollerTrumbore(const Ray& ray, const glm::vec3& v0, const glm::vec3& e1, const glm::vec3& e2, float tMax, float& intersectT) {
+
+    glm::vec3 p = glm::cross(ray.Direction, e2);
+    float det = glm::dot(e1, p);
+    if (glm::abs(det) < 1e-8f) return false;
+    float invDet = 1.0f / det;
+
+    glm::vec3 t = ray.Origin - v0;
+    float u = glm::dot(t, p) * invDet;
+    if (u < 0.0f || u > 1.0f) return false;
+
+    glm::vec3 q = glm::cross(t, e1);
+    float v = glm::dot(ray.Direction, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    float hitT = glm::dot(e2, q) * invDet;
+    if (hitT < 0.0f || hitT >= tMax) return false;
+
+    intersectT = hitT;
+    return true;
+}
+
+
+// Slab test of the traversal before TraversalRay, kept as the reference
+static inline float IntersectAABBReference(const Ray& ray, const glm::vec3& bmin, const glm::vec3& bmax, float tMax) {
+
+    glm::vec3 invDir = 1.0f / ray.Direction;
+    glm::vec3 t0s = (bmin - ray.Origin) * invDir;
+    glm::vec3 t1s = (bmax - ray.Origin) * invDir;
+
+    glm::vec3 tmin = glm::min(t0s, t1s);
+    glm::vec3 tmax = glm::max(t0s, t1s);
+
+    float tminMax = glm::max(tmin.x, glm::max(tmin.y, tmin.z));
+    float tmaxMin = glm::min(tmax.x, glm::min(tmax.y, tmax.z));
+
+    return (tmaxMin >= tminMax && tminMax < tMax && tmaxMin > 0) ? tminMax : FLT_MAX;
+}
+
+
+// Single thread node visits over every interior node of the binary BVH of a mesh : both
+// children are tested, as in BVHTree::Traverse
+static CameraResult BenchCameraRays() {
+
+    CameraResult result;
+    uint32_t width = result.Width, height = result.Height;
+
+    Camera camera(45.0f, 0.1f, 100.0f);
+    camera.OnResize(width, height);
+    camera.SetView(glm::vec3(1.0f, 2.0f, 6.0f), glm::vec3(-.2f, -.3f, -1.0f));
+
+    //As Camera::RecalculateRayDirections did
+    std::vector<glm::vec3> buffer(width * height);
+    Walnut::Timer timer;
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            glm::vec2 coord = { (float)x / (float)width, (float)y / (float)height };
+            coord = coord * 2.0f - 1.0f;
+
+            glm::vec4 target = camera.GetInverseProjection() * glm::vec4(coord.x, coord.y, 1, 1);
+            buffer[x + y * width] = glm::vec3(camera.GetInverseView() * glm::vec4(glm::normalize(glm::vec3(target) / target.w), 0));
+        }
+    }
+    result.BufferMs = timer.ElapsedMillis();
+
+    //Through the same points (the corners of the pixels), into a structure of arrays as the wavefront queue
+    AlignedVector<float> directions[3];
+    for (int a = 0; a < 3; a++) directions[a].resize(width * height);
+    const Camera::RayBasis& basis = camera.GetRayBasis();
+    timer.Reset();
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x += SIMD_WIDTH) {
+            alignas(32) float sampleX[SIMD_WIDTH];
+            for (int l = 0; l < SIMD_WIDTH; l++) sampleX[l] = (float)(x + l);
+            vfloatN direction[3];
+            CameraRayDirections(basis, vfloatN::load(sampleX), vfloatN((float)y), direction);
+            for (int a = 0; a < 3; a++) direction[a].storeu(&directions[a][x + y * width]);
+        }
+    }
+    result.SimdMs = timer.ElapsedMillis();
+
+    for (uint32_t i = 0; i < width * height; i++)
+        for (int a = 0; a < 3; a++) result.MaxError = glm::max(result.MaxError, glm::abs(directions[a][i] - buffer[i][a]));
+
+    fprintf(stderr, "Camera rays %ux%u : %.1fms buffer, %.1fms SIMD (one thread), max difference %g\n",
+        width, height, result.BufferMs, result.SimdMs, result.MaxError);
+
+    return result;
+}
+
+
+static NodeResult BenchNodeTests(const SceneSource& mesh) {
+
+    NodeResult result;
+
+    std::vector<AABB> bounds(mesh.Indices.size() / 3);
+    std::vector<glm::vec3> centroids(bounds.size());
+    for (size_t i = 0; i < bounds.size(); i++) {
+        for (int k = 0; k < 3; k++) bounds[i].grow(mesh.Vertices[mesh.Indices[3*i + k]]);
+        centroids[i] = (bounds[i].bmin + bounds[i].bmax) * 0.5f;
+    }
+    BVHTree bvh;
+    bvh.BuildBVH(std::move(bounds), std::move(centroids));
+
+    std::vector<const BVHNode*> interior;
+    for (int i = 0; i < bvh.nodesUsed; i++)
+        if (bvh.nodes[i].nbShape == 0) interior.push_back(&bvh.nodes[i]);
+    result.Nodes = interior.size();
+
+    //Rays from around the mesh through random points of its bounds
+    const BVHNode& root = bvh.nodes[bvh.rootNodeId];
+    glm::vec3 center = (root.aabbMin + root.aabbMax) * 0.5f;
+    glm::vec3 extent = root.aabbMax - root.aabbMin;
+    uint32_t seed = 1;
+    auto randomPoint = [&](const glm::vec3& bmin, const glm::vec3& bmax) {
+        return bmin + (bmax - bmin) * glm::vec3(Utils::RandomFloat(seed), Utils::RandomFloat(seed), Utils::RandomFloat(seed));
+    };
+    std::vector<Ray> rays(64);
+    for (Ray& ray : rays) {
+        ray.Origin = randomPoint(center - extent, center + extent);
+        ray.Direction = glm::normalize(randomPoint(root.aabbMin, root.aabbMax) - ray.Origin);
+    }
+
+    double nbVisit = (double)rays.size() * interior.size();
+    size_t hits[2] = {0, 0};
+
+    Walnut::Timer timer;
+    for (const Ray& ray : rays) {
+        for (const BVHNode* node : interior) {
+            const BVHNode& child1 = bvh.nodes[node->LeftFirst];
+            const BVHNode& child2 = bvh.nodes[node->LeftFirst + 1];
+            float dist1 = IntersectAABBReference(ray, child1.aabbMin, child1.aabbMax, FLT_MAX);
+            float dist2 = IntersectAABBReference(ray, child2.aabbMin, child2.aabbMax, FLT_MAX);
+            hits[0] += (dist1 != FLT_MAX) + (dist2 != FLT_MAX);
+        }
+    }
+    result.Reference = nbVisit / timer.Elapsed() * 1e-6;
+
+    timer.Reset();
+    for (const Ray& ray : rays) {
+        TraversalRay traversalRay(ray);
+        for (const BVHNode* node : interior) {
+            const BVHNode& child1 = bvh.nodes[node->LeftFirst];
+            const BVHNode& child2 = bvh.nodes[node->LeftFirst + 1];
+            float dist1 = IntersectAABB(traversalRay, child1.aabbMin, child1.aabbMax, FLT_MAX);
+            float dist2 = IntersectAABB(traversalRay, child2.aabbMin, child2.aabbMax, FLT_MAX);
+            hits[1] += (dist1 != FLT_MAX) + (dist2 != FLT_MAX);
+        }
+    }
+    result.Precomputed = nbVisit / timer.Elapsed() * 1e-6;
+
+    result.ReferenceHits = hits[0];
+    result.PrecomputedHits = hits[1];
+
+    fprintf(stderr, "Node visits : %.1f / %.1f Mvisits/s (reference/precomputed ray), x%.2f\n",
+        result.Reference, result.Precomputed, result.Precomputed / result.Reference);
+
+    return result;
+}
+
+
+// Single thread closest hits of the binary BVH of a mesh against its BVH4 and BVH8 collapses :
+// rays from points around the mesh aimed inside its bounds, then a diffuse bounce from each hit
+static WidthResult BenchBVHWidths(const SceneSource& mesh) {
+
+    WidthResult result;
+    result.Name = mesh.Name;
+    result.Triangles = mesh.Indices.size() / 3;
+
+    std::vector<AABB> bounds(result.Triangles);
+    std::vector<glm::vec3> centroids(bounds.size());
+    for (size_t i = 0; i < bounds.size(); i++) {
+        for (int k = 0; k < 3; k++) bounds[i].grow(mesh.Vertices[mesh.Indices[3*i + k]]);
+        centroids[i] = (bounds[i].bmin + bounds[i].bmax) * 0.5f;
+    }
+    BVHTree bvh;
+    bvh.BuildBVH(std::move(bounds), std::move(centroids));
+    WideBVH<4> bvh4;
+    bvh4.Build(bvh);
+    result.Nodes[0] = bvh.nodesUsed;
+    result.Nodes[1] = bvh4.nodes.size();
+#if defined(__AVX__)
+    WideBVH<8> bvh8;
+    bvh8.Build(bvh);
+    result.Nodes[2] = bvh8.nodes.size();
+#endif
+
+    //Closest hit distances and triangles of rays through one of the trees, returns the Mrays/s
+    auto trace = [&](const auto& tree, const std::vector<Ray>& rays, std::vector<HitPayLoad>& hits) {
+        Walnut::Timer timer;
+        for (size_t r = 0; r < rays.size(); r++) {
+            TraversalRay ray(rays[r]);
+            HitPayLoad& payload = hits[r];
+            payload.HitDistance = FLT_MAX;
+            payload.PrimitiveId = UINT32_MAX;
+            tree.Traverse(ray, payload, [&](uint32_t first, uint32_t nbShape) {
+                for (uint32_t i = first; i < first + nbShape; i++) {
+                    uint32_t triangle = bvh.shapeId[i];
+                    float t;
+                    glm::vec2 barycentric;
+                    if (IntersectTriangleWatertight(ray, mesh.Vertices[mesh.Indices[3*triangle]], mesh.Vertices[mesh.Indices[3*triangle + 1]],
+                        mesh.Vertices[mesh.Indices[3*triangle + 2]], payload.HitDistance, t, barycentric)) {
+                        payload.HitDistance = t;
+                        payload.PrimitiveId = triangle;
+                    }
+                }
+            });
+        }
+        return rays.size() / timer.Elapsed() * 1e-6;
+    };
+    auto compare = [&](const std::vector<HitPayLoad>& hits, const std::vector<HitPayLoad>& reference) {
+        for (size_t r = 0; r < hits.size(); r++)
+            result.Mismatches += hits[r].PrimitiveId != reference[r].PrimitiveId || hits[r].HitDistance != reference[r].HitDistance;
+    };
+
+    const BVHNode& root = bvh.nodes[bvh.rootNodeId];
+    glm::vec3 center = (root.aabbMin + root.aabbMax) * 0.5f;
+    glm::vec3 extent = root.aabbMax - root.aabbMin;
+    uint32_t seed = 1;
+    auto randomPoint = [&](const glm::vec3& bmin, const glm::vec3& bmax) {
+        return bmin + (bmax - bmin) * glm::vec3(Utils::RandomFloat(seed), Utils::RandomFloat(seed), Utils::RandomFloat(seed));
+    };
+
+    std::vector<Ray> primary(1 << 18);
+    for (size_t r = 0; r < primary.size(); r++) {
+        //Coherent groups : 4096 rays from each of 64 origins
+        if (r % 4096 == 0) primary[r].Origin = randomPoint(center - extent, center + extent);
+        else primary[r].Origin = primary[r - 1].Origin;
+        primary[r].Direction = glm::normalize(randomPoint(root.aabbMin, root.aabbMax) - primary[r].Origin);
+    }
+
+    std::vector<HitPayLoad> reference(primary.size()), hits(primary.size());
+    result.PrimaryMrays[0] = trace(bvh, primary, reference);
+    result.PrimaryMrays[1] = trace(bvh4, primary, hits);
+    compare(hits, reference);
+#if defined(__AVX__)
+    result.PrimaryMrays[2] = trace(bvh8, primary, hits);
+    compare(hits, reference);
+#endif
+
+    std::vector<Ray> secondary;
+    for (size_t r = 0; r < primary.size(); r++) {
+        if (reference[r].PrimitiveId == UINT32_MAX) continue;
+        uint32_t triangle = reference[r].PrimitiveId;
+        const glm::vec3& p0 = mesh.Vertices[mesh.Indices[3*triangle]];
+        glm::vec3 normal = glm::normalize(glm::cross(mesh.Vertices[mesh.Indices[3*triangle + 1]] - p0, mesh.Vertices[mesh.Indices[3*triangle + 2]] - p0));
+        if (glm::dot(normal, primary[r].Direction) > 0.0f) normal = -normal;
+
+        Ray ray;
+        ray.Origin = primary[r].Origin + primary[r].Direction * reference[r].HitDistance + normal * .0001f;
+        glm::vec3 offset(Utils::RandomFloat(seed) * 2.0f - 1.0f, Utils::RandomFloat(seed) * 2.0f - 1.0f, Utils::RandomFloat(seed) * 2.0f - 1.0f);
+        ray.Direction = glm::normalize(normal + glm::normalize(offset));
+        secondary.push_back(ray);
+    }
+
+    reference.resize(secondary.size());
+    hits.resize(secondary.size());
+    result.SecondaryMrays[0] = trace(bvh, secondary, reference);
+    result.SecondaryMrays[1] = trace(bvh4, secondary, hits);
+    compare(hits, reference);
+#if defined(__AVX__)
+    result.SecondaryMrays[2] = trace(bvh8, secondary, hits);
+    compare(hits, reference);
+#endif
+
+    fprintf(stderr, "BVH widths, %s : %.2f / %.2f / %.2f Mrays/s primary, %.2f / %.2f / %.2f Mrays/s secondary (binary/BVH4/BVH8), %zu mismatches\n",
+        mesh.Name.c_str(), result.PrimaryMrays[0], result.PrimaryMrays[1], result.PrimaryMrays[2],
+        result.SecondaryMrays[0], result.SecondaryMrays[1], result.SecondaryMrays[2], result.Mismatches);
+
+    return result;
+}
+
+
+// Single thread throughput of the triangle kernels over the first triangles of a mesh, then
+// rays from inside a closed mesh aimed at the edges of its triangles (all of them must hit)
+static KernelResult BenchTriangleKernels(const SceneSource& mesh, const SceneSource& closedMesh) {
+
+    KernelResult result;
+    uint32_t seed = 1;
+    auto randomPoint = [&](const glm::vec3& bmin, const glm::vec3& bmax) {
+        return bmin + (bmax - bmin) * glm::vec3(Utils::RandomFloat(seed), Utils::RandomFloat(seed), Utils::RandomFloat(seed));
+    };
+
+    MeshData data(mesh.Vertices, mesh.Indices);
+    uint32_t nbTriangle = (uint32_t)glm::min<size_t>(4096, data.TriangleCount());
+    result.Triangles = nbTriangle;
+
+    std::vector<glm::vec3> v0(nbTriangle), v1(nbTriangle), v2(nbTriangle), e1(nbTriangle), e2(nbTriangle);
+    for (uint32_t i = 0; i < nbTriangle; i++) {
+        v0[i] = glm::vec3(data.V0[0][i], data.V0[1][i], data.V0[2][i]);
+        v1[i] = glm::vec3(data.V1[0][i], data.V1[1][i], data.V1[2][i]);
+        v2[i] = glm::vec3(data.V2[0][i], data.V2[1][i], data.V2[2][i]);
+        e1[i] = v1[i] - v0[i];
+        e2[i] = v2[i] - v0[i];
+    }
+
+    //Rays from around the mesh to random points of its bounds
+    const uint32_t nbRay = 512;
+    glm::vec3 center = (data.Bounds.bmin + data.Bounds.bmax) * 0.5f;
+    glm::vec3 extent = data.Bounds.bmax - data.Bounds.bmin;
+    std::vector<Ray> rays(nbRay);
+    for (Ray& ray : rays) {
+        ray.Origin = randomPoint(center - extent, center + extent);
+        ray.Direction = glm::normalize(randomPoint(data.Bounds.bmin, data.Bounds.bmax) - ray.Origin);
+    }
+
+    double nbTest = (double)nbRay * nbTriangle;
+    size_t hits[3] = {0, 0, 0};
+
+    Walnut::Timer timer;
+    for (const Ray& ray : rays) {
+        for (uint32_t i = 0; i < nbTriangle; i++) {
+            float t;
+            hits[0] += IntersectMollerTrumbore(ray, v0[i], e1[i], e2[i], FLT_MAX, t);
+        }
+    }
+    result.MollerTrumbore = nbTest / timer.Elapsed() * 1e-6;
+
+    timer.Reset();
+    for (const Ray& ray : rays) {
+        TraversalRay watertight(ray);
+        for (uint32_t i = 0; i < nbTriangle; i++) {
+            float t;
+            glm::vec2 barycentric;
+            hits[1] += IntersectTriangleWatertight(watertight, v0[i], v1[i], v2[i], FLT_MAX, t, barycentric);
+        }
+    }
+    result.Watertight = nbTest / timer.Elapsed() * 1e-6;
+
+    timer.Reset();
+    for (const Ray& ray : rays) {
+        TraversalRay watertight(ray);
+        for (uint32_t i = 0; i < nbTriangle; i += SIMD_WIDTH) {
+            const float* p0[3] = { &data.V0[0][i], &data.V0[1][i], &data.V0[2][i] };
+            const float* p1[3] = { &data.V1[0][i], &data.V1[1][i], &data.V1[2][i] };
+            const float* p2[3] = { &data.V2[0][i], &data.V2[1][i], &data.V2[2][i] };
+            vfloatN t, baryU, baryV;
+            int mask = IntersectTrianglesWatertight<SIMD_WIDTH>(watertight, p0, p1, p2, FLT_MAX, t, baryU, baryV);
+            if (nbTriangle - i < SIMD_WIDTH) mask &= (1 << (nbTriangle - i)) - 1;
+            hits[2] += __builtin_popcount(mask);
+        }
+    }
+    result.WatertightSimd = nbTest / timer.Elapsed() * 1e-6;
+
+    result.MollerTrumboreHits = hits[0];
+    result.WatertightHits = hits[1];
+    if (hits[1] != hits[2]) fprintf(stderr, "Watertight kernels disagree : %zu / %zu hits\n", hits[1], hits[2]);
+
+    //Rays from inside the closed mesh to points on the edges of its triangles
+    const std::vector<glm::vec3>& vertices = closedMesh.Vertices;
+    const std::vector<uint32_t>& indices = closedMesh.Indices;
+    glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+    for (const glm::vec3& p : vertices) {
+        bmin = glm::min(bmin, p);
+        bmax = glm::max(bmax, p);
+    }
+    glm::vec3 inner = (bmax - bmin) * 0.25f;
+    glm::vec3 middle = (bmin + bmax) * 0.5f;
+
+    for (int r = 0; r < 65536; r++) {
+        size_t triangle = seed % (indices.size() / 3);
+        int edge = (seed >> 8) % 3;
+        const glm::vec3& a = vertices[indices[3*triangle + edge]];
+        const glm::vec3& b = vertices[indices[3*triangle + (edge + 1) % 3]];
+
+        Ray ray;
+        ray.Origin = randomPoint(middle - inner, middle + inner);
+        ray.Direction = glm::normalize(a + (b - a) * Utils::RandomFloat(seed) - ray.Origin);
+        TraversalRay watertight(ray);
+
+        bool hit[2] = {false, false};
+        for (size_t i = 0; i < indices.size() / 3; i++) {
+            const glm::vec3& p0 = vertices[indices[3*i]];
+            const glm::vec3& p1 = vertices[indices[3*i + 1]];
+            const glm::vec3& p2 = vertices[indices[3*i + 2]];
+            float t;
+            glm::vec2 barycentric;
+            hit[0] |= IntersectMollerTrumbore(ray, p0, p1 - p0, p2 - p0, FLT_MAX, t);
+            hit[1] |= IntersectTriangleWatertight(watertight, p0, p1, p2, FLT_MAX, t, barycentric);
+        }
+        result.EdgeRays++;
+        result.MollerTrumboreLeaks += !hit[0];
+        result.WatertightLeaks += !hit[1];
+    }
+
+    fprintf(stderr, "Triangle kernels : %.1f / %.1f / %.1f Mtests/s (Moller-Trumbore/watertight/watertight x%d), %zu / %zu leaks over %zu edge rays\n",
+        result.MollerTrumbore, result.Watertight, result.WatertightSimd, SIMD_WIDTH, result.MollerTrumboreLeaks, result.WatertightLeaks, result.EdgeRays);
+
+    return result;
+}
+
+
+// Camera orbiting around the scene bounds, looking at their center
+static void SetCameraOnPath(Camera& camera, const Scene& scene, uint32_t frame, uint32_t nbFrame) {
+
+    const BVHNode& root = scene.bvh.nodes[scene.bvh.rootNodeId];
+    glm::vec3 center = (root.aabbMin + root.aabbMax) * .5f;
+    float radius = glm::length(root.aabbMax - root.aabbMin);
+
+    float angle = 6.2831853f * frame / nbFrame;
+    glm::vec3 position = center + radius * glm::vec3(std::sin(angle), .3f, std::cos(angle));
+    camera.SetView(position, center - position);
+}
+
+
+// Closest hits of the camera rays of every frame of the path, then of one diffuse bounce
+// from each hit (incoherent rays), and of shadow rays from each hit to a light above the
+// scene, with the any-hit query and with the closest hit path of the renderer (Intersect
+// then ClosestHit, as TraceRay)
+static void TraceRays(const Scene& scene, Camera& camera, const Options& options, ThreadResult& result) {
+
+    uint32_t nbPixel = options.Width * options.Height;
+    std::vector<Ray> secondary(nbPixel);
+    std::vector<uint8_t> hasSecondary(nbPixel);
+    std::vector<Ray> shadow(nbPixel);
+    std::vector<float> lightDistance(nbPixel);
+
+    const BVHNode& root = scene.bvh.nodes[scene.bvh.rootNodeId];
+    glm::vec3 light = (root.aabbMin + root.aabbMax) * .5f + glm::length(root.aabbMax - root.aabbMin) * glm::vec3(.3f, 1.0f, .2f);
+
+    double primaryTime = 0.0, secondaryTime = 0.0, shadowTime = 0.0, shadowClosestTime = 0.0;
+    size_t nbPrimary = 0;
+    std::atomic<size_t> nbSecondary{0};
+    std::atomic<size_t> shadowHits[2] = {{0}, {0}};
+
+    for (uint32_t f = 0; f < options.Frames; f++) {
+
+        SetCameraOnPath(camera, scene, f, options.Frames);
+
+        Walnut::Timer timer;
+        tbb::parallel_for(tbb::blocked_range<uint32_t>(0, nbPixel), [&](const tbb::blocked_range<uint32_t>& r) {
+            for (uint32_t i = r.begin(); i < r.end(); i++) {
+                Ray ray;
+                ray.Origin = camera.GetPosition();
+                ray.Direction = CameraRayDirection(camera.GetRayBasis(), i % options.Width + .5f, i / options.Width + .5f);
+
+                HitPayLoad payload;
+                payload.HitDistance = FLT_MAX;
+                payload.HitShape = nullptr;
+                scene.bvh.Intersect(ray, scene.Shapes, payload);
+
+                hasSecondary[i] = payload.HitShape != nullptr;
+                if (!payload.HitShape) continue;
+
+                payload.HitShape->ClosestHit(ray, payload);
+                secondary[i].Origin = payload.WorldPosition + payload.WorldNormal * .0001f;
+
+                uint32_t seed = i * (f + 1);
+                glm::vec3 offset(Utils::RandomFloat(seed) * 2.0f - 1.0f, Utils::RandomFloat(seed) * 2.0f - 1.0f, Utils::RandomFloat(seed) * 2.0f - 1.0f);
+                secondary[i].Direction = glm::normalize(payload.WorldNormal + glm::normalize(offset));
+
+                shadow[i].Origin = secondary[i].Origin;
+                lightDistance[i] = glm::length(light - shadow[i].Origin);
+                shadow[i].Direction = (light - shadow[i].Origin) / lightDistance[i];
+            }
+        });
+        primaryTime += timer.Elapsed(); // Includes the shading of the hits and the bounce generation
+        nbPrimary += nbPixel;
+
+        timer.Reset();
+        tbb::parallel_for(tbb::blocked_range<uint32_t>(0, nbPixel), [&](const tbb::blocked_range<uint32_t>& r) {
+            size_t count = 0;
+            for (uint32_t i = r.begin(); i < r.end(); i++) {
+                if (!hasSecondary[i]) continue;
+                HitPayLoad payload;
+                payload.HitDistance = FLT_MAX;
+                payload.HitShape = nullptr;
+                scene.bvh.Intersect(secondary[i], scene.Shapes, payload);
+                count++;
+            }
+            nbSecondary += count;
+        });
+        secondaryTime += timer.Elapsed();
+
+        timer.Reset();
+        tbb::parallel_for(tbb::blocked_range<uint32_t>(0, nbPixel), [&](const tbb::blocked_range<uint32_t>& r) {
+            size_t count = 0;
+            for (uint32_t i = r.begin(); i < r.end(); i++)
+                if (hasSecondary[i]) count += scene.bvh.Occluded(shadow[i], scene.Shapes, lightDistance[i]);
+            shadowHits[0] += count;
+        });
+        shadowTime += timer.Elapsed();
+
+        timer.Reset();
+        tbb::parallel_for(tbb::blocked_range<uint32_t>(0, nbPixel), [&](const tbb::blocked_range<uint32_t>& r) {
+            size_t count = 0;
+            for (uint32_t i = r.begin(); i < r.end(); i++) {
+                if (!hasSecondary[i]) continue;
+                HitPayLoad payload;
+                payload.HitDistance = FLT_MAX;
+                payload.HitShape = nullptr;
+                scene.bvh.Intersect(shadow[i], scene.Shapes, payload);
+                if (!payload.HitShape) continue;
+                payload.HitShape->ClosestHit(shadow[i], payload);
+                count += payload.HitDistance < lightDistance[i];
+            }
+            shadowHits[1] += count;
+        });
+        shadowClosestTime += timer.Elapsed();
+    }
+
+    if (shadowHits[0] != shadowHits[1])
+        fprintf(stderr, "Shadow queries disagree : %zu / %zu occluded\n", shadowHits[0].load(), shadowHits[1].load());
+
+    result.PrimaryMrays = nbPrimary / primaryTime * 1e-6;
+    result.SecondaryMrays = nbSecondary / secondaryTime * 1e-6;
+    result.ShadowMrays = nbSecondary / shadowTime * 1e-6;
+    result.ShadowClosestMrays = nbSecondary / shadowClosestTime * 1e-6;
+}
+
+
+// Closest hits of the camera rays traced as 8x8 packets, returns the Mrays/s
+static double TracePackets(const Scene& scene, Camera& camera, const Options& options) {
+
+    uint32_t nbBlockX = (options.Width + PACKET_WIDTH - 1) / PACKET_WIDTH;
+    uint32_t nbBlockY = (options.Height + PACKET_WIDTH - 1) / PACKET_WIDTH;
+    double time = 0.0;
+
+    for (uint32_t f = 0; f < options.Frames; f++) {
+
+        SetCameraOnPath(camera, scene, f, options.Frames);
+
+        Walnut::Timer timer;
+        tbb::parallel_for(tbb::blocked_range<uint32_t>(0, nbBlockX * nbBlockY), [&](const tbb::blocked_range<uint32_t>& r) {
+            for (uint32_t block = r.begin(); block < r.end(); block++) {
+                uint32_t x0 = (block % nbBlockX) * PACKET_WIDTH;
+                uint32_t y0 = (block / nbBlockX) * PACKET_WIDTH;
+
+                RayPacket packet;
+                packet.Origin = camera.GetPosition();
+                for (int i = 0; i < PACKET_SIZE; i++) {
+                    uint32_t x = glm::min(x0 + i % PACKET_WIDTH, options.Width - 1);
+                    uint32_t y = glm::min(y0 + i / PACKET_WIDTH, options.Height - 1);
+                    glm::vec3 direction = CameraRayDirection(camera.GetRayBasis(), x + .5f, y + .5f);
+                    for (int a = 0; a < 3; a++) packet.Direction[a][i] = direction[a];
+                }
+                packet.Init();
+                scene.bvh.IntersectPacket(packet, scene.Shapes);
+            }
+        });
+        time += timer.Elapsed();
+    }
+
+    return (double)options.Frames * options.Width * options.Height / time * 1e-6;
+}
+
+
+// Full frames of the Renderer along the path : ms and rays traced per pixel per frame
+static void RenderFrames(const Scene& scene, Camera& camera, const Options& options, ThreadResult& result) {
+
+    Renderer renderer;
+    renderer.GetSettings() = options.Settings;
+    renderer.GetSettings().Accumulate = false;
+    renderer.OnResize(options.Width, options.Height);
+
+    Walnut::Timer timer;
+    float pathLength = 0.0f;
+    for (uint32_t f = 0; f < options.Frames; f++) {
+        SetCameraOnPath(camera, scene, f, options.Frames);
+        renderer.Render(scene, camera);
+        pathLength += renderer.GetFrameStats().AvgPathLength;
+    }
+    // Camera rays generation is included, as in the editor
+    result.MsPerFrame = timer.ElapsedMillis() / options.Frames;
+    result.PathLength = pathLength / options.Frames;
+}
+
+
+static SceneResult RunScene(const SceneSource& source, const Options& options) {
+
+    SceneResult result;
+    result.Name = source.Name;
+
+    for (int threads : options.ThreadCounts) {
+
+        tbb::global_control threadLimit(tbb::global_control::max_allowed_parallelism, threads);
+
+        Scene scene;
+        ThreadResult threadResult;
+        threadResult.Threads = threads;
+        threadResult.BuildMs = BuildScene(source, scene);
+
+        Camera camera(45.0f, 0.1f, 100.0f);
+        camera.OnResize(options.Width, options.Height);
+
+        TraceRays(scene, camera, options, threadResult);
+        threadResult.PacketMrays = TracePackets(scene, camera, options);
+        RenderFrames(scene, camera, options, threadResult);
+        if (source.NbInstance > 0) threadResult.MoveMs = MoveInstances(scene);
+        result.Threads.push_back(threadResult);
+
+        //Structure of the BVH (the same for every thread count)
+        if (source.NbSphere > 0) {
+            result.Primitives = source.NbSphere;
+            result.BvhNodes = scene.bvh.nodesUsed;
+            result.SAHCost = scene.bvh.SAHCost();
+        } else {
+            const MeshData& mesh = *((const Mesh*)scene.Shapes[0])->Data;
+            result.Primitives = mesh.TriangleCount() * scene.Shapes.size();
+            result.BvhNodes = mesh.bvh.nodesUsed;
+            result.SAHCost = mesh.SAHCost;
+#if BVH_WIDTH > 2
+            result.WideNodes = mesh.wbvh.nodes.size();
+#endif
+        }
+
+        fprintf(stderr, "%s, %d threads : build %.1fms, %.1f / %.1f / %.1f Mrays/s (primary/packet/secondary), %.1f / %.1f Mrays/s (shadow occluded/closest), %.1fms per frame (%.2f rays per path)",
+            source.Name.c_str(), threads, threadResult.BuildMs, threadResult.PrimaryMrays, threadResult.PacketMrays,
+            threadResult.SecondaryMrays, threadResult.ShadowMrays, threadResult.ShadowClosestMrays, threadResult.MsPerFrame, threadResult.PathLength);
+        if (source.NbInstance > 0) fprintf(stderr, ", %.4fms per instance move", threadResult.MoveMs);
+        fprintf(stderr, "\n");
+    }
+
+    return result;
+}
+
+
+static void WriteJSON(FILE* file, const Options& options, const KernelResult& kernels, const NodeResult& nodeTests, const CameraResult& cameraRays,
+    const std::vector<WidthResult>& widths, const std::vector<SceneResult>& results) {
+
+    const char* modes[] = { "pixel", "packet", "wavefront" };
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"bvh_width\": %d,\n  \"simd_width\": %d,\n", BVH_WIDTH, SIMD_WIDTH);
+    fprintf(file, "  \"width\": %u,\n  \"height\": %u,\n  \"frames\": %u,\n", options.Width, options.Height, options.Frames);
+    fprintf(file, "  \"mode\": \"%s\",\n  \"tile_size\": %u,\n", modes[(int)options.Settings.Mode], options.Settings.TileSize);
+    fprintf(file, "  \"max_depth\": %u,\n  \"roulette_depth\": %u,\n", options.Settings.MaxDepth, options.Settings.RouletteDepth);
+    fprintf(file, "  \"triangle_kernels\": { \"triangles\": %zu, \"moller_trumbore_mtests\": %.3f, \"watertight_mtests\": %.3f, \"watertight_simd_mtests\": %.3f, "
+        "\"moller_trumbore_hits\": %zu, \"watertight_hits\": %zu, \"edge_rays\": %zu, \"moller_trumbore_leaks\": %zu, \"watertight_leaks\": %zu },\n",
+        kernels.Triangles, kernels.MollerTrumbore, kernels.Watertight, kernels.WatertightSimd, kernels.MollerTrumboreHits, kernels.WatertightHits,
+        kernels.EdgeRays, kernels.MollerTrumboreLeaks, kernels.WatertightLeaks);
+    fprintf(file, "  \"node_tests\": { \"nodes\": %zu, \"reference_mvisits\": %.3f, \"precomputed_mvisits\": %.3f, \"speedup\": %.3f, "
+        "\"reference_hits\": %zu, \"precomputed_hits\": %zu },\n",
+        nodeTests.Nodes, nodeTests.Reference, nodeTests.Precomputed, nodeTests.Precomputed / nodeTests.Reference,
+        nodeTests.ReferenceHits, nodeTests.PrecomputedHits);
+    fprintf(file, "  \"camera_rays\": { \"width\": %u, \"height\": %u, \"buffer_ms\": %.3f, \"simd_ms\": %.3f, \"max_error\": %g },\n",
+        cameraRays.Width, cameraRays.Height, cameraRays.BufferMs, cameraRays.SimdMs, cameraRays.MaxError);
+    fprintf(file, "  \"bvh_widths\": [\n");
+    for (size_t w = 0; w < widths.size(); w++) {
+        const WidthResult& r = widths[w];
+        fprintf(file, "    { \"name\": \"%s\", \"triangles\": %zu, \"nodes\": [%zu, %zu, %zu], \"primary_mrays\": [%.3f, %.3f, %.3f], "
+            "\"secondary_mrays\": [%.3f, %.3f, %.3f], \"mismatches\": %zu }%s\n",
+            r.Name.c_str(), r.Triangles, r.Nodes[0], r.Nodes[1], r.Nodes[2], r.PrimaryMrays[0], r.PrimaryMrays[1], r.PrimaryMrays[2],
+            r.SecondaryMrays[0], r.SecondaryMrays[1], r.SecondaryMrays[2], r.Mismatches, w + 1 < widths.size() ? "," : "");
+    }
+    fprintf(file, "  ],\n");
+    fprintf(file, "  \"scenes\": [\n");
+
+    for (size_t s = 0; s < results.size(); s++) {
+        const SceneResult& result = results[s];
+        fprintf(file, "    {\n");
+        fprintf(file, "      \"name\": \"%s\",\n      \"primitives\": %zu,\n", result.Name.c_str(), result.Primitives);
+        fprintf(file, "      \"bvh_nodes\": %d,\n      \"wide_nodes\": %zu,\n      \"sah_cost\": %.4f,\n", result.BvhNodes, result.WideNodes, result.SAHCost);
+        fprintf(file, "      \"threads\": [\n");
+        for (size_t t = 0; t < result.Threads.size(); t++) {
+            const ThreadResult& r = result.Threads[t];
+            fprintf(file, "        { \"threads\": %d, \"build_ms\": %.3f, \"primary_mrays\": %.3f, \"packet_mrays\": %.3f, \"secondary_mrays\": %.3f, \"shadow_mrays\": %.3f, \"shadow_closest_mrays\": %.3f, \"ms_per_frame\": %.3f, \"path_length\": %.3f, \"move_ms\": %.4f }%s\n",
+                r.Threads, r.BuildMs, r.PrimaryMrays, r.PacketMrays, r.SecondaryMrays, r.ShadowMrays, r.ShadowClosestMrays, r.MsPerFrame, r.PathLength, r.MoveMs, t + 1 < result.Threads.size() ? "," : "");
+        }
+        fprintf(file, "      ]\n    }%s\n", s + 1 < results.size() ? "," : "");
+    }
+
+    fprintf(file, "  ]\n}\n");
+}
+
+
+static void PrintUsage(const char* program) {
+    printf("Usage : %s [options]\n"
+           "  --size <width> <height> Resolution (640 360)\n"
+           "  --frames <n>           Camera positions along the path (8)\n"
+           "  --threads <n,n,...>    Thread counts (1, 2, 4, ... all the cores)\n"
+           "  --mode <pixel|packet|wavefront> Trace mode of the full frames (packet)\n"
+           "  --max-depth <n>        Rays traced per path at most (5)\n"
+           "  --roulette-depth <n>   Rays traced before Russian roulette may end a path (3)\n"
+           "  --out <file.json>      Output file (stdout)\n",
+           program);
+}
+
+
+static bool ParseOptions(int argc, char** argv, Options& options) {
+
+    for (int i = 1; i < argc; i++) {
+
+        auto hasArgs = [&](int n) { return i + n < argc; };
+
+        if (!strcmp(argv[i], "--frames") && hasArgs(1)) options.Frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--out") && hasArgs(1)) options.OutputPath = argv[++i];
+        else if (!strcmp(argv[i], "--max-depth") && hasArgs(1)) options.Settings.MaxDepth = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--roulette-depth") && hasArgs(1)) options.Settings.RouletteDepth = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--size") && hasArgs(2)) {
+            options.Width = atoi(argv[++i]);
+            options.Height = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--threads") && hasArgs(1)) {
+            for (char* count = strtok(argv[++i], ","); count; count = strtok(nullptr, ","))
+                if (atoi(count) > 0) options.ThreadCounts.push_back(atoi(count));
+        }
+        else if (!strcmp(argv[i], "--mode") && hasArgs(1)) {
+            const char* mode = argv[++i];
+            if (!strcmp(mode, "pixel")) options.Settings.Mode = Renderer::TraceMode::Pixel;
+            else if (!strcmp(mode, "packet")) options.Settings.Mode = Renderer::TraceMode::Packet;
+            else if (!strcmp(mode, "wavefront")) options.Settings.Mode = Renderer::TraceMode::Wavefront;
+            else return false;
+        }
+        else return false;
+    }
+
+    if (options.ThreadCounts.empty()) {
+        int maxThreads = tbb::info::default_concurrency();
+        for (int threads = 1; threads < maxThreads; threads *= 2) options.ThreadCounts.push_back(threads);
+        options.ThreadCounts.push_back(maxThreads);
+    }
+
+    return options.Width > 0 && options.Height > 0 && options.Frames > 0 && options.Settings.MaxDepth > 0;
+}
+
+
+int main(int argc, char** argv) {
+
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    std::vector<SceneSource> sources;
+    for (const char* name : { "bunny", "monkey", "cube" }) {
+        SceneSource source;
+        source.Name = name;
+        try {
+            SceneLoader::ReadPLY(std::string("ply/") + name + ".ply", source.Vertices, source.Indices);
+        } catch (const std::exception& e) {
+            fprintf(stderr, "Cannot load ply/%s.ply : %s\n", name, e.what());
+            return 1;
+        }
+        sources.push_back(std::move(source));
+    }
+    {
+        //Memory of the geometry is the one of a single bunny
+        SceneSource source = sources[0];
+        source.Name = "bunny_x100";
+        source.NbInstance = 100;
+        sources.push_back(std::move(source));
+    }
+    for (uint32_t nbSphere : { 1000u, 100000u }) {
+        SceneSource source;
+        source.Name = "spheres_" + std::to_string(nbSphere);
+        source.NbSphere = nbSphere;
+        sources.push_back(std::move(source));
+    }
+
+    KernelResult kernels = BenchTriangleKernels(sources[0], sources[2]);
+    NodeResult nodeTests = BenchNodeTests(sources[0]);
+    CameraResult cameraRays = BenchCameraRays();
+    std::vector<WidthResult> widths = { BenchBVHWidths(sources[0]), BenchBVHWidths(sources[1]) };
+
+    std::vector<SceneResult> results;
+    for (const SceneSource& source : sources)
+        results.push_back(RunScene(source, options));
+
+    FILE* file = options.OutputPath.empty() ? stdout : fopen(options.OutputPath.c_str(), "w");
+    if (!file) {
+        fprintf(stderr, "Cannot write %s\n", options.OutputPath.c_str());
+        return 1;
+    }
+    WriteJSON(file, options, kernels, nodeTests, cameraRays, widths, results);
+    if (file != stdout) fclose(file);
+
+    return 0;
+}
@@ -0,0 +1,216 @@
+#include "Walnut/Camera.h"
+#include "Walnut/Timer.h"
+
+#include "raytracer/Renderer.h"
+#include "raytracer/SceneLoader.h"
+#include "raytracer/Sphere.h"
+
+#include <tbb/global_control.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <memory>
+#include <stdexcept>
+
+
+//Batch render without window nor GPU : renders the default scene and writes it to disk
+
+struct Options {
+    std::string PlyPath = DEFAULT_PLY_PATH;
+    std::string OutputPath = "render.ppm";
+    uint32_t Width = 800, Height = 600;
+    uint32_t Samples = 64;
+    int Threads = 0; // 0 : all the cores
+    bool UseCache = true;
+    Renderer::Settings Settings;
+    glm::vec3 Position{0.0f, 0.0f, 6.0f};
+    glm::vec3 Direction{0.0f, 0.0f, -1.0f};
+    std::vector<glm::vec4> Lights;   // Emissive spheres added to the scene : position, radius
+    float LightPower = 10.0f;
+};
+
+
+static void PrintUsage(const char* program) {
+    printf("Usage : %s [options]\n"
+           "  --ply <file>           Mesh of the scene (%s)\n"
+           "  --size <width> <height> Resolution (800 600)\n"
+           "  --spp <n>              Frames, of a sample per pixel (more in the noisy tiles when adaptive) (64)\n"
+           "  --mode <pixel|packet|wavefront>\n"
+           "  --tile <n>             Tile size in pixels (32)\n"
+           "  --threads <n>          Worker threads (all the cores)\n"
+           "  --camera <px py pz dx dy dz> Position and direction of the camera\n"
+           "  --out <file.ppm>       Output image (render.ppm)\n"
+           "  --no-cache             Rebuild the mesh instead of mapping its scene cache\n"
+           "  --light <px py pz r>   Adds a white emissive sphere (repeatable)\n"
+           "  --light-power <p>      Emission power of the added spheres (10)\n"
+           "  --no-light-sampling    Emission only found by the bounces (no next event estimation)\n"
+           "  --max-depth <n>        Rays traced per path at most (5)\n"
+           "  --roulette-depth <n>   Rays traced before Russian roulette may end a path (3)\n"
+           "  --no-adaptive          Every tile gets every sample\n"
+           "  --threshold <t>        Relative error under which the tiles stop being rendered (0.01)\n"
+           "  --max-tile-spp <n>     Samples per frame at most of the tiles above the threshold (4)\n"
+           "  --sampler <pcg|sobol|bluenoise> Random numbers of the paths (sobol)\n"
+           "  --no-jitter            Camera rays through the center of their pixel (no anti-aliasing)\n"
+           "  --tonemap <clamp|reinhard|aces> Tonemapper of the output (clamp)\n"
+           "  --linear               Output written linear instead of sRGB\n"
+           "  --accumulation <rgb32f|rgb16f|rgb9e5> Format of the accumulation buffer (rgb32f)\n",
+           program, DEFAULT_PLY_PATH);
+}
+
+
+static bool ParseOptions(int argc, char** argv, Options& options) {
+
+    for (int i = 1; i < argc; i++) {
+
+        auto hasArgs = [&](int n) { return i + n < argc; };
+
+        if (!strcmp(argv[i], "--ply") && hasArgs(1)) options.PlyPath = argv[++i];
+        else if (!strcmp(argv[i], "--out") && hasArgs(1)) options.OutputPath = argv[++i];
+        else if (!strcmp(argv[i], "--spp") && hasArgs(1)) options.Samples = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--tile") && hasArgs(1)) options.Settings.TileSize = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && hasArgs(1)) options.Threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--no-cache")) options.UseCache = false;
+        else if (!strcmp(argv[i], "--no-light-sampling")) options.Settings.LightSampling = false;
+        else if (!strcmp(argv[i], "--max-depth") && hasArgs(1)) options.Settings.MaxDepth = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--roulette-depth") && hasArgs(1)) options.Settings.RouletteDepth = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--linear")) options.Settings.SRGB = false;
+        else if (!strcmp(argv[i], "--accumulation") && hasArgs(1)) {
+            const char* format = argv[++i];
+            if (!strcmp(format, "rgb32f")) options.Settings.Accumulation = AccumulationFormat::RGB32F;
+            else if (!strcmp(format, "rgb16f")) options.Settings.Accumulation = AccumulationFormat::RGB16F;
+            else if (!strcmp(format, "rgb9e5")) options.Settings.Accumulation = AccumulationFormat::RGB9E5;
+            else return false;
+        }
+        else if (!strcmp(argv[i], "--tonemap") && hasArgs(1)) {
+            const char* tonemap = argv[++i];
+            if (!strcmp(tonemap, "clamp")) options.Settings.Tonemapping = Tonemap::Clamp;
+            else if (!strcmp(tonemap, "reinhard")) options.Settings.Tonemapping = Tonemap::Reinhard;
+            else if (!strcmp(tonemap, "aces")) options.Settings.Tonemapping = Tonemap::ACES;
+            else return false;
+        }
+        else if (!strcmp(argv[i], "--no-jitter")) options.Settings.Jitter = false;
+        else if (!strcmp(argv[i], "--no-adaptive")) options.Settings.Adaptive = false;
+        else if (!strcmp(argv[i], "--threshold") && hasArgs(1)) options.Settings.AdaptiveThreshold = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--max-tile-spp") && hasArgs(1)) options.Settings.AdaptiveMaxSamples = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--light-power") && hasArgs(1)) options.LightPower = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--light") && hasArgs(4)) {
+            glm::vec4 light;
+            for (int a = 0; a < 4; a++) light[a] = atof(argv[++i]);
+            options.Lights.push_back(light);
+        }
+        else if (!strcmp(argv[i], "--size") && hasArgs(2)) {
+            options.Width = atoi(argv[++i]);
+            options.Height = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--mode") && hasArgs(1)) {
+            const char* mode = argv[++i];
+            if (!strcmp(mode, "pixel")) options.Settings.Mode = Renderer::TraceMode::Pixel;
+            else if (!strcmp(mode, "packet")) options.Settings.Mode = Renderer::TraceMode::Packet;
+            else if (!strcmp(mode, "wavefront")) options.Settings.Mode = Renderer::TraceMode::Wavefront;
+            else return false;
+        }
+        else if (!strcmp(argv[i], "--sampler") && hasArgs(1)) {
+            const char* sampler = argv[++i];
+            if (!strcmp(sampler, "pcg")) options.Settings.Sampling = SamplerType::PCG;
+            else if (!strcmp(sampler, "sobol")) options.Settings.Sampling = SamplerType::Sobol;
+            else if (!strcmp(sampler, "bluenoise")) options.Settings.Sampling = SamplerType::BlueNoise;
+            else return false;
+        }
+        else if (!strcmp(argv[i], "--camera") && hasArgs(6)) {
+            for (int a = 0; a < 3; a++) options.Position[a] = atof(argv[++i]);
+            for (int a = 0; a < 3; a++) options.Direction[a] = atof(argv[++i]);
+        }
+        else return false;
+    }
+
+    return options.Width > 0 && options.Height > 0 && options.Samples > 0 && options.Settings.MaxDepth > 0;
+}
+
+
+// Binary PPM, the first row of the image is the bottom one
+static bool WritePPM(const std::string& path, const uint32_t* pixels, uint32_t width, uint32_t height) {
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+
+    std::vector<uint8_t> row(width * 3);
+    for (uint32_t y = height; y-- > 0;) {
+        for (uint32_t x = 0; x < width; x++) {
+            uint32_t rgba = pixels[x + y*width];
+            row[x*3 + 0] = rgba & 0xff;
+            row[x*3 + 1] = (rgba >> 8) & 0xff;
+            row[x*3 + 2] = (rgba >> 16) & 0xff;
+        }
+        fwrite(row.data(), 1, row.size(), file);
+    }
+
+    return fclose(file) == 0;
+}
+
+
+int main(int argc, char** argv) {
+
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    std::unique_ptr<tbb::global_control> threadLimit;
+    if (options.Threads > 0)
+        threadLimit = std::make_unique<tbb::global_control>(tbb::global_control::max_allowed_parallelism, options.Threads);
+
+    Scene scene;
+    try {
+        Walnut::Timer loadTimer;
+        SceneLoader::LoadDefaultScene(scene, options.PlyPath, options.UseCache);
+        if (!options.Lights.empty()) {
+            Material emissive;
+            emissive.EmissionColor = glm::vec3(1.0f);
+            emissive.EmmissionPower = options.LightPower;
+            scene.Materials.push_back(emissive);
+            for (const glm::vec4& light : options.Lights)
+                scene.Shapes.push_back(new Sphere(glm::vec3(light), (int)scene.Materials.size() - 1, light.w));
+            scene.bvh.BuildBVH(scene.Shapes);
+        }
+        printf("Scene loaded in %.1fms\n", loadTimer.ElapsedMillis());
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Cannot load %s : %s\n", options.PlyPath.c_str(), e.what());
+        return 1;
+    }
+
+    Camera camera(45.0f, 0.1f, 100.0f);
+    camera.OnResize(options.Width, options.Height);
+    camera.SetView(options.Position, options.Direction);
+
+    Renderer renderer;
+    renderer.GetSettings() = options.Settings;
+    renderer.GetSettings().Accumulate = true;
+    renderer.OnResize(options.Width, options.Height);
+
+    Walnut::Timer timer;
+    float pathLength = 0.0f, resolveTime = 0.0f;
+    uint32_t samples = 0;
+    //Stops early once every tile has converged
+    while (samples < options.Samples && !renderer.IsConverged()) {
+        renderer.Render(scene, camera);
+        pathLength += renderer.GetFrameStats().AvgPathLength;
+        resolveTime += renderer.GetFrameStats().ResolveMs;
+        samples++;
+    }
+    float renderTime = timer.ElapsedMillis();
+
+    printf("%ux%u, %u spp in %.1fms (%.2fms per sample, %.3fms resolving), %.2f rays per path, %u tiles converged\n", options.Width, options.Height,
+        samples, renderTime, renderTime / samples, resolveTime / samples, pathLength / samples, renderer.GetFrameStats().NbConvergedTile);
+
+    if (!WritePPM(options.OutputPath, renderer.GetImageData(), options.Width, options.Height)) {
+        fprintf(stderr, "Cannot write %s\n", options.OutputPath.c_str());
+        return 1;
+    }
+    printf("Written %s\n", options.OutputPath.c_str());
+
+    return 0;
+}
@@ -1,10 +1,74 @@
 #include "raytracer/BVHTree.h"
 
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/parallel_invoke.h>
+#include <tbb/blocked_range.h>
+#include <tbb/combinable.h>
+
+
+namespace Utils {
+
+    static float SurfaceArea(const BVHNode& node) {
+        glm::vec3 e = node.aabbMax - node.aabbMin;
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+}
+
 
 void BVHTree::Intersect(const Ray& ray, const std::vector<Shape*>& shapes, HitPayLoad& payload) const {
 
-    if (nodes.empty()) return; 
-    IntersectBVH(ray, shapes, rootNodeId, payload);
+    TraversalRay traversalRay(ray);
+    Traverse(traversalRay, payload, [&](uint first, uint nbShape) {
+        for (uint i = 0; i < nbShape; i++) {
+            Shape* shape = shapes[shapeId[first + i]];
+            if (shape->intersect(ray, payload)) payload.HitShape = shape;
+        }
+    });
+}
+
+
+thread_local uint32_t BVHTree::s_LastOccluder = 0;
+
+bool BVHTree::Occluded(const Ray& ray, const std::vector<Shape*>& shapes, float tMax) const {
+
+    TraversalRay traversalRay(ray, 0.0f, tMax);
+
+    //The last occluder, behind its bounds so that a miss costs no more than a node. It is not
+    //tested again in the leaves
+    uint32_t tested = UINT32_MAX;
+    if (s_LastOccluder < m_ShapeBounds.size() && s_LastOccluder < shapes.size()) {
+        tested = s_LastOccluder;
+        const AABB& bounds = m_ShapeBounds[tested];
+        if (IntersectAABB(traversalRay, bounds.bmin, bounds.bmax, tMax) != FLT_MAX && shapes[tested]->Occluded(traversalRay)) return true;
+    }
+
+    return TraverseAny(traversalRay, [&](uint first, uint nbShape) {
+        for (uint i = 0; i < nbShape; i++) {
+            uint32_t id = shapeId[first + i];
+            if (id != tested && shapes[id]->Occluded(traversalRay)) {
+                s_LastOccluder = id;
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+
+void BVHTree::IntersectPacket(RayPacket& packet, const std::vector<Shape*>& shapes) const {
+
+    TraversePacket(packet, ALL_GROUPS, [&](uint first, uint nbShape, uint32_t groups) {
+        for (uint i = 0; i < nbShape; i++) {
+            Shape* shape = shapes[shapeId[first + i]];
+
+            uint64_t hitMask = shape->IntersectPacket(packet, groups);
+            while (hitMask) {
+                packet.HitShape[__builtin_ctzll(hitMask)] = shape;
+                hitMask &= hitMask - 1;
+            }
+        }
+    });
 }
 
 
@@ -15,74 +79,392 @@ void BVHTree::BuildBVH(const std::vector<Shape*>& shapes) {
         shapeId.clear();
         rootNodeId = 0;
         nodesUsed = 0;
+        m_Parent.clear();
+        m_ShapeLeaf.clear();
+        m_BuildArea.clear();
+        m_InteriorCost = m_LeafCost = 0.0;
+        m_BuildCost = 0.0f;
         return;
     }
 
     //Init BVH
-    if (shapes.size() == 0) return;
+    m_ShapeBounds.resize(shapes.size());
+    m_ShapeCentroids.resize(shapes.size());
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, shapes.size()), [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t i = r.begin(); i < r.end(); i++) {
+            m_ShapeBounds[i].bmin = shapes[i]->GetAABBMin();
+            m_ShapeBounds[i].bmax = shapes[i]->GetAABBMax();
+            m_ShapeCentroids[i] = shapes[i]->Position;
+        }
+    });
+
+    Build();
+
+    //Refit data
+    m_Parent.resize(nodes.size());
+    m_BuildArea.resize(nodes.size());
+    m_ShapeLeaf.resize(shapes.size());
+    LinkSubtree(rootNodeId, -1);
+    ComputeCost();
+    m_BuildCost = SAHCost();
+}
+
 
-    nodes.resize(2 * shapes.size() - 1);
-    shapeId.resize(shapes.size());
+void BVHTree::BuildBVH(std::vector<AABB> bounds, std::vector<glm::vec3> centroids) {
 
-    for(int i = 0; i < shapes.size(); i++) shapeId[i] = i;
+    nodes.clear();
+    shapeId.clear();
     rootNodeId = 0;
-    nodesUsed = 1;
+    nodesUsed = 0;
+    if (bounds.empty()) return;
+
+    m_ShapeBounds = std::move(bounds);
+    m_ShapeCentroids = std::move(centroids);
+
+    Build();
+    ComputeCost();
+    m_BuildCost = SAHCost();
+
+    nodes.resize(nodesUsed);
+    nodes.shrink_to_fit();
+
+    //Static geometry : the build data is not kept
+    m_ShapeBounds = std::vector<AABB>();
+    m_ShapeCentroids = std::vector<glm::vec3>();
+    m_Parent = std::vector<int>();
+    m_ShapeLeaf = std::vector<int>();
+    m_BuildArea = std::vector<float>();
+}
+
+
+void BVHTree::Build() {
+
+    size_t nbShape = m_ShapeBounds.size();
+    nodes.resize(2 * nbShape - 1);
+    shapeId.resize(nbShape);
+    for (size_t i = 0; i < nbShape; i++) shapeId[i] = i;
+
+    rootNodeId = 0;
+    m_NbDeadNode = 0;
+    std::atomic<int> nodeCounter{1};
 
     //Build bvh
     BVHNode& root = nodes[rootNodeId];
     root.LeftFirst = 0;
-    root.nbShape = shapes.size();
-    UpdateNodeBounds(rootNodeId, shapes);
-    Subdivide(rootNodeId, shapes);
+    root.nbShape = nbShape;
+    UpdateNodeBounds(rootNodeId);
+    Subdivide(rootNodeId, nodeCounter);
+
+    nodesUsed = nodeCounter;
+}
+
+
+void BVHTree::Refit(const std::vector<Shape*>& shapes, int shapeIndex) {
+
+    //Shapes were added or removed
+    if (nodes.empty() || shapes.size() != shapeId.size()) {
+        BuildBVH(shapes);
+        return;
+    }
+
+    m_ShapeBounds[shapeIndex].bmin = shapes[shapeIndex]->GetAABBMin();
+    m_ShapeBounds[shapeIndex].bmax = shapes[shapeIndex]->GetAABBMax();
+    m_ShapeCentroids[shapeIndex] = shapes[shapeIndex]->Position;
+
+    int leafId = m_ShapeLeaf[shapeIndex];
+    RefitPath(leafId);
+
+    if (SAHCost() <= m_BuildCost * REBUILD_SAH_RATIO) return;
+
+    //Quality degraded : rebuild from the highest node of the edited branch that grew too much
+    int rebuildId = -1;
+    for (int id = leafId; id != -1; id = m_Parent[id])
+        if (Utils::SurfaceArea(nodes[id]) > m_BuildArea[id] * REBUILD_SAH_RATIO) rebuildId = id;
+
+    if (rebuildId != -1 && rebuildId != rootNodeId) {
+        RebuildSubtree(rebuildId);
+        if (SAHCost() <= m_BuildCost * REBUILD_SAH_RATIO) return;
+    }
+
+    BuildBVH(shapes);
+}
+
+
+float BVHTree::SAHCost() const {
+
+    if (nodes.empty()) return 0.0f;
+    return (m_InteriorCost + m_LeafCost) / Utils::SurfaceArea(nodes[rootNodeId]);
 }
 
 
-void BVHTree::UpdateNodeBounds(uint nodeId, const std::vector<Shape*>& shapes) {
+void BVHTree::RefitPath(int nodeId) {
+
+    for (int id = nodeId; id != -1; id = m_Parent[id]) {
+
+        BVHNode& node = nodes[id];
+        float oldArea = Utils::SurfaceArea(node);
+
+        if (node.nbShape > 0)
+            UpdateNodeBounds(id);
+        else {
+            const BVHNode& left = nodes[node.LeftFirst];
+            const BVHNode& right = nodes[node.LeftFirst + 1];
+            node.aabbMin = glm::min(left.aabbMin, right.aabbMin);
+            node.aabbMax = glm::max(left.aabbMax, right.aabbMax);
+        }
+
+        float areaDelta = Utils::SurfaceArea(node) - oldArea;
+        if (node.nbShape > 0) m_LeafCost += areaDelta * node.nbShape;
+        else m_InteriorCost += areaDelta;
+    }
+}
+
+
+void BVHTree::RebuildSubtree(int nodeId) {
+
+    //Shapes of a subtree are contiguous in shapeId, its child pairs are reused by the new subtree
+    uint first = UINT32_MAX, count = 0;
+    std::vector<int> freePairs;
+    int stack[64], stackPtr = 0;
+    stack[stackPtr++] = nodeId;
+    while (stackPtr > 0) {
+        const BVHNode& node = nodes[stack[--stackPtr]];
+        if (node.nbShape > 0) {
+            first = glm::min(first, node.LeftFirst);
+            count += node.nbShape;
+        } else {
+            freePairs.push_back(node.LeftFirst);
+            stack[stackPtr++] = node.LeftFirst;
+            stack[stackPtr++] = node.LeftFirst + 1;
+        }
+    }
+
+    //Build after the used nodes
+    int end = nodesUsed;
+    nodes.resize(end + 2 * count);
 
     BVHNode& node = nodes[nodeId];
-    node.aabbMin = glm::vec3(FLT_MAX);
-    node.aabbMax = glm::vec3(-FLT_MAX);
+    node.LeftFirst = first;
+    node.nbShape = count;
+    UpdateNodeBounds(nodeId);
+
+    std::atomic<int> nodeCounter{end};
+    Subdivide(nodeId, nodeCounter);
+    std::vector<BVHNode> built(nodes.begin() + end, nodes.begin() + nodeCounter);
+    nodes.resize(end);
+
+    //Then move the new child pairs to the old ones, and only past the used nodes when they run out
+    stack[stackPtr++] = nodeId;
+    while (stackPtr > 0) {
+        int id = stack[--stackPtr];
+        if (nodes[id].nbShape > 0) continue;
+
+        int pair;
+        if (!freePairs.empty()) {
+            pair = freePairs.back();
+            freePairs.pop_back();
+        } else {
+            pair = nodesUsed;
+            nodesUsed += 2;
+            nodes.resize(nodesUsed);
+        }
 
-    for (int first = node.LeftFirst, i = 0; i < node.nbShape; i++) {
+        int builtId = nodes[id].LeftFirst - end;
+        nodes[pair] = built[builtId];
+        nodes[pair + 1] = built[builtId + 1];
+        nodes[id].LeftFirst = pair;
+        stack[stackPtr++] = pair;
+        stack[stackPtr++] = pair + 1;
+    }
+    m_NbDeadNode += 2 * freePairs.size();
 
-        int leafShapeId = shapeId[first + i];
-        Shape* leafShape = shapes[leafShapeId];
+    m_Parent.resize(nodesUsed);
+    m_BuildArea.resize(nodesUsed);
+    LinkSubtree(nodeId, m_Parent[nodeId]);
+    if (m_Parent[nodeId] != -1) RefitPath(m_Parent[nodeId]);
+    ComputeCost();
 
-        node.aabbMin = glm::min(node.aabbMin, leafShape->GetAABBMin());
-        node.aabbMax = glm::max(node.aabbMax, leafShape->GetAABBMax());
+    if (m_NbDeadNode > nodesUsed * COMPACT_DEAD_RATIO) Compact();
+}
+
+
+void BVHTree::Compact() {
+
+    //Renumbers the nodes depth first, the root first and child pairs together
+    std::vector<BVHNode> compacted(nodesUsed - m_NbDeadNode);
+    std::vector<int> parent(compacted.size());
+    std::vector<float> buildArea(compacted.size());
+
+    compacted[0] = nodes[rootNodeId];
+    parent[0] = -1;
+    buildArea[0] = m_BuildArea[rootNodeId];
+    int used = 1;
+
+    int stack[64], stackPtr = 0;
+    stack[stackPtr++] = 0;
+    while (stackPtr > 0) {
+        int id = stack[--stackPtr];
+        BVHNode& node = compacted[id];
+
+        if (node.nbShape > 0) {
+            for (uint i = 0; i < node.nbShape; i++) m_ShapeLeaf[shapeId[node.LeftFirst + i]] = id;
+            continue;
+        }
+
+        for (int k = 0; k < 2; k++) {
+            compacted[used + k] = nodes[node.LeftFirst + k];
+            buildArea[used + k] = m_BuildArea[node.LeftFirst + k];
+            parent[used + k] = id;
+        }
+        node.LeftFirst = used;
+        stack[stackPtr++] = used;
+        stack[stackPtr++] = used + 1;
+        used += 2;
     }
+
+    nodes = std::move(compacted);
+    m_Parent = std::move(parent);
+    m_BuildArea = std::move(buildArea);
+    rootNodeId = 0;
+    nodesUsed = used;
+    m_NbDeadNode = 0;
 }
 
 
-float BVHTree::FindBestSplitPlane(BVHNode& node, int& axis, float& splitPos, const std::vector<Shape*>& shapes) {
+void BVHTree::LinkSubtree(int nodeId, int parentId) {
 
-    float bestCost = FLT_MAX;
+    int stack[64], stackPtr = 0;
+    m_Parent[nodeId] = parentId;
+    stack[stackPtr++] = nodeId;
 
-    for(int a = 0; a < 3; a++ ) {
+    while (stackPtr > 0) {
+        int id = stack[--stackPtr];
+        const BVHNode& node = nodes[id];
+        m_BuildArea[id] = Utils::SurfaceArea(node);
 
-        //Find BoundsMin/boundsMax with centroids (Shape.Position)
-        float boundsMin = FLT_MAX, boundsMax = -FLT_MAX;
-        for (int i = 0; i < node.nbShape; i++) {
-            Shape* shape = shapes[shapeId[node.LeftFirst + i]];
-            boundsMin = glm::min(boundsMin, shape->Position[a]);
-            boundsMax = glm::max(boundsMax, shape->Position[a]);
+        if (node.nbShape > 0) {
+            for (uint i = 0; i < node.nbShape; i++) m_ShapeLeaf[shapeId[node.LeftFirst + i]] = id;
+        } else {
+            m_Parent[node.LeftFirst] = m_Parent[node.LeftFirst + 1] = id;
+            stack[stackPtr++] = node.LeftFirst;
+            stack[stackPtr++] = node.LeftFirst + 1;
         }
-        if (boundsMin == boundsMax) continue;
+    }
+}
+
+
+void BVHTree::ComputeCost() {
+
+    m_InteriorCost = m_LeafCost = 0.0;
+
+    int stack[64], stackPtr = 0;
+    stack[stackPtr++] = rootNodeId;
+    while (stackPtr > 0) {
+        const BVHNode& node = nodes[stack[--stackPtr]];
+        if (node.nbShape > 0) {
+            m_LeafCost += (double)Utils::SurfaceArea(node) * node.nbShape;
+        } else {
+            m_InteriorCost += Utils::SurfaceArea(node);
+            stack[stackPtr++] = node.LeftFirst;
+            stack[stackPtr++] = node.LeftFirst + 1;
+        }
+    }
+}
+
+
+void BVHTree::UpdateNodeBounds(uint nodeId) {
+
+    BVHNode& node = nodes[nodeId];
+    const int* ids = &shapeId[node.LeftFirst];
+
+    AABB bounds;
+    if (node.nbShape >= PARALLEL_BINNING_MIN_SHAPES) {
+        bounds = tbb::parallel_reduce(tbb::blocked_range<uint>(0, node.nbShape), AABB(),
+            [&](const tbb::blocked_range<uint>& r, AABB box) {
+                for (uint i = r.begin(); i < r.end(); i++) box.grow(m_ShapeBounds[ids[i]]);
+                return box;
+            },
+            [](AABB a, const AABB& b) { a.grow(b); return a; });
+    } else {
+        for (uint i = 0; i < node.nbShape; i++) bounds.grow(m_ShapeBounds[ids[i]]);
+    }
+
+    node.aabbMin = bounds.bmin;
+    node.aabbMax = bounds.bmax;
+}
+
+
+float BVHTree::FindBestSplitPlane(const BVHNode& node, int& axis, float& splitPos) const {
+
+    const bool parallel = node.nbShape >= PARALLEL_BINNING_MIN_SHAPES;
+    const int* ids = &shapeId[node.LeftFirst];
+
+    //Find BoundsMin/BoundsMax with centroids (Shape.Position), all axis at once
+    AABB centroidBounds;
+    if (parallel) {
+        centroidBounds = tbb::parallel_reduce(tbb::blocked_range<uint>(0, node.nbShape), AABB(),
+            [&](const tbb::blocked_range<uint>& r, AABB box) {
+                for (uint i = r.begin(); i < r.end(); i++) box.grow(m_ShapeCentroids[ids[i]]);
+                return box;
+            },
+            [](AABB a, const AABB& b) { a.grow(b); return a; });
+    } else {
+        for (uint i = 0; i < node.nbShape; i++) centroidBounds.grow(m_ShapeCentroids[ids[i]]);
+    }
+
+    glm::vec3 scale;
+    for (int a = 0; a < 3; a++)
+        scale[a] = BINS / (centroidBounds.bmax[a] - centroidBounds.bmin[a]);
 
-        //Populate the BINS
-        Bin bin[BINS];
-        float scale = BINS / (boundsMax - boundsMin);
-        for (uint i = 0; i < node.nbShape; i++) {
+    //Populate the BINS of the 3 axis in a single pass over the shapes
+    struct BinSet {
+        Bin bin[3][BINS];
 
-            Shape* shape = shapes[shapeId[node.LeftFirst + i]];
-            int binIdx = glm::min(BINS-1, (int)((shape->Position[a] - boundsMin)*scale));
-            bin[binIdx].nbShape++;
-            bin[binIdx].bounds.grow(shape->GetAABBMin());
-            bin[binIdx].bounds.grow(shape->GetAABBMax());
+        void add(const BinSet& other) {
+            for (int a = 0; a < 3; a++)
+                for (int b = 0; b < BINS; b++) {
+                    bin[a][b].nbShape += other.bin[a][b].nbShape;
+                    bin[a][b].bounds.grow(other.bin[a][b].bounds);
+                }
+        }
+    };
+
+    auto populate = [&](uint begin, uint end, BinSet& set) {
+        for (uint i = begin; i < end; i++) {
+            const glm::vec3& centroid = m_ShapeCentroids[ids[i]];
+            const AABB& bounds = m_ShapeBounds[ids[i]];
+
+            for (int a = 0; a < 3; a++) {
+                if (centroidBounds.bmin[a] == centroidBounds.bmax[a]) continue;
+                int binIdx = glm::min(BINS-1, (int)((centroid[a] - centroidBounds.bmin[a])*scale[a]));
+                set.bin[a][binIdx].nbShape++;
+                set.bin[a][binIdx].bounds.grow(bounds);
+            }
         }
+    };
+
+    BinSet bins;
+    if (parallel) {
+        tbb::combinable<BinSet> localBins;
+        tbb::parallel_for(tbb::blocked_range<uint>(0, node.nbShape), [&](const tbb::blocked_range<uint>& r) {
+            populate(r.begin(), r.end(), localBins.local());
+        });
+        localBins.combine_each([&](const BinSet& set) { bins.add(set); });
+    } else {
+        populate(0, node.nbShape, bins);
+    }
+
+    float bestCost = FLT_MAX;
+
+    for(int a = 0; a < 3; a++ ) {
 
-        
-        //Gather data of in-between planes 
+        float boundsMin = centroidBounds.bmin[a], boundsMax = centroidBounds.bmax[a];
+        if (boundsMin == boundsMax) continue;
+
+        const Bin* bin = bins.bin[a];
+
+        //Gather data of in-between planes
         float leftArea[BINS - 1], rightArea[BINS - 1];
         int leftCount[BINS - 1], rightCount[BINS - 1];
         AABB leftBox, rightBox;
@@ -99,12 +481,12 @@ float BVHTree::FindBestSplitPlane(BVHNode& node, int& axis, float& splitPos, con
         }
 
         //Calc SAH cost of in-between planes
-        scale = (boundsMax - boundsMin)/BINS;
+        float planeScale = (boundsMax - boundsMin)/BINS;
         for (uint i = 0; i < BINS-1; i++) {
             float planeCost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
             if (planeCost < bestCost) {
                 axis = a;
-                splitPos = boundsMin + scale * (i + 1);
+                splitPos = boundsMin + planeScale * (i + 1);
                 bestCost = planeCost;
             }
         }
@@ -114,20 +496,18 @@ float BVHTree::FindBestSplitPlane(BVHNode& node, int& axis, float& splitPos, con
 
 
 float BVHTree::CalcNodeCost(BVHNode& node) {
-    glm::vec3 e = node.aabbMax - node.aabbMin; 
-    float surfaceArea = e.x * e.y + e.y * e.z + e.z * e.x;
-    return node.nbShape * surfaceArea;
+    return node.nbShape * Utils::SurfaceArea(node);
 }
 
 
-void BVHTree::Subdivide(int nodeId, const std::vector<Shape*>& shapes) {
+void BVHTree::Subdivide(int nodeId, std::atomic<int>& nodeCounter) {
 
     BVHNode& node = nodes[nodeId];
 
     // Determine split axis using SAH
     int axis;
     float splitPos;
-    float splitCost = FindBestSplitPlane(node, axis, splitPos, shapes);
+    float splitCost = FindBestSplitPlane(node, axis, splitPos);
 
     // Abort if split does not reduce cost
     float nosplitCost = CalcNodeCost(node);
@@ -138,7 +518,7 @@ void BVHTree::Subdivide(int nodeId, const std::vector<Shape*>& shapes) {
     int i = node.LeftFirst;
     int j = i + node.nbShape - 1;
     while (i <= j) {
-        if (shapes[shapeId[i]]->Position[axis] < splitPos)
+        if (m_ShapeCentroids[shapeId[i]][axis] < splitPos)
             i++;
         else
             std::swap(shapeId[i], shapeId[j--]);
@@ -148,9 +528,9 @@ void BVHTree::Subdivide(int nodeId, const std::vector<Shape*>& shapes) {
     int leftNbShape = i - node.LeftFirst;
     if (leftNbShape == 0 || leftNbShape == node.nbShape) return;
 
-    //Create child nodes
-    int leftChildId = nodesUsed++;
-    int rightChildId = nodesUsed++;
+    //Create child nodes (siblings are always allocated as a pair)
+    int leftChildId = nodeCounter.fetch_add(2);
+    int rightChildId = leftChildId + 1;
 
     nodes[leftChildId].LeftFirst = node.LeftFirst;
     nodes[leftChildId].nbShape = leftNbShape;
@@ -160,92 +540,41 @@ void BVHTree::Subdivide(int nodeId, const std::vector<Shape*>& shapes) {
     node.LeftFirst = leftChildId;
     node.nbShape = 0;
 
-    UpdateNodeBounds(leftChildId, shapes);
-    UpdateNodeBounds(rightChildId, shapes);
-
-    //Recurse
-    Subdivide(leftChildId, shapes);
-    Subdivide(rightChildId, shapes);
+    //Recurse, the two subtrees are independent so big ones are built as parallel tasks
+    auto buildLeft = [&]() {
+        UpdateNodeBounds(leftChildId);
+        Subdivide(leftChildId, nodeCounter);
+    };
+    auto buildRight = [&]() {
+        UpdateNodeBounds(rightChildId);
+        Subdivide(rightChildId, nodeCounter);
+    };
+
+    if (nodes[leftChildId].nbShape + nodes[rightChildId].nbShape >= PARALLEL_BUILD_MIN_SHAPES)
+        tbb::parallel_invoke(buildLeft, buildRight);
+    else {
+        buildLeft();
+        buildRight();
+    }
 }
 
 
-float BVHTree::EvaluateSAH(BVHNode& node, int axis, float pos, const std::vector<Shape*>& shapes) {
+float BVHTree::EvaluateSAH(BVHNode& node, int axis, float pos) {
 
     AABB leftBox, rightBox;
     int leftCount = 0, rightCount = 0;
 
     for( uint i = 0; i < node.nbShape; i++ ) {
 
-        Shape* shape = shapes[shapeId[node.LeftFirst + i]];
-        if (shape->Position[axis] < pos) {
+        int id = shapeId[node.LeftFirst + i];
+        if (m_ShapeCentroids[id][axis] < pos) {
             leftCount++;
-            leftBox.grow(shape->GetAABBMin());
-            leftBox.grow(shape->GetAABBMax());
+            leftBox.grow(m_ShapeBounds[id]);
         } else {
             rightCount++;
-            rightBox.grow(shape->GetAABBMin());
-            rightBox.grow(shape->GetAABBMax());
+            rightBox.grow(m_ShapeBounds[id]);
         }
     }
     float cost = leftCount * leftBox.area() + rightCount * rightBox.area();
     return cost > 0 ? cost : FLT_MAX;
-}
-
-
-void BVHTree::IntersectBVH(const Ray& ray, const std::vector<Shape*>& shapes, const uint nodeId, HitPayLoad& payload) const  {
-
-    const BVHNode* node = &nodes[rootNodeId];
-    const BVHNode* stack[64]; //Stack to visit node front to back
-    uint stackPtr = 0;
-
-    while(true) {
-        if (node->nbShape > 0) {
-            for (uint i = 0; i < node->nbShape; i++) {
-                Shape* shape = shapes[shapeId[node->LeftFirst + i]];
-                float t;
-            
-                if (shape->intersect(ray, t) && t < payload.HitDistance) {
-                    payload.HitDistance = t;
-                    payload.HitShape = shape;
-                }
-            }
-            if (stackPtr == 0) break;
-            else node = stack[--stackPtr];
-            continue;
-        }
-
-        const BVHNode* child1 = &nodes[node->LeftFirst];
-        const BVHNode* child2 = &nodes[node->LeftFirst + 1];
-
-        float dist1 = IntersectAABB(ray, child1->aabbMin, child1->aabbMax, payload.HitDistance);
-        float dist2 = IntersectAABB(ray, child2->aabbMin, child2->aabbMax, payload.HitDistance);
-        if (dist1 > dist2) { 
-            std::swap( dist1, dist2); 
-            std::swap( child1, child2);
-        } 
-        if (dist1 == FLT_MAX) { //miss
-            if (stackPtr == 0) break; 
-            else node = stack[--stackPtr];
-        } else {
-            node = child1;
-            if (dist2 != FLT_MAX) stack[stackPtr++] = child2;
-        }
-
-    }
-}
-
-
-float BVHTree::IntersectAABB(const Ray& ray, const glm::vec3& bmin, const glm::vec3& bmax, float tMax) const {
-
-    glm::vec3 invDir = 1.0f / ray.Direction;
-    glm::vec3 t0s = (bmin - ray.Origin) * invDir;
-    glm::vec3 t1s = (bmax - ray.Origin) * invDir;
-
-    glm::vec3 tmin = glm::min(t0s, t1s);
-    glm::vec3 tmax = glm::max(t0s, t1s);
-
-    float tminMax = glm::max(tmin.x, glm::max(tmin.y, tmin.z));
-    float tmaxMin = glm::min(tmax.x, glm::min(tmax.y, tmax.z));
-
-    return (tmaxMin >= tminMax && tminMax < tMax && tmaxMin > 0) ? tminMax : FLT_MAX;
 }
\ No newline at end of file
@@ -0,0 +1,33 @@
+#include "raytracer/MappedFile.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+
+MappedFile::MappedFile(const std::string& path, bool sequential) {
+
+    m_File = open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if (m_File < 0 || fstat(m_File, &status) < 0 || status.st_size == 0) {
+        if (m_File >= 0) close(m_File);
+        throw std::runtime_error("Could not open file " + path);
+    }
+
+    m_Size = status.st_size;
+    void* data = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, m_File, 0);
+    if (data == MAP_FAILED) {
+        close(m_File);
+        throw std::runtime_error("Could not map file " + path);
+    }
+    m_Data = (const char*)data;
+    madvise(data, m_Size, sequential ? MADV_SEQUENTIAL : MADV_WILLNEED);
+}
+
+MappedFile::~MappedFile() {
+    munmap((void*)m_Data, m_Size);
+    close(m_File);
+}
@@ -0,0 +1,435 @@
+#include "raytracer/Mesh.h"
+
+#include "raytracer/RayPacket.h"
+#include "raytracer/Scene.h"
+
+#include "imgui/imgui.h"
+#include "font/forkawesome.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <string>
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+
+namespace Utils {
+
+    static inline glm::vec3 GetVertex(const ArrayView<float> vertex[3], uint32_t i) {
+        return glm::vec3(vertex[0][i], vertex[1][i], vertex[2][i]);
+    }
+
+    // Watertight test of the triangle i with one ray of a packet, for the rays the group kernel
+    // leaves aside
+    static inline bool IntersectTriangleRay(const RayPacket& packet, const MeshData& data, uint32_t i, int ray, float& intersectT, glm::vec2& barycentric) {
+        TraversalRay traversalRay(Ray{packet.Origin, packet.GetDirection(ray)});
+        return IntersectTriangleWatertight(traversalRay, GetVertex(data.V0, i), GetVertex(data.V1, i), GetVertex(data.V2, i),
+            packet.HitDistance[ray], intersectT, barycentric);
+    }
+
+    // Watertight test of the triangle i with a group of rays of a packet, returns the rays hit
+    // closer than their HitDistance
+    static inline int IntersectTriangleGroup(const RayPacket& packet, const MeshData& data, uint32_t i, int group,
+        vfloatN& intersectT, vfloatN& baryU, vfloatN& baryV) {
+
+        int first = group * SIMD_WIDTH;
+        int onEdge = (1 << SIMD_WIDTH) - 1;
+        int hit = 0;
+        intersectT = baryU = baryV = vfloatN(0.0f);
+
+        //The origin is shared, only the shear depends on the ray
+        if (packet.GroupAxis[group][2] >= 0) {
+            hit = IntersectTriangleRaysWatertight<SIMD_WIDTH>(
+                GetVertex(data.V0, i) - packet.Origin, GetVertex(data.V1, i) - packet.Origin, GetVertex(data.V2, i) - packet.Origin,
+                packet.GroupAxis[group], vfloatN::load(&packet.Shear[0][first]), vfloatN::load(&packet.Shear[1][first]),
+                vfloatN::load(&packet.Shear[2][first]), vfloatN::load(&packet.HitDistance[first]), intersectT, baryU, baryV, onEdge);
+            if (!onEdge) return hit;
+        }
+
+        alignas(32) float lanes[3][SIMD_WIDTH];
+        intersectT.store(lanes[0]);
+        baryU.store(lanes[1]);
+        baryV.store(lanes[2]);
+        while (onEdge) {
+            int lane = __builtin_ctz(onEdge);
+            onEdge &= onEdge - 1;
+            glm::vec2 barycentric;
+            if (IntersectTriangleRay(packet, data, i, first + lane, lanes[0][lane], barycentric)) {
+                lanes[1][lane] = barycentric.x;
+                lanes[2][lane] = barycentric.y;
+                hit |= 1 << lane;
+            }
+        }
+        intersectT = vfloatN::load(lanes[0]);
+        baryU = vfloatN::load(lanes[1]);
+        baryV = vfloatN::load(lanes[2]);
+        return hit;
+    }
+}
+
+
+MeshData::MeshData(std::vector<glm::vec3> vertices, std::vector<uint32_t> indices)
+    : m_Vertices(std::move(vertices)) {
+
+    Vertices = m_Vertices;
+    size_t nbTriangle = indices.size() / 3;
+
+    //Build the BVH over the triangles bounds
+    std::vector<AABB> bounds(nbTriangle);
+    std::vector<glm::vec3> centroids(nbTriangle);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, nbTriangle), [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t i = r.begin(); i < r.end(); i++) {
+            const glm::vec3& p0 = m_Vertices[indices[3*i]];
+            const glm::vec3& p1 = m_Vertices[indices[3*i + 1]];
+            const glm::vec3& p2 = m_Vertices[indices[3*i + 2]];
+            bounds[i].grow(p0); bounds[i].grow(p1); bounds[i].grow(p2);
+            centroids[i] = (p0 + p1 + p2) / 3.0f;
+        }
+    });
+    bvh.BuildBVH(std::move(bounds), std::move(centroids));
+    SAHCost = bvh.SAHCost();
+    if (!bvh.nodes.empty()) {
+        Bounds.bmin = bvh.nodes[bvh.rootNodeId].aabbMin;
+        Bounds.bmax = bvh.nodes[bvh.rootNodeId].aabbMax;
+    }
+
+    //Store the triangles in leaf order
+    m_Indices.resize(nbTriangle * 3);
+    for (AlignedVector<float>& array : m_Triangles) array.assign(nbTriangle + MESH_TRIANGLE_PADDING, 0.0f);
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, nbTriangle), [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t i = r.begin(); i < r.end(); i++) {
+            size_t src = bvh.shapeId[i];
+            for (int k = 0; k < 3; k++) m_Indices[3*i + k] = indices[3*src + k];
+
+            for (int k = 0; k < 3; k++) {
+                const glm::vec3& p = m_Vertices[m_Indices[3*i + k]];
+                for (int a = 0; a < 3; a++) m_Triangles[3*k + a][i] = p[a];
+            }
+        }
+    });
+
+    Indices = m_Indices;
+    for (int a = 0; a < 3; a++) {
+        V0[a] = m_Triangles[a];
+        V1[a] = m_Triangles[3 + a];
+        V2[a] = m_Triangles[6 + a];
+    }
+
+    //Leaves now index the triangles directly
+    bvh.shapeId = std::vector<int>();
+
+#if BVH_WIDTH > 2
+    wbvh.Build(bvh);
+    bvh.nodes = std::vector<BVHNode>();
+#endif
+}
+
+
+size_t MeshData::MemoryUsage() const {
+    return Vertices.size() * sizeof(glm::vec3) + Indices.size() * sizeof(uint32_t)
+        + 9 * V0[0].size() * sizeof(float) + bvh.nodes.size() * sizeof(BVHNode)
+#if BVH_WIDTH > 2
+        + wbvh.nodes.size() * sizeof(WideBVHNode<BVH_WIDTH>) + wbvh.MemoryUsage()
+#endif
+        ;
+}
+
+
+Mesh::Mesh(std::vector<glm::vec3> vertices, std::vector<uint32_t> indices, int materialIndex)
+    : Mesh(std::make_shared<const MeshData>(std::move(vertices), std::move(indices)), materialIndex) {}
+
+Mesh::Mesh(std::shared_ptr<const MeshData> data, int materialIndex)
+    : Data(std::move(data)) {
+
+    MaterialIndex = materialIndex;
+    Position = (Data->Bounds.bmin + Data->Bounds.bmax) * 0.5f;
+    UpdateTransform();
+}
+
+glm::vec3 Mesh::GetAABBMin() const {
+    return m_Bounds.bmin;
+}
+
+glm::vec3 Mesh::GetAABBMax() const {
+    return m_Bounds.bmax;
+}
+
+
+void Mesh::UpdateTransform() {
+
+    glm::vec3 center = (Data->Bounds.bmin + Data->Bounds.bmax) * 0.5f;
+    m_Transformed = Position != center || Rotation != glm::vec3(0.0f) || Scale != glm::vec3(1.0f);
+    if (!m_Transformed) {
+        m_ObjectToWorld = glm::mat4(1.0f);
+        m_WorldToObject = glm::mat4(1.0f);
+        m_NormalToWorld = glm::mat3(1.0f);
+        m_Bounds = Data->Bounds;
+        return;
+    }
+
+    glm::mat4 objectToWorld = glm::translate(glm::mat4(1.0f), Position);
+    objectToWorld = glm::rotate(objectToWorld, glm::radians(Rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+    objectToWorld = glm::rotate(objectToWorld, glm::radians(Rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+    objectToWorld = glm::rotate(objectToWorld, glm::radians(Rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+    objectToWorld = glm::scale(objectToWorld, Scale);
+    objectToWorld = glm::translate(objectToWorld, -center);
+
+    m_ObjectToWorld = objectToWorld;
+    m_WorldToObject = glm::inverse(objectToWorld);
+    m_NormalToWorld = glm::transpose(glm::mat3(m_WorldToObject));
+
+    //World bounds of the corners of the object bounds
+    m_Bounds = AABB();
+    for (int corner = 0; corner < 8; corner++) {
+        glm::vec3 p((corner & 1) ? Data->Bounds.bmax.x : Data->Bounds.bmin.x,
+                    (corner & 2) ? Data->Bounds.bmax.y : Data->Bounds.bmin.y,
+                    (corner & 4) ? Data->Bounds.bmax.z : Data->Bounds.bmin.z);
+        m_Bounds.grow(glm::vec3(objectToWorld * glm::vec4(p, 1.0f)));
+    }
+}
+
+
+bool Mesh::intersect(const Ray& ray, float& intersectT) const {
+
+    HitPayLoad payload;
+    payload.HitDistance = FLT_MAX;
+    if (!intersect(ray, payload)) return false;
+
+    intersectT = payload.HitDistance;
+    return true;
+}
+
+bool Mesh::intersect(const Ray& ray, HitPayLoad& payload) const {
+
+    if (!m_Transformed) return IntersectObject(ray, payload);
+
+    //The direction is not normalized so that the hit distances are the same in both spaces
+    Ray objectRay;
+    objectRay.Origin = glm::vec3(m_WorldToObject * glm::vec4(ray.Origin, 1.0f));
+    objectRay.Direction = glm::mat3(m_WorldToObject) * ray.Direction;
+    return IntersectObject(objectRay, payload);
+}
+
+bool Mesh::IntersectObject(const Ray& objectRay, HitPayLoad& payload) const {
+
+    const MeshData& data = *Data;
+    TraversalRay ray(objectRay);
+    bool hit = false;
+
+    //The triangles of a leaf are tested SIMD_WIDTH at a time, the padding covers the last ones
+    data.Traverse(ray, payload, [&](uint first, uint nbTriangle) {
+        for (uint i = first; i < first + nbTriangle; i += SIMD_WIDTH) {
+            const float* p0[3] = { &data.V0[0][i], &data.V0[1][i], &data.V0[2][i] };
+            const float* p1[3] = { &data.V1[0][i], &data.V1[1][i], &data.V1[2][i] };
+            const float* p2[3] = { &data.V2[0][i], &data.V2[1][i], &data.V2[2][i] };
+
+            vfloatN t, baryU, baryV;
+            int laneMask = IntersectTrianglesWatertight<SIMD_WIDTH>(ray, p0, p1, p2, payload.HitDistance, t, baryU, baryV);
+            if (first + nbTriangle - i < SIMD_WIDTH) laneMask &= (1 << (first + nbTriangle - i)) - 1;
+            if (!laneMask) continue;
+
+            alignas(32) float lanes[3][SIMD_WIDTH];
+            t.store(lanes[0]);
+            baryU.store(lanes[1]);
+            baryV.store(lanes[2]);
+
+            //Closest of the triangles hit, the first one on ties
+            while (laneMask) {
+                int lane = __builtin_ctz(laneMask);
+                laneMask &= laneMask - 1;
+                if (lanes[0][lane] >= payload.HitDistance) continue;
+                payload.HitDistance = lanes[0][lane];
+                payload.PrimitiveId = i + lane;
+                payload.Barycentric = glm::vec2(lanes[1][lane], lanes[2][lane]);
+                hit = true;
+            }
+        }
+    });
+
+    return hit;
+}
+
+bool Mesh::Occluded(const TraversalRay& ray) const {
+
+    if (!m_Transformed) return OccludedObject(ray);
+
+    Ray objectRay;
+    objectRay.Origin = glm::vec3(m_WorldToObject * glm::vec4(ray.Origin, 1.0f));
+    objectRay.Direction = glm::mat3(m_WorldToObject) * ray.Direction;
+    return OccludedObject(TraversalRay(objectRay, ray.TMin, ray.TMax));
+}
+
+thread_local uint32_t Mesh::s_LastOccluder = 0;
+
+bool Mesh::OccludedObject(const TraversalRay& ray) const {
+
+    const MeshData& data = *Data;
+
+    //The lanes past the end of a leaf test triangles of the next leaves (or the degenerate
+    //padding) : any of them hit occludes the ray just as well, so they are not masked
+    auto occludedBlock = [&](uint i) {
+        const float* p0[3] = { &data.V0[0][i], &data.V0[1][i], &data.V0[2][i] };
+        const float* p1[3] = { &data.V1[0][i], &data.V1[1][i], &data.V1[2][i] };
+        const float* p2[3] = { &data.V2[0][i], &data.V2[1][i], &data.V2[2][i] };
+        return OccludedTrianglesWatertight<SIMD_WIDTH>(ray, p0, p1, p2);
+    };
+
+    if (s_LastOccluder < data.TriangleCount() && occludedBlock(s_LastOccluder)) return true;
+
+    return data.TraverseAny(ray, [&](uint first, uint nbTriangle) {
+        for (uint i = first; i < first + nbTriangle; i += SIMD_WIDTH) {
+            if (occludedBlock(i)) {
+                s_LastOccluder = i;
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+uint64_t Mesh::IntersectPacket(RayPacket& packet, uint32_t groups) const {
+
+    //Instances are traced ray by ray : usually small on screen, the groups that reach one
+    //mostly hold rays missing it (twice the packet throughput on 100 bunnies)
+    if (m_Transformed) return Shape::IntersectPacket(packet, groups);
+    return IntersectPacketObject(packet, groups);
+}
+
+uint64_t Mesh::IntersectPacketObject(RayPacket& packet, uint32_t groups) const {
+
+    const MeshData& data = *Data;
+    uint64_t hitMask = 0;
+
+    data.TraversePacket(packet, groups, [&](uint first, uint nbTriangle, uint32_t activeGroups) {
+        for (uint i = first; i < first + nbTriangle; i++) {
+            for (int g = 0; g < PACKET_GROUPS; g++) {
+                if (!(activeGroups & (1u << g))) continue;
+
+                vfloatN t, baryU, baryV;
+                int laneMask = Utils::IntersectTriangleGroup(packet, data, i, g, t, baryU, baryV);
+                if (!laneMask) continue;
+
+                alignas(32) float lanes[3][SIMD_WIDTH];
+                t.store(lanes[0]);
+                baryU.store(lanes[1]);
+                baryV.store(lanes[2]);
+                while (laneMask) {
+                    int lane = __builtin_ctz(laneMask);
+                    laneMask &= laneMask - 1;
+                    int ray = g * SIMD_WIDTH + lane;
+                    packet.HitDistance[ray] = lanes[0][lane];
+                    packet.PrimitiveId[ray] = i;
+                    packet.Barycentric[0][ray] = lanes[1][lane];
+                    packet.Barycentric[1][ray] = lanes[2][lane];
+                    hitMask |= 1ull << ray;
+                }
+            }
+        }
+    });
+
+    return hitMask;
+}
+
+void Mesh::GetWorldTriangle(uint32_t i, glm::vec3 p[3]) const {
+
+    const MeshData& data = *Data;
+    p[0] = Utils::GetVertex(data.V0, i);
+    p[1] = Utils::GetVertex(data.V1, i);
+    p[2] = Utils::GetVertex(data.V2, i);
+    if (m_Transformed)
+        for (int k = 0; k < 3; k++) p[k] = glm::vec3(m_ObjectToWorld * glm::vec4(p[k], 1.0f));
+}
+
+// A triangle is drawn uniformly (no area table to build or to cache), then a point of it
+// uniformly over its area
+bool Mesh::SampleLight(const glm::vec3& p, glm::vec2 u, LightSample& sample) const {
+
+    uint32_t nbTriangle = (uint32_t)Data->TriangleCount();
+    if (nbTriangle == 0) return false;
+
+    float scaled = u.x * nbTriangle;
+    uint32_t i = glm::min((uint32_t)scaled, nbTriangle - 1);
+    u.x = glm::min(scaled - i, 1.0f);
+
+    glm::vec3 v[3];
+    GetWorldTriangle(i, v);
+    float su = glm::sqrt(u.x);
+    glm::vec3 point = v[0] * (1.0f - su) + v[1] * (su * (1.0f - u.y)) + v[2] * (su * u.y);
+    glm::vec3 cross = glm::cross(v[1] - v[0], v[2] - v[0]);
+    float area = .5f * glm::length(cross);
+
+    glm::vec3 toPoint = point - p;
+    sample.Distance = glm::length(toPoint);
+    sample.Direction = toPoint / sample.Distance;
+
+    float cosine = glm::abs(glm::dot(cross, sample.Direction)) / (2.0f * area);
+    if (cosine <= 0.0f || area <= 0.0f) return false;
+    sample.Pdf = sample.Distance * sample.Distance / (cosine * area * nbTriangle);
+    return true;
+}
+
+float Mesh::LightPdf(const Ray& ray, const HitPayLoad& payload) const {
+
+    glm::vec3 v[3];
+    GetWorldTriangle(payload.PrimitiveId, v);
+    float area = .5f * glm::length(glm::cross(v[1] - v[0], v[2] - v[0]));
+    float cosine = glm::abs(glm::dot(payload.WorldNormal, ray.Direction));
+    if (cosine <= 0.0f || area <= 0.0f) return 0.0f;
+    return payload.HitDistance * payload.HitDistance / (cosine * area * Data->TriangleCount());
+}
+
+void Mesh::ClosestHit(const Ray& ray, HitPayLoad& payload) {
+
+    const MeshData& data = *Data;
+    uint32_t i = payload.PrimitiveId;
+
+    glm::vec3 p0 = Utils::GetVertex(data.V0, i);
+    glm::vec3 e1 = Utils::GetVertex(data.V1, i) - p0;
+    glm::vec3 e2 = Utils::GetVertex(data.V2, i) - p0;
+
+    payload.WorldPosition = ray.Origin + ray.Direction * payload.HitDistance;
+    payload.WorldNormal = glm::normalize(m_NormalToWorld * glm::cross(e1, e2));
+}
+
+
+bool Mesh::RenderUiSettings(int index, Scene& scene) {
+
+    bool edited = false;
+
+    ImGui::PushID(index);
+
+    std::string objectName = ICON_FK_CUBE " Mesh " + std::to_string(index);
+    bool isOpen = ImGui::TreeNode(objectName.c_str());
+
+    edited |= RenderDeleteButton(index, scene);
+
+    if (isOpen) {
+
+        ImGui::Text("%zu triangles, %zu vertices (%.1f MB, %ld instances)", Data->TriangleCount(), Data->Vertices.size(),
+            Data->MemoryUsage() / (1024.0f * 1024.0f), Data.use_count());
+
+        bool moved = false;
+        moved |= ImGui::DragFloat3(ICON_FK_ARROWS " Position", glm::value_ptr(Position), .01f);
+        moved |= ImGui::DragFloat3(ICON_FK_REPEAT " Rotation", glm::value_ptr(Rotation), .5f);
+        moved |= ImGui::DragFloat3(ICON_FK_EXPAND " Scale", glm::value_ptr(Scale), .01f);
+        if (moved) UpdateTransform();
+        edited |= moved;
+
+        edited |= RenderUiMaterial(scene);
+
+        //New instance next to this one, sharing the geometry
+        if (ImGui::Button(ICON_FK_CLONE " Instance")) {
+            Mesh* instance = new Mesh(*this);
+            instance->Position.x += m_Bounds.bmax.x - m_Bounds.bmin.x;
+            instance->UpdateTransform();
+            scene.Shapes.push_back(instance);
+            edited = true;
+        }
+
+        ImGui::TreePop();
+    }
+    ImGui::PopID();
+
+    return edited;
+}
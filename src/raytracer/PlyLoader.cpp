@@ -0,0 +1,585 @@
+#include "raytracer/PlyLoader.h"
+#include "raytracer/MappedFile.h"
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+
+enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64, Invalid };
+
+enum class PlyFormat { Ascii, BinaryLittleEndian, BinaryBigEndian };
+
+struct PlyProperty {
+    std::string Name;
+    PlyType Type = PlyType::Invalid;      // Type of the items for lists
+    PlyType CountType = PlyType::Invalid; // Lists only
+    bool IsList = false;
+};
+
+struct PlyElement {
+    std::string Name;
+    size_t Count = 0;
+    std::vector<PlyProperty> Properties;
+};
+
+struct PlyHeader {
+    PlyFormat Format = PlyFormat::Ascii;
+    std::vector<PlyElement> Elements;
+    size_t DataOffset = 0; // First byte after end_header
+};
+
+
+namespace Utils {
+
+    static void Fail(const std::string& message) {
+        throw std::runtime_error("PLY parser: " + message);
+    }
+
+    static PlyType ParseType(const std::string& name) {
+        if (name == "char" || name == "int8") return PlyType::Int8;
+        if (name == "uchar" || name == "uint8") return PlyType::UInt8;
+        if (name == "short" || name == "int16") return PlyType::Int16;
+        if (name == "ushort" || name == "uint16") return PlyType::UInt16;
+        if (name == "int" || name == "int32") return PlyType::Int32;
+        if (name == "uint" || name == "uint32") return PlyType::UInt32;
+        if (name == "float" || name == "float32") return PlyType::Float32;
+        if (name == "double" || name == "float64") return PlyType::Float64;
+        Fail("unknown property type " + name);
+        return PlyType::Invalid;
+    }
+
+    static size_t TypeSize(PlyType type) {
+        switch (type) {
+            case PlyType::Int8: case PlyType::UInt8: return 1;
+            case PlyType::Int16: case PlyType::UInt16: return 2;
+            case PlyType::Int32: case PlyType::UInt32: case PlyType::Float32: return 4;
+            case PlyType::Float64: return 8;
+            default: return 0;
+        }
+    }
+
+    // Next line of the header, without the line break
+    static std::string NextHeaderLine(const char*& p, const char* end) {
+        const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+        if (!lineEnd) Fail("unterminated header");
+        std::string line(p, lineEnd);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        p = lineEnd + 1;
+        return line;
+    }
+
+    static std::vector<std::string> SplitWords(const std::string& line) {
+        std::vector<std::string> words;
+        size_t i = 0;
+        while (i < line.size()) {
+            while (i < line.size() && isspace((unsigned char)line[i])) i++;
+            size_t start = i;
+            while (i < line.size() && !isspace((unsigned char)line[i])) i++;
+            if (i > start) words.emplace_back(line, start, i - start);
+        }
+        return words;
+    }
+
+    static PlyHeader ParseHeader(const char* data, size_t size) {
+
+        PlyHeader header;
+        const char* p = data;
+        const char* end = data + size;
+
+        if (NextHeaderLine(p, end) != "ply") Fail("not a PLY file");
+
+        while (true) {
+            std::vector<std::string> words = SplitWords(NextHeaderLine(p, end));
+            if (words.empty() || words[0] == "comment" || words[0] == "obj_info") continue;
+
+            if (words[0] == "end_header") break;
+
+            if (words[0] == "format" && words.size() >= 2) {
+                if (words[1] == "ascii") header.Format = PlyFormat::Ascii;
+                else if (words[1] == "binary_little_endian") header.Format = PlyFormat::BinaryLittleEndian;
+                else if (words[1] == "binary_big_endian") header.Format = PlyFormat::BinaryBigEndian;
+                else Fail("unknown format " + words[1]);
+            }
+            else if (words[0] == "element" && words.size() >= 3) {
+                PlyElement element;
+                element.Name = words[1];
+                element.Count = std::stoull(words[2]);
+                header.Elements.push_back(element);
+            }
+            else if (words[0] == "property" && !header.Elements.empty()) {
+                PlyProperty property;
+                if (words.size() >= 5 && words[1] == "list") {
+                    property.IsList = true;
+                    property.CountType = ParseType(words[2]);
+                    property.Type = ParseType(words[3]);
+                    property.Name = words[4];
+                } else if (words.size() >= 3) {
+                    property.Type = ParseType(words[1]);
+                    property.Name = words[2];
+                } else Fail("malformed property");
+                header.Elements.back().Properties.push_back(property);
+            }
+            else Fail("unexpected header line " + words[0]);
+        }
+
+        header.DataOffset = p - data;
+        return header;
+    }
+
+    static int FindProperty(const PlyElement& element, const char* name) {
+        for (size_t i = 0; i < element.Properties.size(); i++)
+            if (element.Properties[i].Name == name) return i;
+        return -1;
+    }
+
+
+    //Binary values
+
+    template<typename T>
+    static T Load(const char* p, bool swap) {
+        T value;
+        memcpy(&value, p, sizeof(T));
+        if (swap) {
+            char* bytes = (char*)&value;
+            for (size_t i = 0; i < sizeof(T) / 2; i++) std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+        }
+        return value;
+    }
+
+    static double ReadValue(const char* p, PlyType type, bool swap) {
+        switch (type) {
+            case PlyType::Int8: return (int8_t)*p;
+            case PlyType::UInt8: return (uint8_t)*p;
+            case PlyType::Int16: return Load<int16_t>(p, swap);
+            case PlyType::UInt16: return Load<uint16_t>(p, swap);
+            case PlyType::Int32: return Load<int32_t>(p, swap);
+            case PlyType::UInt32: return Load<uint32_t>(p, swap);
+            case PlyType::Float32: return Load<float>(p, swap);
+            case PlyType::Float64: return Load<double>(p, swap);
+            default: return 0.0;
+        }
+    }
+
+    static int64_t ReadInteger(const char* p, PlyType type, bool swap) {
+        switch (type) {
+            case PlyType::Int8: return (int8_t)*p;
+            case PlyType::UInt8: return (uint8_t)*p;
+            case PlyType::Int16: return Load<int16_t>(p, swap);
+            case PlyType::UInt16: return Load<uint16_t>(p, swap);
+            case PlyType::Int32: return Load<int32_t>(p, swap);
+            case PlyType::UInt32: return Load<uint32_t>(p, swap);
+            default: return (int64_t)ReadValue(p, type, swap);
+        }
+    }
+
+
+    //ASCII tokens (never cross a line break)
+
+    static const char* SkipSpaces(const char* p, const char* end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+        return p;
+    }
+
+    static bool IsBlank(const char* p, const char* lineEnd) {
+        return SkipSpaces(p, lineEnd) == lineEnd;
+    }
+
+    static const char* SkipToken(const char* p, const char* end) {
+        p = SkipSpaces(p, end);
+        const char* start = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+        return p > start ? p : nullptr;
+    }
+
+    static const char* ParseInteger(const char* p, const char* end, int64_t& value) {
+        p = SkipSpaces(p, end);
+        bool negative = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) p++;
+        const char* start = p;
+        value = 0;
+        for (; p < end && (unsigned)(*p - '0') < 10; p++) value = value * 10 + (*p - '0');
+        if (p == start) return nullptr;
+        if (negative) value = -value;
+        return p;
+    }
+
+    // Adds the triangle fan of a polygon, returns false on out of range indices
+    struct FanBuilder {
+        std::vector<uint32_t>& Indices;
+        size_t NbVertex;
+        uint32_t First = 0, Previous = 0;
+        int Count = 0;
+
+        bool Add(int64_t index) {
+            if (index < 0 || (size_t)index >= NbVertex) return false;
+            if (Count >= 2) {
+                Indices.push_back(First);
+                Indices.push_back(Previous);
+                Indices.push_back(index);
+            } else if (Count == 0) First = index;
+            Previous = index;
+            Count++;
+            return true;
+        }
+    };
+}
+
+
+const char* PlyLoader::ParseFloat(const char* str, const char* end, float& value) {
+
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char* p = str;
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) p++;
+
+    //Up to 19 significant digits in the mantissa, the others only move the exponent
+    uint64_t mantissa = 0;
+    int exponent = 0, digits = 0;
+    bool hasDigits = false;
+
+    for (; p < end && (unsigned)(*p - '0') < 10; p++) {
+        hasDigits = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+        } else exponent++;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && (unsigned)(*p - '0') < 10; p++) {
+            hasDigits = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+    if (!hasDigits) return str; // "inf" and "nan" included
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool negativeExponent = q < end && *q == '-';
+        if (q < end && (*q == '-' || *q == '+')) q++;
+        int e = 0;
+        const char* digitsStart = q;
+        for (; q < end && (unsigned)(*q - '0') < 10; q++) e = std::min(e * 10 + (*q - '0'), 100000);
+        if (q > digitsStart) {
+            exponent += negativeExponent ? -e : e;
+            p = q;
+        }
+    }
+
+    double result = (double)mantissa;
+    if (mantissa != 0) {
+        if (exponent >= 0 && exponent <= 22) result *= powers[exponent];
+        else if (exponent < 0 && exponent >= -22) result /= powers[-exponent];
+        else result *= std::pow(10.0, exponent);
+    }
+
+    //Out of the range of floats
+    float parsed = (float)(negative ? -result : result);
+    if (!std::isfinite(parsed)) return str;
+
+    value = parsed;
+    return p;
+}
+
+
+static void LoadAscii(const char* body, const char* end, const PlyHeader& header, int vertexElement, int faceElement,
+                      std::vector<glm::vec3>& vertices, std::vector<uint32_t>& indices) {
+
+    //Chunks start at the beginning of a line
+    size_t size = end - body;
+    size_t nbChunk = std::max<size_t>(1, (size + PLY_CHUNK_SIZE - 1) / PLY_CHUNK_SIZE);
+    std::vector<const char*> chunkStart(nbChunk + 1);
+    chunkStart[0] = body;
+    chunkStart[nbChunk] = end;
+    for (size_t c = 1; c < nbChunk; c++) {
+        const char* p = body + c * size / nbChunk;
+        const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+        chunkStart[c] = std::max(chunkStart[c - 1], lineEnd ? lineEnd + 1 : end);
+    }
+
+    //Index of the first line of each chunk, blank lines are skipped
+    std::vector<size_t> firstLine(nbChunk + 1, 0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, nbChunk, 1), [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t c = r.begin(); c < r.end(); c++) {
+            size_t nbLine = 0;
+            for (const char* p = chunkStart[c]; p < chunkStart[c + 1];) {
+                const char* lineEnd = (const char*)memchr(p, '\n', chunkStart[c + 1] - p);
+                if (!lineEnd) lineEnd = chunkStart[c + 1]; // Last line without line break
+                nbLine += !Utils::IsBlank(p, lineEnd);
+                p = lineEnd + 1;
+            }
+            firstLine[c + 1] = nbLine;
+        }
+    });
+    for (size_t c = 0; c < nbChunk; c++) firstLine[c + 1] += firstLine[c];
+
+    //Lines of each element (one per instance)
+    size_t nbElement = header.Elements.size();
+    std::vector<size_t> elementLine(nbElement + 1, 0);
+    for (size_t e = 0; e < nbElement; e++) elementLine[e + 1] = elementLine[e] + header.Elements[e].Count;
+    if (firstLine[nbChunk] < elementLine[nbElement]) Utils::Fail("unexpected end of file");
+
+    int px = -1, py = -1, pz = -1, pIndices = -1;
+    if (vertexElement >= 0) {
+        const PlyElement& element = header.Elements[vertexElement];
+        px = Utils::FindProperty(element, "x");
+        py = Utils::FindProperty(element, "y");
+        pz = Utils::FindProperty(element, "z");
+        if (px < 0 || py < 0 || pz < 0) Utils::Fail("missing vertex position");
+    }
+    if (faceElement >= 0) pIndices = Utils::FindProperty(header.Elements[faceElement], "vertex_indices");
+    if (faceElement >= 0 && pIndices < 0) pIndices = Utils::FindProperty(header.Elements[faceElement], "vertex_index");
+
+    size_t nbVertex = vertices.size();
+    std::vector<std::vector<uint32_t>> chunkIndices(nbChunk);
+    std::atomic<bool> failed{false};
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, nbChunk, 1), [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t c = r.begin(); c < r.end(); c++) {
+
+            Utils::FanBuilder fan{chunkIndices[c], nbVertex};
+            size_t line = firstLine[c];
+            size_t e = 0;
+            const char* lineEnd = nullptr;
+
+            for (const char* p = chunkStart[c]; p < chunkStart[c + 1] && line < elementLine[nbElement]; p = lineEnd + 1) {
+
+                lineEnd = (const char*)memchr(p, '\n', chunkStart[c + 1] - p);
+                if (!lineEnd) lineEnd = chunkStart[c + 1];
+                if (Utils::IsBlank(p, lineEnd)) continue;
+
+                while (line >= elementLine[e + 1]) e++;
+
+                if ((int)e == vertexElement || (int)e == faceElement) {
+                    const PlyElement& element = header.Elements[e];
+                    glm::vec3 position(0.0f);
+                    const char* q = p;
+
+                    for (int k = 0; k < (int)element.Properties.size() && q; k++) {
+                        const PlyProperty& property = element.Properties[k];
+
+                        if (property.IsList) {
+                            int64_t count;
+                            q = Utils::ParseInteger(q, lineEnd, count);
+                            if (!q || count < 0) break;
+                            fan.Count = 0;
+                            for (int64_t i = 0; i < count && q; i++) {
+                                if (k == pIndices) {
+                                    int64_t index;
+                                    q = Utils::ParseInteger(q, lineEnd, index);
+                                    if (q && !fan.Add(index)) q = nullptr;
+                                } else q = Utils::SkipToken(q, lineEnd);
+                            }
+                        }
+                        else if ((int)e == vertexElement && (k == px || k == py || k == pz)) {
+                            float value;
+                            const char* start = Utils::SkipSpaces(q, lineEnd);
+                            q = PlyLoader::ParseFloat(start, lineEnd, value);
+                            if (q == start) q = nullptr;
+                            position[k == px ? 0 : (k == py ? 1 : 2)] = value;
+                        }
+                        else q = Utils::SkipToken(q, lineEnd);
+                    }
+
+                    if (!q) {
+                        failed = true;
+                        break;
+                    }
+                    if ((int)e == vertexElement) vertices[line - elementLine[e]] = position;
+                }
+                line++;
+            }
+        }
+    });
+
+    if (failed) Utils::Fail("malformed data or vertex index out of range");
+
+    //Concatenate the triangles of the chunks
+    std::vector<size_t> offset(nbChunk + 1, 0);
+    for (size_t c = 0; c < nbChunk; c++) offset[c + 1] = offset[c] + chunkIndices[c].size();
+    indices.resize(offset[nbChunk]);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, nbChunk, 1), [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t c = r.begin(); c < r.end(); c++)
+            std::copy(chunkIndices[c].begin(), chunkIndices[c].end(), indices.begin() + offset[c]);
+    });
+}
+
+
+static void LoadBinary(const char* body, const char* end, const PlyHeader& header, int vertexElement, int faceElement,
+                       std::vector<glm::vec3>& vertices, std::vector<uint32_t>& indices) {
+
+    bool swap = header.Format == PlyFormat::BinaryBigEndian;
+    size_t nbVertex = vertices.size();
+    const char* p = body;
+
+    for (int e = 0; e < (int)header.Elements.size() && (e <= vertexElement || e <= faceElement); e++) {
+
+        const PlyElement& element = header.Elements[e];
+
+        bool hasList = false;
+        size_t stride = 0;
+        for (const PlyProperty& property : element.Properties) {
+            hasList |= property.IsList;
+            stride += Utils::TypeSize(property.Type);
+        }
+
+        //Fixed size instances : decoded in parallel. The counts come from the header, they are
+        //compared by division so that their products cannot overflow
+        if (!hasList) {
+            if (stride > 0 && element.Count > (size_t)(end - p) / stride) Utils::Fail("unexpected end of file");
+
+            if (e == vertexElement) {
+                size_t offset[3];
+                PlyType type[3];
+                const char* names[3] = { "x", "y", "z" };
+                for (int a = 0; a < 3; a++) {
+                    int k = Utils::FindProperty(element, names[a]);
+                    if (k < 0) Utils::Fail(std::string("missing vertex property ") + names[a]);
+                    offset[a] = 0;
+                    for (int i = 0; i < k; i++) offset[a] += Utils::TypeSize(element.Properties[i].Type);
+                    type[a] = element.Properties[k].Type;
+                }
+
+                std::atomic<bool> notFinite{false};
+                tbb::parallel_for(tbb::blocked_range<size_t>(0, element.Count), [&](const tbb::blocked_range<size_t>& r) {
+                    for (size_t i = r.begin(); i < r.end(); i++) {
+                        for (int a = 0; a < 3; a++) {
+                            vertices[i][a] = Utils::ReadValue(p + i * stride + offset[a], type[a], swap);
+                            if (!std::isfinite(vertices[i][a])) notFinite = true;
+                        }
+                    }
+                });
+                if (notFinite) Utils::Fail("vertex position not finite");
+            }
+            p += element.Count * stride;
+            continue;
+        }
+
+        //Faces made of a single list, all with the same number of vertices : fixed size too
+        if (e == faceElement && element.Properties.size() == 1 && element.Count > 0) {
+            const PlyProperty& list = element.Properties[0];
+            size_t countSize = Utils::TypeSize(list.CountType), indexSize = Utils::TypeSize(list.Type);
+            int64_t n = (size_t)(end - p) >= countSize ? Utils::ReadInteger(p, list.CountType, swap) : -1;
+            size_t faceStride = countSize + std::max<int64_t>(n, 0) * indexSize;
+
+            if (n >= 3 && element.Count <= (size_t)(end - p) / faceStride) {
+                std::atomic<bool> uniform{true};
+                tbb::parallel_for(tbb::blocked_range<size_t>(0, element.Count), [&](const tbb::blocked_range<size_t>& r) {
+                    for (size_t i = r.begin(); i < r.end() && uniform; i++)
+                        if (Utils::ReadInteger(p + i * faceStride, list.CountType, swap) != n) uniform = false;
+                });
+
+                if (uniform) {
+                    size_t trianglesPerFace = n - 2;
+                    indices.resize(element.Count * trianglesPerFace * 3);
+                    std::atomic<bool> outOfRange{false};
+
+                    tbb::parallel_for(tbb::blocked_range<size_t>(0, element.Count), [&](const tbb::blocked_range<size_t>& r) {
+                        for (size_t i = r.begin(); i < r.end(); i++) {
+                            const char* face = p + i * faceStride + countSize;
+                            uint32_t* out = &indices[i * trianglesPerFace * 3];
+                            int64_t first = Utils::ReadInteger(face, list.Type, swap);
+                            int64_t previous = Utils::ReadInteger(face + indexSize, list.Type, swap);
+                            bool valid = first >= 0 && (size_t)first < nbVertex && previous >= 0 && (size_t)previous < nbVertex;
+                            for (int64_t k = 2; k < n; k++) {
+                                int64_t index = Utils::ReadInteger(face + k * indexSize, list.Type, swap);
+                                valid &= index >= 0 && (size_t)index < nbVertex;
+                                *out++ = first;
+                                *out++ = previous;
+                                *out++ = index;
+                                previous = index;
+                            }
+                            if (!valid) outOfRange = true;
+                        }
+                    });
+
+                    if (outOfRange) Utils::Fail("vertex index out of range");
+                    p += element.Count * faceStride;
+                    continue;
+                }
+            }
+        }
+
+        //Variable size instances : decoded in order
+        int pIndices = Utils::FindProperty(element, "vertex_indices");
+        if (pIndices < 0) pIndices = Utils::FindProperty(element, "vertex_index");
+        Utils::FanBuilder fan{indices, nbVertex};
+
+        for (size_t i = 0; i < element.Count; i++) {
+            for (int k = 0; k < (int)element.Properties.size(); k++) {
+                const PlyProperty& property = element.Properties[k];
+                size_t typeSize = Utils::TypeSize(property.Type);
+
+                if (!property.IsList) {
+                    if ((size_t)(end - p) < typeSize) Utils::Fail("unexpected end of file");
+                    if (e == vertexElement) {
+                        const std::string& name = property.Name;
+                        if (name == "x" || name == "y" || name == "z") {
+                            float value = Utils::ReadValue(p, property.Type, swap);
+                            if (!std::isfinite(value)) Utils::Fail("vertex position not finite");
+                            vertices[i][name[0] - 'x'] = value;
+                        }
+                    }
+                    p += typeSize;
+                    continue;
+                }
+
+                size_t countSize = Utils::TypeSize(property.CountType);
+                if ((size_t)(end - p) < countSize) Utils::Fail("unexpected end of file");
+                int64_t count = Utils::ReadInteger(p, property.CountType, swap);
+                p += countSize;
+                if (count < 0 || (size_t)count > (size_t)(end - p) / typeSize) Utils::Fail("unexpected end of file");
+
+                if (e == faceElement && k == pIndices) {
+                    fan.Count = 0;
+                    for (int64_t j = 0; j < count; j++)
+                        if (!fan.Add(Utils::ReadInteger(p + j * typeSize, property.Type, swap)))
+                            Utils::Fail("vertex index out of range");
+                }
+                p += count * typeSize;
+            }
+        }
+    }
+}
+
+
+void PlyLoader::Load(const std::string& path, std::vector<glm::vec3>& vertices, std::vector<uint32_t>& indices) {
+
+    MappedFile file(path);
+    PlyHeader header = Utils::ParseHeader(file.Data(), file.Size());
+
+    int vertexElement = -1, faceElement = -1;
+    for (size_t e = 0; e < header.Elements.size(); e++) {
+        if (header.Elements[e].Name == "vertex") vertexElement = e;
+        else if (header.Elements[e].Name == "face") faceElement = e;
+    }
+    if (vertexElement < 0) Utils::Fail("no vertex element");
+
+    //An instance takes a byte at least (binary) or a line (ASCII) : larger counts are checked
+    //before allocating for them
+    const char* body = file.Data() + header.DataOffset;
+    const char* end = file.Data() + file.Size();
+    for (const PlyElement& element : header.Elements)
+        if (!element.Properties.empty() && element.Count > (size_t)(end - body)) Utils::Fail("unexpected end of file");
+
+    vertices.assign(header.Elements[vertexElement].Count, glm::vec3(0.0f));
+    indices.clear();
+
+    if (header.Format == PlyFormat::Ascii)
+        LoadAscii(body, end, header, vertexElement, faceElement, vertices, indices);
+    else
+        LoadBinary(body, end, header, vertexElement, faceElement, vertices, indices);
+}
@@ -5,11 +5,13 @@
 #include "Walnut/Camera.h"
 #include "Walnut/Input.h"
 #include "font/forkawesome.h"
-#include "happly/happly.h"
 
 #include "raytracer/Renderer.h"
+#include "raytracer/RenderThread.h"
 #include "raytracer/Sphere.h"
 #include "raytracer/Triangle.h"
+#include "raytracer/Mesh.h"
+#include "raytracer/SceneLoader.h"
 
 #include <glm/gtc/type_ptr.hpp>
 
@@ -22,51 +24,15 @@ public:
 	ExampleLayer()
 		: m_Camera(45.0f, 0.1f, 100.0f) {
 
-		Material pinkSphere;
-		pinkSphere.Albedo = {1.0f, 0.0f, 1.0f};
-		pinkSphere.Roughness = 0.0f;
-		m_Scene.Materials.push_back(pinkSphere);
-		
-		Material blueSphere;
-		blueSphere.Albedo = {0.0f, 0.0f, 1.0f};
-		blueSphere.Roughness = .1f;
-		m_Scene.Materials.push_back(blueSphere);
-
-
-		Sphere* sphere = new Sphere();
-		sphere->Position = {.0f, .0f, .0f};
-		sphere->Radius = 1.0f;
-		sphere->MaterialIndex = 0;
-		m_Scene.Shapes.push_back(sphere);
-
-		Sphere* sphere2 = new Sphere();
-		sphere2->Position = {.0f, -201.0f, .0f};
-		sphere2->Radius = 200.0f;
-		sphere2->MaterialIndex = 1;
-		m_Scene.Shapes.push_back(sphere2);
-
-		happly::PLYData testPly("ply/bunny.ply");
-		std::vector<std::array<double, 3>> vertexPositions = testPly.getVertexPositions();
-		std::vector<std::vector<size_t>> faceIndices = testPly.getFaceIndices<size_t>();
-
-		for (const auto& face : faceIndices) {
-			
-			Vertex v0 { glm::vec3(vertexPositions[face[0]][0], vertexPositions[face[0]][1], vertexPositions[face[0]][2]), glm::vec3(0.0f) };
-			Vertex v1 { glm::vec3(vertexPositions[face[1]][0], vertexPositions[face[1]][1], vertexPositions[face[1]][2]), glm::vec3(0.0f) };
-			Vertex v2 { glm::vec3(vertexPositions[face[2]][0], vertexPositions[face[2]][1], vertexPositions[face[2]][2]), glm::vec3(0.0f) };
-			Triangle* triangle = new Triangle(v0, v1, v2);
-			m_Scene.Shapes.push_back(triangle);
-		}
-
-		printf("File read\n");
-		m_Scene.bvh.BuildBVH(m_Scene.Shapes);
-		printf("BVHTree built\n");
+		SceneLoader::LoadDefaultScene(m_Scene);
 
+		m_RenderThread.PostSettings(m_Settings);
+		m_RenderThread.PostScene(m_Scene);
 	}
 
 	virtual void OnUpdate(float ts) override {
 		if (m_Camera.OnUpdate(ts))
-			m_Renderer.ResetFrameIndex();
+			m_RenderThread.PostCamera(m_Camera);
 	}
 
 	virtual void OnUIRender() override
@@ -75,33 +41,127 @@ public:
 
 		ImGui::Begin(ICON_FK_COG "Settings");
 
-			ImGui::Text("Last Render %.3fms (%d FPS)", m_LastRenderTime, (1000/(1+(int)m_LastRenderTime)));
-
-			if (ImGui::Button("Render")) Render();
+			ImGui::Text("UI %.1f FPS", ImGui::GetIO().Framerate);
+			if (m_LastFrame)
+				ImGui::Text("Last Render %.3fms (%d FPS), %u samples", m_LastFrame->RenderTime, (1000/(1+(int)m_LastFrame->RenderTime)), m_LastFrame->SampleCount);
+			if (m_LastFrame)
+				ImGui::Text("%.2f rays per path, %u tiles converged, resolve %.3fms", m_LastFrame->FrameStats.AvgPathLength,
+					m_LastFrame->FrameStats.NbConvergedTile, m_LastFrame->FrameStats.ResolveMs);
+			if (m_LastFrame && m_LastFrame->FrameStats.Coverage < 1.0f)
+				ImGui::Text("Preview, %.0f%% of the pixels sampled", m_LastFrame->FrameStats.Coverage * 100.0f);
+
+			bool paused = m_RenderThread.IsPaused();
+			if (ImGui::Button(paused ? "Resume" : "Pause")) m_RenderThread.SetPaused(!paused);
 			ImGui::SameLine();
-			if (ImGui::Button("Reset")) m_Renderer.ResetFrameIndex();
+			if (ImGui::Button("Reset")) m_RenderThread.PostReset();
 
-			ImGui::Checkbox("Accumulate", &m_Renderer.GetSettings().Accumulate);
+			bool settingsEdited = ImGui::Checkbox("Accumulate", &m_Settings.Accumulate);
+			settingsEdited |= ImGui::Checkbox("Light sampling", &m_Settings.LightSampling);
+			settingsEdited |= ImGui::Checkbox("Anti-aliasing", &m_Settings.Jitter);
+
+			const char* traceModes[] = { "Pixel", "Packet", "Wavefront" };
+			int traceMode = (int)m_Settings.Mode;
+			if (ImGui::Combo("Trace mode", &traceMode, traceModes, IM_ARRAYSIZE(traceModes))) {
+				m_Settings.Mode = (Renderer::TraceMode)traceMode;
+				settingsEdited = true;
+			}
+
+			const char* samplers[] = { "PCG", "Sobol", "Blue noise" };
+			int sampler = (int)m_Settings.Sampling;
+			if (ImGui::Combo("Sampler", &sampler, samplers, IM_ARRAYSIZE(samplers))) {
+				m_Settings.Sampling = (SamplerType)sampler;
+				settingsEdited = true;
+			}
+
+			const char* tonemaps[] = { "Clamp", "Reinhard", "ACES" };
+			int tonemap = (int)m_Settings.Tonemapping;
+			if (ImGui::Combo("Tonemap", &tonemap, tonemaps, IM_ARRAYSIZE(tonemaps))) {
+				m_Settings.Tonemapping = (Tonemap)tonemap;
+				settingsEdited = true;
+			}
+			settingsEdited |= ImGui::Checkbox("sRGB", &m_Settings.SRGB);
+
+			const char* accumulationFormats[] = { "RGB32F (12 B)", "RGB16F (8 B)", "RGB9E5 (4 B)" };
+			int accumulationFormat = (int)m_Settings.Accumulation;
+			if (ImGui::Combo("Accumulation", &accumulationFormat, accumulationFormats, IM_ARRAYSIZE(accumulationFormats))) {
+				m_Settings.Accumulation = (AccumulationFormat)accumulationFormat;
+				settingsEdited = true;
+			}
+
+			int tileSize = (int)m_Settings.TileSize;
+			if (ImGui::SliderInt("Tile size", &tileSize, 8, 128)) {
+				m_Settings.TileSize = (uint32_t)tileSize;
+				settingsEdited = true;
+			}
+
+			int maxDepth = (int)m_Settings.MaxDepth;
+			if (ImGui::SliderInt("Max depth", &maxDepth, 1, 32)) {
+				m_Settings.MaxDepth = (uint32_t)maxDepth;
+				settingsEdited = true;
+			}
+
+			int rouletteDepth = (int)m_Settings.RouletteDepth;
+			if (ImGui::SliderInt("Roulette depth", &rouletteDepth, 1, 32)) {
+				m_Settings.RouletteDepth = (uint32_t)rouletteDepth;
+				settingsEdited = true;
+			}
+
+			settingsEdited |= ImGui::SliderFloat("Preview budget (ms)", &m_Settings.PreviewBudgetMs, 0.0f, 100.0f, "%.0f");
+
+			settingsEdited |= ImGui::Checkbox("Adaptive sampling", &m_Settings.Adaptive);
+			settingsEdited |= ImGui::SliderFloat("Threshold", &m_Settings.AdaptiveThreshold, .001f, .1f, "%.3f", ImGuiSliderFlags_Logarithmic);
+			int maxSamples = (int)m_Settings.AdaptiveMaxSamples;
+			if (ImGui::SliderInt("Max tile samples", &maxSamples, 1, 16)) {
+				m_Settings.AdaptiveMaxSamples = (uint32_t)maxSamples;
+				settingsEdited = true;
+			}
+
+			if (settingsEdited) m_RenderThread.PostSettings(m_Settings);
+
+			//Load balance of the tiles
+			if (m_LastFrame && m_Settings.Mode != Renderer::TraceMode::Wavefront && m_LastFrame->TileStats.NbTile > 0) {
+				const Renderer::TileStats& tileStats = m_LastFrame->TileStats;
+				const std::vector<float>& tileTimes = m_LastFrame->TileTimes;
+				ImGui::Text("%u tiles : %.3f / %.3f / %.3f ms (min/avg/max)", tileStats.NbTile, tileStats.MinMs, tileStats.AvgMs, tileStats.MaxMs);
+				ImGui::PlotHistogram("Tile times", tileTimes.data(), (int)tileTimes.size(), 0, nullptr, 0.0f, tileStats.MaxMs, ImVec2(0, 60));
+			}
 			
 
 		ImGui::End();
 
 		//Tabs
-        if (ObjectTabRender()) {
-			m_Renderer.ResetFrameIndex();
-			m_Scene.bvh.BuildBVH(m_Scene.Shapes); //TODO : fix
+		//One shape edited (sliders) only posts that shape, the whole scene is posted when
+		//shapes were added or removed
+		int editedShape = -1;
+		size_t nbShape = m_Scene.Shapes.size();
+        if (ObjectTabRender(editedShape)) {
+			if (editedShape >= 0 && m_Scene.Shapes.size() == nbShape) {
+				m_Scene.bvh.Refit(m_Scene.Shapes, editedShape);
+				m_RenderThread.PostShape(editedShape, *m_Scene.Shapes[editedShape]);
+			} else {
+				m_Scene.bvh.BuildBVH(m_Scene.Shapes);
+				m_RenderThread.PostScene(m_Scene);
+			}
 		}
-		if (MaterialTabRender()) m_Renderer.ResetFrameIndex();
+		if (MaterialTabRender()) m_RenderThread.PostMaterials(m_Scene.Materials);
 
 		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(.0f, .0f));
 		ImGui::Begin(ICON_FK_PICTURE_O " Viewport");
 
-			m_ViewportWidth = ImGui::GetContentRegionAvail().x;
-			m_ViewportHeight = ImGui::GetContentRegionAvail().y;
+			uint32_t viewportWidth = ImGui::GetContentRegionAvail().x;
+			uint32_t viewportHeight = ImGui::GetContentRegionAvail().y;
+			if (viewportWidth != m_ViewportWidth || viewportHeight != m_ViewportHeight) {
+				m_ViewportWidth = viewportWidth;
+				m_ViewportHeight = viewportHeight;
+				m_Camera.OnResize(m_ViewportWidth, m_ViewportHeight);
+				m_RenderThread.PostResize(m_ViewportWidth, m_ViewportHeight);
+				m_RenderThread.PostCamera(m_Camera);
+			}
+
+			UploadFrame();
 
 			//Render image
-			auto image = m_Renderer.GetFinalImage();
-			if (image) ImGui::Image((ImTextureID)image->GetDescriptorSet(), {(float)image->GetWidth(), (float)image->GetHeight()}, ImVec2(0,1), ImVec2(1,0));
+			if (m_Image) ImGui::Image((ImTextureID)m_Image->GetDescriptorSet(), {(float)m_Image->GetWidth(), (float)m_Image->GetHeight()}, ImVec2(0,1), ImVec2(1,0));
 
 			//Camera control
 			if (ImGui::IsMouseClicked(0) && !ImGui::IsMouseDragging(0) && ImGui::IsWindowHovered()) 
@@ -113,30 +173,47 @@ public:
 	
 		ImGui::End();
 		ImGui::PopStyleVar();
-
-		Render();
 	}
 
-	void Render() {
-
-		Timer timer;
-
-		//resize
-		m_Renderer.OnResize(m_ViewportWidth, m_ViewportHeight);
-		m_Camera.OnResize(m_ViewportWidth, m_ViewportHeight);
-		m_Renderer.Render(m_Scene, m_Camera);
-
-		m_LastRenderTime = timer.ElapsedMillis();
+	// Uploads the last frame finished by the render thread, if there is a new one
+	void UploadFrame() {
+
+		const RenderFrame* frame = m_RenderThread.AcquireFrame();
+		if (!frame) return;
+
+		//The tiles that changed are enough when the image holds the previous frame
+		bool partial = m_Image && m_LastFrame && frame->Index == m_LastFrameIndex + 1
+			&& m_Image->GetWidth() == frame->Width && m_Image->GetHeight() == frame->Height;
+
+		if (!m_Image)
+			m_Image = std::make_shared<Walnut::Image>(frame->Width, frame->Height, Walnut::ImageFormat::RGBA);
+		else if (m_Image->GetWidth() != frame->Width || m_Image->GetHeight() != frame->Height)
+			m_Image->Resize(frame->Width, frame->Height);
+
+		if (partial) {
+			m_UploadRegions.clear();
+			for (const Renderer::Region& region : frame->Regions)
+				m_UploadRegions.push_back({region.x, region.y, region.width, region.height});
+			m_Image->SetData(frame->Pixels.data(), m_UploadRegions);
+		} else
+			m_Image->SetData(frame->Pixels.data());
+		m_LastFrame = frame;
+		m_LastFrameIndex = frame->Index;
 	}
 
 private:       
                 
-	bool ObjectTabRender() {
+	// editedShape is set to the index of the edited shape, or -1 when several were edited
+	bool ObjectTabRender(int& editedShape) {
 		ImGui::Begin(ICON_FK_CUBES " Scene");
 
 		bool edited = false;
-		for (size_t i = 0; i < m_Scene.Shapes.size(); i++) 
-			edited |= m_Scene.Shapes[i]->RenderUiSettings(i, m_Scene);
+		for (size_t i = 0; i < m_Scene.Shapes.size(); i++) {
+			if (m_Scene.Shapes[i]->RenderUiSettings(i, m_Scene)) {
+				editedShape = edited ? -1 : i;
+				edited = true;
+			}
+		}
 		
 		
 		ImGui::Separator();
@@ -159,6 +236,7 @@ private:
 				case 1: shape = new Sphere(); break;
 			}
 			m_Scene.Shapes.push_back(shape);
+			editedShape = -1;
 			edited = true;
 		}
 	
@@ -185,12 +263,16 @@ private:
 		return edited;
 	}
 
-	Renderer m_Renderer;
 	Camera m_Camera;
 	Scene m_Scene;
+	Renderer::Settings m_Settings;
 	uint32_t m_ViewportWidth = 0, m_ViewportHeight = 0;
 
-	float m_LastRenderTime = .0f;
+	RenderThread m_RenderThread;
+	std::shared_ptr<Walnut::Image> m_Image;
+	const RenderFrame* m_LastFrame = nullptr; // Valid until the next frame is acquired
+	uint32_t m_LastFrameIndex = 0;            // Its index, read once the next one is acquired
+	std::vector<Walnut::ImageRegion> m_UploadRegions;
 };
 
 Walnut::Application* Walnut::CreateApplication(int argc, char** argv) {
@@ -0,0 +1,225 @@
+#include "raytracer/RenderThread.h"
+#include "Walnut/Timer.h"
+
+#include <algorithm>
+
+
+RenderThread::RenderThread() {
+    m_Thread = std::thread(&RenderThread::Run, this);
+}
+
+RenderThread::~RenderThread() {
+    {
+        std::lock_guard<std::mutex> lock(m_CommandMutex);
+        m_Stop = true;
+    }
+    m_Version++; //Cancels the frame in flight
+    m_CommandPosted.notify_one();
+    m_Thread.join();
+}
+
+
+void RenderThread::PostScene(const Scene& scene) {
+
+    std::unique_ptr<Scene> copy = std::make_unique<Scene>(scene);
+    {
+        std::lock_guard<std::mutex> lock(m_CommandMutex);
+        m_Command.NewScene = std::move(copy);
+        m_Command.NewShapes.clear();
+        m_Command.NewMaterials.reset();
+        m_Command.Pending = true;
+        m_Version++;
+    }
+    m_CommandPosted.notify_one();
+}
+
+void RenderThread::PostShape(uint32_t index, const Shape& shape) {
+
+    std::unique_ptr<Shape> copy(shape.Clone());
+    {
+        std::lock_guard<std::mutex> lock(m_CommandMutex);
+        m_Command.NewShapes.emplace_back(index, std::move(copy));
+        m_Command.Pending = true;
+        m_Version++;
+    }
+    m_CommandPosted.notify_one();
+}
+
+void RenderThread::PostMaterials(const std::vector<Material>& materials) {
+
+    std::unique_ptr<std::vector<Material>> copy = std::make_unique<std::vector<Material>>(materials);
+    {
+        std::lock_guard<std::mutex> lock(m_CommandMutex);
+        m_Command.NewMaterials = std::move(copy);
+        m_Command.Pending = true;
+        m_Version++;
+    }
+    m_CommandPosted.notify_one();
+}
+
+void RenderThread::PostCamera(const Camera& camera) {
+
+    std::unique_ptr<Camera> copy = std::make_unique<Camera>(camera);
+    {
+        std::lock_guard<std::mutex> lock(m_CommandMutex);
+        m_Command.NewCamera = std::move(copy);
+        m_Command.Pending = true;
+        m_Version++;
+    }
+    m_CommandPosted.notify_one();
+}
+
+void RenderThread::PostSettings(const Renderer::Settings& settings) {
+    {
+        std::lock_guard<std::mutex> lock(m_CommandMutex);
+        m_Command.NewSettings = std::make_unique<Renderer::Settings>(settings);
+        m_Command.Pending = true;
+        m_Version++;
+    }
+    m_CommandPosted.notify_one();
+}
+
+void RenderThread::PostResize(uint32_t width, uint32_t height) {
+    {
+        std::lock_guard<std::mutex> lock(m_CommandMutex);
+        m_Command.Width = width;
+        m_Command.Height = height;
+        m_Command.Resize = true;
+        m_Command.Pending = true;
+        m_Version++;
+    }
+    m_CommandPosted.notify_one();
+}
+
+void RenderThread::PostReset() {
+    {
+        std::lock_guard<std::mutex> lock(m_CommandMutex);
+        m_Command.Pending = true;
+        m_Version++;
+    }
+    m_CommandPosted.notify_one();
+}
+
+void RenderThread::SetPaused(bool paused) {
+    {
+        std::lock_guard<std::mutex> lock(m_CommandMutex);
+        m_Paused = paused;
+    }
+    m_CommandPosted.notify_one();
+}
+
+
+const RenderFrame* RenderThread::AcquireFrame() {
+
+    if (!(m_SharedFrame.load(std::memory_order_acquire) & NEW_FRAME_BIT)) return nullptr;
+
+    m_FrontFrame = m_SharedFrame.exchange(m_FrontFrame, std::memory_order_acq_rel) & ~NEW_FRAME_BIT;
+    return &m_Frames[m_FrontFrame];
+}
+
+
+bool RenderThread::CanRender() const {
+
+    //The camera must match the image, a resize can be picked before the camera that goes with it.
+    //A converged image waits for the next command
+    return m_Scene && m_Camera && m_Renderer.GetWidth() > 0
+        && m_Camera->GetViewportWidth() == m_Renderer.GetWidth() && m_Camera->GetViewportHeight() == m_Renderer.GetHeight()
+        && !m_Renderer.IsConverged();
+}
+
+
+void RenderThread::Run() {
+
+    while (true) {
+
+        uint32_t version;
+        Command command;
+        {
+            std::unique_lock<std::mutex> lock(m_CommandMutex);
+            m_CommandPosted.wait(lock, [this] { return m_Stop || m_Command.Pending || (!m_Paused && CanRender()); });
+            if (m_Stop) return;
+
+            command = std::move(m_Command);
+            m_Command = Command();
+            version = m_Version;
+        }
+
+        //Applied outside the lock, the refits must not hold the UI
+        if (command.Pending) Apply(command);
+        if (m_Paused || !CanRender()) continue;
+
+        Walnut::Timer timer;
+        bool finished = m_Renderer.Render(*m_Scene, *m_Camera, [this, version] {
+            return m_Version.load(std::memory_order_relaxed) != version;
+        });
+
+        if (finished) Publish(version, timer.ElapsedMillis());
+    }
+}
+
+
+void RenderThread::Apply(Command& command) {
+
+    if (command.NewScene) m_Scene = std::move(command.NewScene);
+    if (m_Scene) {
+        for (auto& [index, shape] : command.NewShapes) {
+            if (index >= m_Scene->Shapes.size()) continue;
+            delete m_Scene->Shapes[index];
+            m_Scene->Shapes[index] = shape.release();
+            m_Scene->bvh.Refit(m_Scene->Shapes, index);
+        }
+        if (command.NewMaterials) m_Scene->Materials = std::move(*command.NewMaterials);
+    }
+    if (command.NewCamera) m_Camera = std::move(command.NewCamera);
+    if (command.NewSettings) m_Renderer.GetSettings() = *command.NewSettings;
+    if (command.Resize) m_Renderer.OnResize(command.Width, command.Height);
+    m_Renderer.ResetFrameIndex();
+}
+
+
+void RenderThread::Publish(uint32_t version, float renderTime) {
+
+    RenderFrame& frame = m_Frames[m_BackFrame];
+    uint32_t width = m_Renderer.GetWidth(), height = m_Renderer.GetHeight();
+    const uint32_t* image = m_Renderer.GetImageData();
+    const std::vector<Renderer::Region>& regions = m_Renderer.GetResolvedRegions();
+
+    //The frame only gets the pixels it misses : the regions resolved since it was last published
+    if (frame.Width != width || frame.Height != height) {
+        for (uint64_t& stalePixels : m_StalePixels) stalePixels = (uint64_t)width * height; //Resized, copied whole
+        frame.Width = width;
+        frame.Height = height;
+    }
+
+    std::vector<Renderer::Region>& stale = m_StaleRegions[m_BackFrame];
+    if (m_StalePixels[m_BackFrame] >= (uint64_t)width * height) {
+        frame.Pixels.assign(image, image + width * height);
+    } else {
+        stale.insert(stale.end(), regions.begin(), regions.end());
+        for (const Renderer::Region& region : stale)
+            for (uint32_t y = region.y; y < region.y + region.height; y++)
+                std::copy_n(image + region.x + y * width, region.width, frame.Pixels.data() + region.x + y * width);
+    }
+    stale.clear();
+    m_StalePixels[m_BackFrame] = 0;
+
+    //Past the size of the image, the other frames are copied whole
+    for (uint32_t i = 0; i < 3; i++) {
+        if (i == m_BackFrame || m_StalePixels[i] >= (uint64_t)width * height) continue;
+        for (const Renderer::Region& region : regions) {
+            m_StaleRegions[i].push_back(region);
+            m_StalePixels[i] += (uint64_t)region.width * region.height;
+        }
+    }
+
+    frame.Index = m_NbPublished++;
+    frame.Regions = regions;
+    frame.Version = version;
+    frame.SampleCount = m_Renderer.GetSettings().Accumulate ? m_Renderer.GetFrameIndex() - 1 : 1;
+    frame.RenderTime = renderTime;
+    frame.TileStats = m_Renderer.GetTileStats();
+    frame.FrameStats = m_Renderer.GetFrameStats();
+    frame.TileTimes = m_Renderer.GetTileTimes();
+
+    m_BackFrame = m_SharedFrame.exchange(m_BackFrame | NEW_FRAME_BIT, std::memory_order_acq_rel) & ~NEW_FRAME_BIT;
+}
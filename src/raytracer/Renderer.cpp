@@ -1,97 +1,535 @@
 #include "raytracer/Renderer.h"
+#include "raytracer/RayPacket.h"
+#include "raytracer/CameraRays.h"
 #include "Walnut/Random.h"
+#include "Walnut/Timer.h"
 
-#include <execution>
 #include <cstring>
+#include <cfloat>
+#include <cmath>
 #include <algorithm>
+#include <atomic>
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
+#include <tbb/blocked_range.h>
+#include <tbb/partitioner.h>
+
+#define SHADE_CHUNK 1024 // Rays compacted together in the shade stage
+#define PI 3.14159265f
+#define CAMERA_DIMENSIONS 2 // Sampler dimensions of the camera ray (jitter), the bounces follow
+#define BOUNCE_DIMENSIONS 6 // Sampler dimensions of a bounce : light (1 + 2), direction (2), roulette (1)
 
 namespace Utils {
 
-    static uint32_t ConvertToRGBA(const glm::vec4& color) {
+    static float Luminance(const glm::vec3& color) {
+        return glm::dot(color, glm::vec3(.2126f, .7152f, .0722f));
+    }
+
+    // Direction around n of pdf cos / pi
+    static glm::vec3 CosineHemisphere(const glm::vec3& n, glm::vec2 u) {
 
-        uint8_t r = (uint8_t)(color.r * 255.0f);
-        uint8_t g = (uint8_t)(color.g * 255.0f);
-        uint8_t b = (uint8_t)(color.b * 255.0f);
-        uint8_t a = (uint8_t)(color.a * 255.0f);
+        //Orthonormal basis of n (Duff et al. 2017)
+        float sign = std::copysign(1.0f, n.z);
+        float a = -1.0f / (sign + n.z);
+        float b = n.x * n.y * a;
+        glm::vec3 t(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+        glm::vec3 bt(b, sign + n.y * n.y * a, -n.y);
 
-        return (a << 24) | (b << 16) | (g << 8) | r;
+        float r = glm::sqrt(u.x), phi = 2.0f * PI * u.y;
+        return t * (r * glm::cos(phi)) + bt * (r * glm::sin(phi)) + n * glm::sqrt(glm::max(1.0f - u.x, 0.0f));
     }
 
-    static uint32_t PCG_Hash(uint32_t input) {
-        uint32_t state = input  * 747796405u + 2891336453u;
-        uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
-        return (word >> 22u) ^ word;
+    // Multiple importance sampling weight of a strategy of pdf a against one of pdf b
+    static float PowerHeuristic(float a, float b) {
+        return a*a / (a*a + b*b);
     }
 
-    static float RandomFastFloat(uint32_t& seed) {
-        seed = PCG_Hash(seed);
-        return seed/(float)UINT32_MAX;
+    // Spreads the 9 low bits of x every 3 bits
+    static uint32_t ExpandBits(uint32_t x) {
+        x &= 0x1ff;
+        x = (x | (x << 16)) & 0x030000ff;
+        x = (x | (x <<  8)) & 0x0300f00f;
+        x = (x | (x <<  4)) & 0x030c30c3;
+        x = (x | (x <<  2)) & 0x09249249;
+        return x;
     }
 
-    static glm::vec3 InUnitSphere(uint32_t& seed) {
-        return glm::normalize(glm::vec3(
-            RandomFastFloat(seed)*2.0f -1.0f,
-            RandomFastFloat(seed)*2.0f -1.0f,
-            RandomFastFloat(seed)*2.0f -1.0f)
-        );
+    // Distance of (x, y) along the Hilbert curve filling a n*n grid (n power of 2)
+    static uint32_t HilbertIndex(uint32_t n, uint32_t x, uint32_t y) {
+        uint32_t d = 0;
+        for (uint32_t s = n / 2; s > 0; s /= 2) {
+            uint32_t rx = (x & s) > 0;
+            uint32_t ry = (y & s) > 0;
+            d += s * s * ((3 * rx) ^ ry);
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = n - 1 - x;
+                    y = n - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return d;
     }
 }
 
 void Renderer::OnResize(u_int32_t width, uint32_t height) {
 
-    if (m_FinalImage) {
-
-        if (m_FinalImage->GetWidth() == width && m_FinalImage->GetHeight() == height)
-            return;
+    if (m_Width == width && m_Height == height)
+        return;
 
-        m_FinalImage->Resize(width, height);
-        ResetFrameIndex();
-
-    } else {
-        m_FinalImage = std::make_shared<Walnut::Image>(width, height, Walnut::ImageFormat::RGBA);
-    }
+    m_Width = width;
+    m_Height = height;
+    ResetFrameIndex();
 
     delete[] m_ImageData;
     m_ImageData = new uint32_t[width *  height];
 
     delete[] m_AccumulationData;
-    m_AccumulationData = new glm::vec4[width *  height];
+    m_AccumulationData = nullptr;
+    UpdateAccumulation();
+
+    delete[] m_SquaredLuminance;
+    m_SquaredLuminance = new float[width *  height];
+
+    m_TileSize = 0;
+    UpdateTiles();
+
+    m_RayQueues[0].Resize(width * height);
+    m_RayQueues[1].Resize(width * height);
+    m_HitDistance.resize(width * height);
+    m_HitShape.resize(width * height);
+    m_HitPrimitive.resize(width * height);
+    m_HitBarycentric.resize(width * height);
+    m_BounceLights.resize(width * height);
+    m_SortKeys.resize(width * height);
+    m_Radiance.resize(width * height);
+}
+
+
+void Renderer::UpdateTiles() {
+
+    uint32_t tileSize = glm::max(m_Settings.TileSize, (uint32_t)PACKET_WIDTH);
+    tileSize = (tileSize + PACKET_WIDTH - 1) / PACKET_WIDTH * PACKET_WIDTH;
+    if (tileSize == m_TileSize) return;
+    m_TileSize = tileSize;
+
+    uint32_t width = m_Width, height = m_Height;
+    uint32_t nbTileX = (width + tileSize - 1) / tileSize;
+    uint32_t nbTileY = (height + tileSize - 1) / tileSize;
+
+    uint32_t n = 1;
+    while (n < nbTileX || n < nbTileY) n *= 2;
 
-    m_ImageHorizontalIterator.resize(width);
-    m_ImageVerticalIterator.resize(height);
-    for(uint32_t i = 0; i < width; i++) m_ImageHorizontalIterator[i] = i;
-    for(uint32_t i = 0; i < height; i++) m_ImageVerticalIterator[i] = i;
+    std::vector<std::pair<uint32_t, Tile>> tiles;
+    tiles.reserve(nbTileX * nbTileY);
+    for (uint32_t ty = 0; ty < nbTileY; ty++)
+        for (uint32_t tx = 0; tx < nbTileX; tx++)
+            tiles.push_back({Utils::HilbertIndex(n, tx, ty), {tx * tileSize, ty * tileSize}});
+
+    std::sort(tiles.begin(), tiles.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    m_Tiles.resize(tiles.size());
+    m_TileGrid.resize(tiles.size());
+    m_NbTileX = nbTileX;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        m_Tiles[i] = tiles[i].second;
+        m_TileGrid[m_Tiles[i].x / tileSize + m_Tiles[i].y / tileSize * nbTileX] = (uint32_t)i;
+    }
+    m_TileTimes.assign(m_Tiles.size(), 0.0f);
+
+    //The sample counts were the ones of the previous tiles
+    ResetFrameIndex();
 }
 
-void Renderer::Render(const Scene& scene, const Camera& camera) {
+bool Renderer::Render(const Scene& scene, const Camera& camera, const CancelCallback& cancelled) {
 
     m_ActiveScene = &scene;
     m_ActiveCamera = &camera;
+    m_Cancelled = cancelled;
+    UpdateLights();
+
+    if (m_Width == 0 || m_Height == 0) return false;
+
+    Walnut::Timer frameTimer;
+    UpdateTiles();
+    UpdateAccumulation();
+    UpdatePreview();
+
+    //A first sample in preview passes is only cleared before its first pass
+    if(m_FrameIndex == 1 && m_PreviewPass == 0) {
+        memset(m_AccumulationData, 0, (size_t)m_Width * m_Height * AccumulationUtils::PixelSize(m_AccumulationFormat));
+        memset(m_SquaredLuminance, 0, m_Width * m_Height * sizeof(float));
+        for (Tile& tile : m_Tiles) {
+            tile.Converged = false;
+            tile.NbSample = 0;
+            tile.NbPass = 1;
+        }
+    }
 
-    if(m_FrameIndex == 1) 
-        memset(m_AccumulationData, 0, m_FinalImage->GetWidth() * m_FinalImage->GetHeight() * sizeof(glm::vec4));
-
-    std::for_each(std::execution::par, m_ImageVerticalIterator.begin(), m_ImageVerticalIterator.end(), [this](uint32_t y) {
-        std::for_each(std::execution::par, m_ImageHorizontalIterator.begin(), m_ImageHorizontalIterator.end(), [this, y](uint32_t x) {
+    //Pixels of the tiles still rendered, or of the preview passes (no tile has converged then)
+    uint64_t nbPixel = 0;
+    if (IsPreview()) {
+        uint32_t step = 1 << m_PreviewLevel;
+        for (uint32_t pass = m_PreviewPass; pass < m_PreviewPassEnd; pass++) {
+            glm::uvec2 offset = PreviewOffset(pass);
+            nbPixel += (uint64_t)((m_Width - offset.x + step - 1) / step) * ((m_Height - offset.y + step - 1) / step);
+        }
+    } else {
+        for (const Tile& tile : m_Tiles)
+            if (!tile.Converged) nbPixel += (uint64_t)(glm::min(tile.x + m_TileSize, m_Width) - tile.x) * (glm::min(tile.y + m_TileSize, m_Height) - tile.y) * tile.NbPass;
+    }
+    m_PathSegments = 0;
 
-            glm::vec4 color = PerPixel(x,y);
-            m_AccumulationData[x + y*m_FinalImage->GetWidth()] += color;
+    //Preview passes are traced per pixel in every mode, their pixels are strided
+    if (m_Settings.Mode == TraceMode::Wavefront && !IsPreview()) {
 
-            glm::vec4 accumulateColor = m_AccumulationData[x + y*m_FinalImage->GetWidth()] / (float)m_FrameIndex;
+        m_Arena.execute([this] { RenderWavefront(); });
+        if (IsCancelled()) return false;
 
-            accumulateColor = glm::clamp(accumulateColor, glm::vec4(0.0f),glm::vec4(1.0f));
-            m_ImageData[x + y*m_FinalImage->GetWidth()] =  Utils::ConvertToRGBA(accumulateColor); 
+    } else {
 
+        //One task per tile : idle workers steal the remaining halves of the curve, so they
+        //keep working on neighbouring tiles
+        m_Arena.execute([this] {
+            tbb::parallel_for(tbb::blocked_range<uint32_t>(0, (uint32_t)m_Tiles.size(), 1), [this](const tbb::blocked_range<uint32_t>& r) {
+                for (uint32_t t = r.begin(); t < r.end(); t++) RenderTile(t);
+            }, tbb::simple_partitioner());
         });
-    });
+        if (IsCancelled()) return false;
+
+        //Converged tiles were skipped, they are left out
+        m_TileStats.NbTile = (uint32_t)m_TileTimes.size();
+        m_TileStats.MinMs = FLT_MAX;
+        m_TileStats.MaxMs = m_TileStats.AvgMs = 0.0f;
+        uint32_t nbRendered = 0;
+        for (uint32_t t = 0; t < m_Tiles.size(); t++) {
+            if (m_TileTimes[t] < 0.0f) continue;
+            m_TileStats.MinMs = glm::min(m_TileStats.MinMs, m_TileTimes[t]);
+            m_TileStats.MaxMs = glm::max(m_TileStats.MaxMs, m_TileTimes[t]);
+            m_TileStats.AvgMs += m_TileTimes[t];
+            nbRendered++;
+        }
+        if (nbRendered > 0) m_TileStats.AvgMs /= nbRendered;
+        else m_TileStats.MinMs = 0.0f;
+    }
 
-    m_FinalImage->SetData(m_ImageData);
+    Walnut::Timer resolveTimer;
+    m_Arena.execute([this] { Resolve(); });
+    m_FrameStats.ResolveMs = resolveTimer.ElapsedMillis();
+
+    m_NbConvergedTile = 0;
+    for (const Tile& tile : m_Tiles) m_NbConvergedTile += tile.Converged;
+
+    m_FrameStats.AvgPathLength = nbPixel > 0 ? (float)((double)m_PathSegments / nbPixel) : 0.0f;
+    m_FrameStats.NbConvergedTile = m_NbConvergedTile;
+    if (nbPixel > 0) m_PixelCostMs = frameTimer.ElapsedMillis() / nbPixel;
+
+    //The sample is complete once every pass is done
+    m_FrameStats.Coverage = 1.0f;
+    if (IsPreview()) {
+        uint32_t nbPass = 1 << (2*m_PreviewLevel);
+        m_PreviewPass = m_PreviewPassEnd;
+        m_FrameStats.Coverage = (float)m_PreviewPass / nbPass;
+        if (m_PreviewPass < nbPass) return true;
+        for (Tile& tile : m_Tiles) tile.NbSample = 1;
+    }
 
     if (m_Settings.Accumulate)
         m_FrameIndex++;
     else
         m_FrameIndex = 1;
 
+    return true;
+}
+
+
+void Renderer::UpdateLights() {
+
+    m_Lights.clear();
+    if (!m_Settings.LightSampling) return;
+
+    for (const Shape* shape : m_ActiveScene->Shapes)
+        if (m_ActiveScene->Materials[shape->MaterialIndex].EmmissionPower > 0.0f) m_Lights.push_back(shape);
+}
+
+
+void Renderer::UpdatePreview() {
+
+    m_PreviewPassEnd = 0;
+    if (!m_Settings.Accumulate || m_FrameIndex != 1 || m_Settings.PreviewBudgetMs <= 0.0f) {
+        //A first sample left in preview passes restarts, its pixels would get a second sample
+        //from a full frame otherwise
+        if (m_FrameIndex == 1) m_PreviewPass = 0;
+        return;
+    }
+
+    //The level is chosen as the first sample starts : the coarsest one needed for a pass to
+    //fit in the budget, at the cost of the last frame
+    float frameCost = m_PixelCostMs * m_Width * m_Height;
+    if (m_PreviewPass == 0) {
+        m_PreviewLevel = 0;
+        while (m_PreviewLevel < MAX_PREVIEW_LEVEL && frameCost / (1 << (2*m_PreviewLevel)) > m_Settings.PreviewBudgetMs)
+            m_PreviewLevel++;
+        if (m_PreviewLevel == 0) return;
+
+        uint32_t step = 1 << m_PreviewLevel;
+        m_PreviewOrder.resize(step * step);
+        for (uint32_t pass = 0; pass < step * step; pass++) {
+            glm::uvec2 offset = PreviewOffset(pass);
+            m_PreviewOrder[offset.x + offset.y * step] = pass;
+        }
+    }
+    if (m_PreviewLevel == 0) return;
+
+    uint32_t nbPass = 1 << (2*m_PreviewLevel);
+    uint32_t passes = frameCost > 0.0f ? (uint32_t)(m_Settings.PreviewBudgetMs / (frameCost / nbPass)) : nbPass;
+    m_PreviewPassEnd = glm::min(m_PreviewPass + glm::max(passes, 1u), nbPass);
+}
+
+
+glm::uvec2 Renderer::PreviewOffset(uint32_t pass) const {
+
+    //Each base 4 digit of the pass, from the lowest, picks a quadrant of the finer grid : the
+    //first 4^k passes cover the grid of step 2^(level - k)
+    const glm::uvec2 quadrants[4] = {{0, 0}, {1, 1}, {1, 0}, {0, 1}};
+    glm::uvec2 offset(0);
+    for (uint32_t level = 0; level < m_PreviewLevel; level++, pass >>= 2)
+        offset += quadrants[pass & 3] * (1u << (m_PreviewLevel - 1 - level));
+    return offset;
+}
+
+
+void Renderer::UpdateAccumulation() {
+
+    if (m_AccumulationData && m_AccumulationFormat == m_Settings.Accumulation) return;
+
+    m_AccumulationFormat = m_Settings.Accumulation;
+    delete[] m_AccumulationData;
+    //Padded for the resolve, which loads 4 floats per pixel
+    m_AccumulationData = new uint8_t[(size_t)m_Width * m_Height * AccumulationUtils::PixelSize(m_AccumulationFormat) + 16];
+    ResetFrameIndex();
+}
+
+
+void Renderer::AccumulatePixel(uint32_t x, uint32_t y, const glm::vec3& color) {
+
+    uint32_t pixel = x + y*m_Width;
+    uint32_t sampleCount = SampleIndex(x, y) + 1;
+    uint32_t random = m_AccumulationFormat == AccumulationFormat::RGB32F ? 0 : SamplerUtils::Hash(pixel, sampleCount, 0xacc);
+    AccumulationUtils::Accumulate(m_AccumulationFormat, m_AccumulationData + (size_t)pixel * AccumulationUtils::PixelSize(m_AccumulationFormat),
+        color, sampleCount, random);
+
+    float luminance = Utils::Luminance(color);
+    m_SquaredLuminance[pixel] += luminance * luminance;
+}
+
+
+void Renderer::Resolve() {
+
+    m_ResolvedTiles.clear();
+    m_ResolvedRegions.clear();
+    for (uint32_t t = 0; t < m_Tiles.size(); t++) {
+        const Tile& tile = m_Tiles[t];
+        if (!tile.Dirty) continue;
+        m_ResolvedTiles.push_back(t);
+        m_ResolvedRegions.push_back({tile.x, tile.y, glm::min(m_TileSize, m_Width - tile.x), glm::min(m_TileSize, m_Height - tile.y)});
+    }
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, m_ResolvedTiles.size()), [this](const tbb::blocked_range<size_t>& r) {
+        for (size_t i = r.begin(); i < r.end(); i++) ResolveTile(m_ResolvedTiles[i]);
+    });
+}
+
+
+void Renderer::ResolveTile(uint32_t tileIndex) {
+
+    Tile& tile = m_Tiles[tileIndex];
+    tile.Dirty = false;
+
+    uint32_t xEnd = glm::min(tile.x + m_TileSize, m_Width);
+    uint32_t yEnd = glm::min(tile.y + m_TileSize, m_Height);
+
+    //The pixels of a tile have its samples (the first one may still be in preview passes).
+    //Sums are resolved in place, the means of the compact formats are decoded first
+    uint32_t pixelSize = AccumulationUtils::PixelSize(m_AccumulationFormat);
+    bool sums = m_AccumulationFormat == AccumulationFormat::RGB32F;
+    float scale = sums ? 1.0f / glm::max(tile.NbSample, 1u) : 1.0f;
+    glm::vec4 means[64] = {};
+
+    for (uint32_t y = tile.y; y < yEnd; y++) {
+        for (uint32_t x = tile.x; x < xEnd; x += 64) {
+            const uint8_t* in = m_AccumulationData + (size_t)(x + y*m_Width) * pixelSize;
+            uint32_t* out = m_ImageData + x + y*m_Width;
+            uint32_t count = glm::min(xEnd - x, 64u);
+
+            if (sums) {
+                ResolveRow<3>((const float*)in, out, count, scale);
+            } else {
+                AccumulationUtils::DecodeMeans(m_AccumulationFormat, in, &means[0][0], count);
+                ResolveRow<4>(&means[0][0], out, count, scale);
+            }
+        }
+    }
+
+    //Pixels without their first sample yet repeat the one of the finest complete grid
+    uint32_t step = 1 << m_PreviewLevel;
+    if (!IsPreview() || m_PreviewPassEnd == step * step) return;
+
+    uint32_t grid = step;
+    while (grid > 1 && (2 * step / grid) * (2 * step / grid) <= m_PreviewPassEnd) grid /= 2;
+
+    for (uint32_t y = tile.y; y < yEnd; y++) {
+        uint32_t* row = m_ImageData + y*m_Width;
+        const uint32_t* source = m_ImageData + (y & ~(grid - 1))*m_Width;
+        for (uint32_t x = tile.x; x < xEnd; x++)
+            if (m_PreviewOrder[(x & (step - 1)) + (y & (step - 1)) * step] >= m_PreviewPassEnd) row[x] = source[x & ~(grid - 1)];
+    }
+}
+
+
+template<int STRIDE>
+void Renderer::ResolveRow(const float* in, uint32_t* out, uint32_t count, float scale) const {
+
+    switch (m_Settings.Tonemapping) {
+        case Tonemap::Reinhard: ResolvePixels<Tonemap::Reinhard, STRIDE>(in, out, count, scale, m_Settings.SRGB); break;
+        case Tonemap::ACES:     ResolvePixels<Tonemap::ACES, STRIDE>(in, out, count, scale, m_Settings.SRGB); break;
+        default:                ResolvePixels<Tonemap::Clamp, STRIDE>(in, out, count, scale, m_Settings.SRGB); break;
+    }
+}
+
+
+void Renderer::UpdateTileSamples(uint32_t tileIndex) {
+
+    Tile& tile = m_Tiles[tileIndex];
+    tile.NbPass = 1;
+    if (tile.NbSample < m_Settings.AdaptiveMinSamples) return;
+
+    uint32_t xEnd = glm::min(tile.x + m_TileSize, m_Width);
+    uint32_t yEnd = glm::min(tile.y + m_TileSize, m_Height);
+    float n = (float)tile.NbSample;
+    float maxError = 0.0f;
+
+    for (uint32_t y = tile.y; y < yEnd; y++) {
+        for (uint32_t x = tile.x; x < xEnd; x++) {
+            float mean = Utils::Luminance(AccumulationUtils::Mean(m_AccumulationFormat,
+                m_AccumulationData + (size_t)(x + y*m_Width) * AccumulationUtils::PixelSize(m_AccumulationFormat), tile.NbSample));
+            float variance = glm::max(m_SquaredLuminance[x + y*m_Width] / n - mean * mean, 0.0f);
+
+            //Standard error of the mean, relative to it above .1 (dark pixels would never
+            //converge otherwise)
+            float error = glm::sqrt(variance / n) / glm::max(mean, .1f);
+            maxError = glm::max(maxError, error);
+        }
+    }
+
+    //Tiles at k times the threshold get k samples per frame, up to the maximum
+    tile.Converged = maxError <= m_Settings.AdaptiveThreshold;
+    float ratio = glm::min(maxError / m_Settings.AdaptiveThreshold, (float)glm::max(m_Settings.AdaptiveMaxSamples, 1u));
+    tile.NbPass = tile.Converged ? 1 : glm::max((uint32_t)ratio, 1u);
+}
+
+
+void Renderer::RenderTile(uint32_t tileIndex) {
+
+    if (IsCancelled()) return;
+
+    Tile& tile = m_Tiles[tileIndex];
+    if (tile.Converged) {
+        m_TileTimes[tileIndex] = -1.0f;
+        return;
+    }
+
+    Walnut::Timer timer;
+
+    uint32_t width = m_Width, height = m_Height;
+    uint32_t xEnd = glm::min(tile.x + m_TileSize, width);
+    uint32_t yEnd = glm::min(tile.y + m_TileSize, height);
+    uint32_t pathLength = 0;
+
+    if (IsPreview()) {
+        //Tiles start on a multiple of the block size
+        uint32_t step = 1 << m_PreviewLevel;
+        for (uint32_t pass = m_PreviewPass; pass < m_PreviewPassEnd; pass++) {
+            glm::uvec2 offset = PreviewOffset(pass);
+            for (uint32_t y = tile.y + offset.y; y < yEnd; y += step)
+                for (uint32_t x = tile.x + offset.x; x < xEnd; x += step)
+                    AccumulatePixel(x, y, glm::vec3(PerPixel(x, y, pathLength)));
+        }
+    } else {
+        //One sample per pixel per pass, the tile counts it once complete
+        for (uint32_t pass = 0; pass < tile.NbPass; pass++, tile.NbSample++) {
+            if (m_Settings.Mode == TraceMode::Packet) {
+                for (uint32_t y = tile.y; y < yEnd; y += PACKET_WIDTH)
+                    for (uint32_t x = tile.x; x < xEnd; x += PACKET_WIDTH)
+                        RenderBlock(x, y, pathLength);
+            } else {
+                for (uint32_t y = tile.y; y < yEnd; y++)
+                    for (uint32_t x = tile.x; x < xEnd; x++)
+                        AccumulatePixel(x, y, glm::vec3(PerPixel(x, y, pathLength)));
+            }
+        }
+    }
+    m_PathSegments.fetch_add(pathLength, std::memory_order_relaxed);
+    tile.Dirty = true;
+    if (IsAdaptive() && !IsPreview()) UpdateTileSamples(tileIndex);
+
+    m_TileTimes[tileIndex] = timer.ElapsedMillis();
+}
+
+
+void Renderer::RenderBlock(uint32_t x0, uint32_t y0, uint32_t& pathLength) {
+
+    uint32_t width = m_Width, height = m_Height;
+
+    //Primary rays of the block, pixels outside of the image repeat the border ones
+    RayPacket packet;
+    packet.Origin = m_ActiveCamera->GetPosition();
+
+    alignas(32) float sampleX[PACKET_SIZE], sampleY[PACKET_SIZE];
+    for (int i = 0; i < PACKET_SIZE; i++) {
+        glm::vec2 sample = CameraSample(glm::min(x0 + i % PACKET_WIDTH, width - 1), glm::min(y0 + i / PACKET_WIDTH, height - 1));
+        sampleX[i] = sample.x;
+        sampleY[i] = sample.y;
+    }
+    for (int i = 0; i < PACKET_SIZE; i += SIMD_WIDTH) {
+        vfloatN direction[3];
+        CameraRayDirections(m_ActiveCamera->GetRayBasis(), vfloatN::load(sampleX + i), vfloatN::load(sampleY + i), direction);
+        for (int a = 0; a < 3; a++) direction[a].store(packet.Direction[a] + i);
+    }
+    packet.Init();
+
+    m_ActiveScene->bvh.IntersectPacket(packet, m_ActiveScene->Shapes);
+
+    //Shading goes on per pixel from the primary hit
+    for (int i = 0; i < PACKET_SIZE; i++) {
+        uint32_t x = x0 + i % PACKET_WIDTH;
+        uint32_t y = y0 + i / PACKET_WIDTH;
+        if (x >= width || y >= height) continue;
+
+        Ray ray;
+        ray.Origin = packet.Origin;
+        ray.Direction = glm::vec3(packet.Direction[0][i], packet.Direction[1][i], packet.Direction[2][i]);
+
+        HitPayLoad payload;
+        payload.HitDistance = packet.HitDistance[i];
+        payload.HitShape = packet.HitShape[i];
+        payload.PrimitiveId = packet.PrimitiveId[i];
+        payload.Barycentric = glm::vec2(packet.Barycentric[0][i], packet.Barycentric[1][i]);
+        ResolveHit(ray, payload);
+
+        AccumulatePixel(x, y, glm::vec3(PerPixel(x, y, pathLength, &payload)));
+    }
+}
+
+
+glm::vec2 Renderer::CameraSample(uint32_t x, uint32_t y) const {
+
+    if (!m_Settings.Jitter) return glm::vec2(x + .5f, y + .5f);
+
+    Sampler sampler(m_Settings.Sampling, x + y*m_Width, SampleIndex(x, y), m_Width);
+    return glm::vec2(x, y) + sampler.Get2D();
 }
 
 
@@ -102,61 +540,463 @@ HitPayLoad Renderer::TraceRay(const Ray& ray) {
     payload.HitShape = nullptr;
 
     m_ActiveScene->bvh.Intersect(ray, m_ActiveScene->Shapes, payload);
+    ResolveHit(ray, payload);
+
+    return payload;
+}
+
+
+void Renderer::ResolveHit(const Ray& ray, HitPayLoad& payload) {
 
     if (!payload.HitShape) 
         payload.HitShape->Miss(ray, payload);
     else 
         payload.HitShape->ClosestHit(ray, payload);
-
-    return payload;
 }
 
 
-glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y) {
+glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y, uint32_t& pathLength, const HitPayLoad* primaryHit) {
     
     Ray ray; 
     ray.Origin = m_ActiveCamera->GetPosition();
-    ray.Direction = m_ActiveCamera->GetRayDirections()[x + y*m_FinalImage->GetWidth()];
+    glm::vec2 sample = CameraSample(x, y);
+    ray.Direction = CameraRayDirection(m_ActiveCamera->GetRayBasis(), sample.x, sample.y);
 
     glm::vec3 light(.0f);
-    glm::vec3 contribution(1.0f);
+    PathState state;
 
-    uint32_t seed = x + y*m_FinalImage->GetWidth();
-    seed *= m_FrameIndex;
+    Sampler sampler(m_Settings.Sampling, x + y*m_Width, SampleIndex(x, y), m_Width);
 
-    int bounces = 5;
+    for(uint32_t i = 0; i < m_Settings.MaxDepth; i++) {
 
-    for(int i = 0; i < bounces; i++) {
+        sampler.SetDimension(CAMERA_DIMENSIONS + i * BOUNCE_DIMENSIONS);
 
-        seed += i;
-
-        HitPayLoad payload = TraceRay(ray);
+        HitPayLoad payload = (i == 0 && primaryHit) ? *primaryHit : TraceRay(ray);
+        pathLength++;
         
         if (payload.HitDistance < 0.0f) {
 
             glm::vec3 skyColor = glm::vec3(.6f, .7f, .9f);
-            light += skyColor * contribution;
+            light += skyColor * state.Throughput;
             break;
         }
-        
-        // glm::vec3 lightDir = glm::normalize(glm::vec3(-1, -1, -1));
-        // float lightIntensity = glm::max(glm::dot(payload.WorldNormal, -lightDir),0.0f);
 
-        const Material& material = m_ActiveScene->Materials[payload.HitShape->MaterialIndex];
+        //TODO : specular
+
+        light += ShadeHit(ray, payload, state, sampler);
+        if (!ContinuePath(state, i, sampler)) break;
+    }
 
-        contribution *= material.Albedo;
-        light += material.GetEmission();
+    return glm::vec4(light, 1.0f);
+}
 
-        //glm::vec3 RoughnessVector = material.Roughness * Walnut::Random::Vec3(-0.5f, 0.5f);
-        
-        //TODO : specular
 
-        ray.Origin = payload.WorldPosition + payload.WorldNormal * .0001f;
-        //ray.Direction = glm::reflect(ray.Direction, payload.WorldNormal + RoughnessVector);
+glm::vec3 Renderer::ShadeHit(Ray& ray, const HitPayLoad& payload, PathState& state, Sampler& sampler, BounceLight* deferred) const {
+
+    const Shape* shape = payload.HitShape;
+    const Material& material = m_ActiveScene->Materials[shape->MaterialIndex];
+    glm::vec3 light(0.0f);
 
-        ray.Direction = glm::normalize(payload.WorldNormal + Utils::InUnitSphere(seed));
+    //Emission reached by the bounce, weighted against the light sample of the previous hit
+    //(which could not draw the shape it left from)
+    if (material.EmmissionPower > 0.0f) {
+        float weight = 1.0f;
+        if (!m_Lights.empty() && state.BsdfPdf > 0.0f && shape != state.LastShape) {
+            float lightPdf = shape->LightPdf(ray, payload) / m_Lights.size();
+            weight = Utils::PowerHeuristic(state.BsdfPdf, lightPdf);
+        }
+        light += state.Throughput * material.GetEmission() * weight;
     }
 
-    return glm::vec4(light, 1.0f);
+    //Lambertian surface : f = albedo / pi, the bounces are drawn with pdf cos / pi
+    glm::vec3 origin = payload.WorldPosition + payload.WorldNormal * .0001f;
+
+    //Next event estimation : a light drawn uniformly, then a point of it
+    if (!m_Lights.empty()) {
+        float select = sampler.Get1D();
+        glm::vec2 u = sampler.Get2D();
+        const Shape* lightShape = m_Lights[glm::min((size_t)(select * m_Lights.size()), m_Lights.size() - 1)];
+
+        LightSample sample;
+        if (lightShape != shape && lightShape->SampleLight(origin, u, sample)) {
+            float cosine = glm::dot(payload.WorldNormal, sample.Direction);
+            Ray shadowRay;
+            shadowRay.Origin = origin;
+            shadowRay.Direction = sample.Direction;
+
+            float shadowDistance = sample.Distance * (1.0f - 1e-4f);
+
+            if (cosine > 0.0f && (deferred || !m_ActiveScene->bvh.Occluded(shadowRay, m_ActiveScene->Shapes, shadowDistance))) {
+                float lightPdf = sample.Pdf / m_Lights.size();
+                float weight = Utils::PowerHeuristic(lightPdf, cosine / PI);
+                const Material& lightMaterial = m_ActiveScene->Materials[lightShape->MaterialIndex];
+                glm::vec3 sampleLight = state.Throughput * material.Albedo * lightMaterial.GetEmission() * (cosine / PI * weight / lightPdf);
+
+                if (deferred) {
+                    deferred->SampleLight = sampleLight;
+                    deferred->Shadow = shadowRay;
+                    deferred->ShadowDistance = shadowDistance;
+                } else light += sampleLight;
+            }
+        }
+    }
+
+    ray.Origin = origin;
+    ray.Direction = Utils::CosineHemisphere(payload.WorldNormal, sampler.Get2D());
+
+    state.Throughput *= material.Albedo;
+    state.BsdfPdf = glm::max(glm::dot(payload.WorldNormal, ray.Direction), 0.0f) / PI;
+    state.LastShape = shape;
+
+    return light;
+}
+
+
+bool Renderer::ContinuePath(PathState& state, uint32_t depth, Sampler& sampler) const {
+
+    if (depth + 1 >= m_Settings.MaxDepth) return false;
+    if (depth + 1 < m_Settings.RouletteDepth) return true;
+
+    //Survives with the probability of its throughput (capped so that bright paths still
+    //end), the survivors make up for the others
+    float survival = glm::min(glm::max(state.Throughput.r, glm::max(state.Throughput.g, state.Throughput.b)), .95f);
+    if (sampler.Get1D() >= survival) return false;
+
+    state.Throughput /= survival;
+    return true;
+}
+
+
+void Renderer::RayQueue::Resize(size_t capacity) {
+
+    for (int a = 0; a < 3; a++) {
+        Origin[a].resize(capacity);
+        Direction[a].resize(capacity);
+        Throughput[a].resize(capacity);
+    }
+    BsdfPdf.resize(capacity);
+    LastShape.resize(capacity);
+    Pixel.resize(capacity);
+    Size = 0;
+}
+
+void Renderer::RayQueue::CopyRay(size_t dst, const RayQueue& src, size_t srcId) {
+
+    for (int a = 0; a < 3; a++) {
+        Origin[a][dst] = src.Origin[a][srcId];
+        Direction[a][dst] = src.Direction[a][srcId];
+        Throughput[a][dst] = src.Throughput[a][srcId];
+    }
+    BsdfPdf[dst] = src.BsdfPdf[srcId];
+    LastShape[dst] = src.LastShape[srcId];
+    Pixel[dst] = src.Pixel[srcId];
+}
+
+
+void Renderer::RenderWavefront() {
+
+    //A sample per pixel of the tiles that still need one per pass, the samples of the next
+    //frame are chosen once they are all done
+    uint32_t nbPass = 0;
+    for (const Tile& tile : m_Tiles)
+        if (!tile.Converged) nbPass = glm::max(nbPass, tile.NbPass);
+
+    for (uint32_t pass = 0; pass < nbPass; pass++) {
+
+        WavefrontGenerate(pass);
+
+        for (uint32_t bounce = 0; bounce < m_Settings.MaxDepth && m_RayQueues[m_CurrentQueue].Size > 0; bounce++) {
+            if (IsCancelled()) return;
+            if (bounce > 0) WavefrontSort(); //Primary rays are already coherent
+            size_t nbRay = m_RayQueues[m_CurrentQueue].Size;
+            m_PathSegments += nbRay;
+            WavefrontExtend(bounce);
+            WavefrontShade(bounce);
+            WavefrontConnect(nbRay);
+        }
+
+        WavefrontAccumulate(pass);
+    }
+
+    if (!IsAdaptive()) return;
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, (uint32_t)m_Tiles.size()), [&](const tbb::blocked_range<uint32_t>& r) {
+        for (uint32_t t = r.begin(); t < r.end(); t++)
+            if (!m_Tiles[t].Converged) UpdateTileSamples(t);
+    });
+}
+
+
+void Renderer::WavefrontGenerate(uint32_t pass) {
+
+    uint32_t width = m_Width, height = m_Height;
+
+    m_CurrentQueue = 0;
+    RayQueue& queue = m_RayQueues[m_CurrentQueue];
+
+    //Rays of the tiles rendered by the pass, tile after tile, in blocks of PACKET_WIDTH x PACKET_WIDTH
+    //pixels (the packets of the extend stage)
+    auto rendered = [&](const Tile& tile) { return !tile.Converged && pass < tile.NbPass; };
+    std::vector<uint32_t> tileOffsets(m_Tiles.size());
+    uint32_t nbRay = 0;
+    for (size_t t = 0; t < m_Tiles.size(); t++) {
+        tileOffsets[t] = nbRay;
+        const Tile& tile = m_Tiles[t];
+        if (rendered(tile)) nbRay += (glm::min(tile.x + m_TileSize, width) - tile.x) * (glm::min(tile.y + m_TileSize, height) - tile.y);
+    }
+    queue.Size = nbRay;
+
+    const glm::vec3& origin = m_ActiveCamera->GetPosition();
+    const Camera::RayBasis& basis = m_ActiveCamera->GetRayBasis();
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, m_Tiles.size()), [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t t = r.begin(); t < r.end(); t++) {
+            const Tile& tile = m_Tiles[t];
+            if (!rendered(tile)) continue;
+
+            uint32_t xEnd = glm::min(tile.x + m_TileSize, width);
+            uint32_t yEnd = glm::min(tile.y + m_TileSize, height);
+            uint32_t tileWidth = xEnd - tile.x, tileHeight = yEnd - tile.y;
+
+            //Index of a pixel in the queue : the blocks before its own, then the pixels before it in its block
+            auto rayIndex = [&](uint32_t x, uint32_t y) {
+                uint32_t bx = (x - tile.x) / PACKET_WIDTH * PACKET_WIDTH, by = (y - tile.y) / PACKET_WIDTH * PACKET_WIDTH;
+                uint32_t blockWidth = glm::min(tileWidth - bx, (uint32_t)PACKET_WIDTH);
+                uint32_t blockHeight = glm::min(tileHeight - by, (uint32_t)PACKET_WIDTH);
+                return tileOffsets[t] + by * tileWidth + bx * blockHeight + (y - tile.y - by) * blockWidth + (x - tile.x - bx);
+            };
+
+            for (uint32_t y = tile.y; y < yEnd; y++) {
+
+                //Directions of the row SIMD_WIDTH at a time (never across blocks), the remaining ones one by one
+                uint32_t x = tile.x;
+                for (; x + SIMD_WIDTH <= xEnd; x += SIMD_WIDTH) {
+                    alignas(32) float sampleX[SIMD_WIDTH], sampleY[SIMD_WIDTH];
+                    for (int l = 0; l < SIMD_WIDTH; l++) {
+                        glm::vec2 sample = CameraSample(x + l, y);
+                        sampleX[l] = sample.x;
+                        sampleY[l] = sample.y;
+                    }
+                    vfloatN direction[3];
+                    CameraRayDirections(basis, vfloatN::load(sampleX), vfloatN::load(sampleY), direction);
+                    for (int a = 0; a < 3; a++) direction[a].storeu(&queue.Direction[a][rayIndex(x, y)]);
+                }
+                for (; x < xEnd; x++) {
+                    glm::vec2 sample = CameraSample(x, y);
+                    glm::vec3 direction = CameraRayDirection(basis, sample.x, sample.y);
+                    for (int a = 0; a < 3; a++) queue.Direction[a][rayIndex(x, y)] = direction[a];
+                }
+
+                for (x = tile.x; x < xEnd; x++) {
+                    uint32_t i = x + y*width;
+                    uint32_t k = rayIndex(x, y);
+                    for (int a = 0; a < 3; a++) {
+                        queue.Origin[a][k] = origin[a];
+                        queue.Throughput[a][k] = 1.0f;
+                    }
+                    queue.BsdfPdf[k] = 0.0f;
+                    queue.LastShape[k] = nullptr;
+                    queue.Pixel[k] = i;
+                    m_Radiance[i] = glm::vec3(0.0f);
+                }
+            }
+        }
+    });
+}
+
+
+void Renderer::WavefrontSort() {
+
+    RayQueue& queue = m_RayQueues[m_CurrentQueue];
+    RayQueue& sorted = m_RayQueues[1 - m_CurrentQueue];
+
+    const BVHTree& bvh = m_ActiveScene->bvh;
+    if (bvh.nodes.empty()) return;
+    glm::vec3 sceneMin = bvh.nodes[bvh.rootNodeId].aabbMin;
+    glm::vec3 scale = 511.0f / glm::max(bvh.nodes[bvh.rootNodeId].aabbMax - sceneMin, glm::vec3(1e-6f));
+
+    //Key : direction octant, then Morton code of the origin in the scene bounds, then ray index
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, queue.Size), [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t i = r.begin(); i < r.end(); i++) {
+            uint32_t octant = 0, morton = 0;
+            for (int a = 0; a < 3; a++) {
+                octant |= (queue.Direction[a][i] < 0.0f) << a;
+                float cell = glm::clamp((queue.Origin[a][i] - sceneMin[a]) * scale[a], 0.0f, 511.0f);
+                morton |= Utils::ExpandBits((uint32_t)cell) << (2 - a);
+            }
+            m_SortKeys[i] = ((uint64_t)(octant << 27 | morton) << 32) | i;
+        }
+    });
+
+    tbb::parallel_sort(m_SortKeys.begin(), m_SortKeys.begin() + queue.Size);
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, queue.Size), [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t i = r.begin(); i < r.end(); i++)
+            sorted.CopyRay(i, queue, m_SortKeys[i] & 0xffffffff);
+    });
+
+    sorted.Size = queue.Size;
+    m_CurrentQueue = 1 - m_CurrentQueue;
+}
+
+
+void Renderer::WavefrontExtend(uint32_t bounce) {
+
+    const RayQueue& queue = m_RayQueues[m_CurrentQueue];
+
+    //Camera rays are traced as packets of PACKET_SIZE consecutive rays (a block of pixels),
+    //the last one repeating its last ray. The bounces are diffuse : in packets, their groups
+    //rarely share the axes of the watertight test and visit the union of their nodes
+    if (bounce == 0) {
+        size_t nbPacket = (queue.Size + PACKET_SIZE - 1) / PACKET_SIZE;
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, nbPacket), [&](const tbb::blocked_range<size_t>& r) {
+            RayPacket packet;
+            for (size_t p = r.begin(); p < r.end(); p++) {
+                size_t first = p * PACKET_SIZE;
+                size_t count = glm::min((size_t)PACKET_SIZE, queue.Size - first);
+
+                packet.Origin = m_ActiveCamera->GetPosition();
+                for (int i = 0; i < PACKET_SIZE; i++) {
+                    size_t k = first + glm::min((size_t)i, count - 1);
+                    for (int a = 0; a < 3; a++) packet.Direction[a][i] = queue.Direction[a][k];
+                }
+                packet.Init();
+
+                m_ActiveScene->bvh.IntersectPacket(packet, m_ActiveScene->Shapes);
+
+                for (size_t i = 0; i < count; i++) {
+                    m_HitDistance[first + i] = packet.HitDistance[i];
+                    m_HitShape[first + i] = packet.HitShape[i];
+                    m_HitPrimitive[first + i] = packet.PrimitiveId[i];
+                    m_HitBarycentric[first + i] = glm::vec2(packet.Barycentric[0][i], packet.Barycentric[1][i]);
+                }
+            }
+        });
+        return;
+    }
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, queue.Size), [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t i = r.begin(); i < r.end(); i++) {
+            Ray ray;
+            ray.Origin = glm::vec3(queue.Origin[0][i], queue.Origin[1][i], queue.Origin[2][i]);
+            ray.Direction = glm::vec3(queue.Direction[0][i], queue.Direction[1][i], queue.Direction[2][i]);
+
+            HitPayLoad payload;
+            payload.HitDistance = std::numeric_limits<float>::max();
+            payload.HitShape = nullptr;
+            m_ActiveScene->bvh.Intersect(ray, m_ActiveScene->Shapes, payload);
+
+            m_HitDistance[i] = payload.HitDistance;
+            m_HitShape[i] = payload.HitShape;
+            m_HitPrimitive[i] = payload.PrimitiveId;
+            m_HitBarycentric[i] = payload.Barycentric;
+        }
+    });
+}
+
+
+void Renderer::WavefrontShade(uint32_t bounce) {
+
+    RayQueue& queue = m_RayQueues[m_CurrentQueue];
+    RayQueue& next = m_RayQueues[1 - m_CurrentQueue];
+    std::atomic<size_t> nextSize{0};
+
+    //Each chunk shades its rays, then appends the surviving ones to the next queue at once
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, queue.Size, SHADE_CHUNK), [&](const tbb::blocked_range<size_t>& r) {
+
+        uint32_t survivors[SHADE_CHUNK];
+        glm::vec3 survivorOrigin[SHADE_CHUNK], survivorDirection[SHADE_CHUNK];
+        uint32_t nbSurvivor = 0;
+
+        for (size_t i = r.begin(); i < r.end(); i++) {
+
+            Ray ray;
+            ray.Origin = glm::vec3(queue.Origin[0][i], queue.Origin[1][i], queue.Origin[2][i]);
+            ray.Direction = glm::vec3(queue.Direction[0][i], queue.Direction[1][i], queue.Direction[2][i]);
+            PathState state;
+            state.Throughput = glm::vec3(queue.Throughput[0][i], queue.Throughput[1][i], queue.Throughput[2][i]);
+            state.BsdfPdf = queue.BsdfPdf[i];
+            state.LastShape = queue.LastShape[i];
+            uint32_t pixel = queue.Pixel[i];
+
+            HitPayLoad payload;
+            payload.HitDistance = m_HitDistance[i];
+            payload.HitShape = m_HitShape[i];
+            payload.PrimitiveId = m_HitPrimitive[i];
+            payload.Barycentric = m_HitBarycentric[i];
+            ResolveHit(ray, payload);
+
+            BounceLight& bounceLight = m_BounceLights[i];
+            bounceLight.Pixel = pixel;
+            bounceLight.ShadowDistance = 0.0f;
+
+            if (payload.HitDistance < 0.0f) {
+                glm::vec3 skyColor = glm::vec3(.6f, .7f, .9f);
+                bounceLight.Light = skyColor * state.Throughput;
+                continue;
+            }
+
+            Sampler sampler(m_Settings.Sampling, pixel, SampleIndex(pixel % m_Width, pixel / m_Width), m_Width);
+            sampler.SetDimension(CAMERA_DIMENSIONS + bounce * BOUNCE_DIMENSIONS);
+            bounceLight.Light = ShadeHit(ray, payload, state, sampler, &bounceLight);
+            if (!ContinuePath(state, bounce, sampler)) continue;
+
+            survivorOrigin[nbSurvivor] = ray.Origin;
+            survivorDirection[nbSurvivor] = ray.Direction;
+            survivors[nbSurvivor++] = i;
+
+            //Path state is updated in place, the ray is copied with it
+            for (int a = 0; a < 3; a++) queue.Throughput[a][i] = state.Throughput[a];
+            queue.BsdfPdf[i] = state.BsdfPdf;
+            queue.LastShape[i] = state.LastShape;
+        }
+
+        size_t base = nextSize.fetch_add(nbSurvivor);
+        for (uint32_t k = 0; k < nbSurvivor; k++) {
+            next.CopyRay(base + k, queue, survivors[k]);
+            for (int a = 0; a < 3; a++) {
+                next.Origin[a][base + k] = survivorOrigin[k][a];
+                next.Direction[a][base + k] = survivorDirection[k][a];
+            }
+        }
+    }, tbb::simple_partitioner());
+
+    next.Size = nextSize;
+    m_CurrentQueue = 1 - m_CurrentQueue;
+}
+
+
+void Renderer::WavefrontConnect(size_t nbRay) {
+
+    //Shadow rays of the light samples of the bounce, the light of each ray then goes to its pixel
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, nbRay), [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t i = r.begin(); i < r.end(); i++) {
+            const BounceLight& bounceLight = m_BounceLights[i];
+            glm::vec3 light = bounceLight.Light;
+            if (bounceLight.ShadowDistance > 0.0f && !m_ActiveScene->bvh.Occluded(bounceLight.Shadow, m_ActiveScene->Shapes, bounceLight.ShadowDistance))
+                light += bounceLight.SampleLight;
+            m_Radiance[bounceLight.Pixel] += light;
+        }
+    });
+}
+
+
+void Renderer::WavefrontAccumulate(uint32_t pass) {
+
+    uint32_t width = m_Width, height = m_Height;
+
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, (uint32_t)m_Tiles.size()), [&](const tbb::blocked_range<uint32_t>& r) {
+        for (uint32_t t = r.begin(); t < r.end(); t++) {
+            Tile& tile = m_Tiles[t];
+            if (tile.Converged || pass >= tile.NbPass) continue;
+
+            uint32_t xEnd = glm::min(tile.x + m_TileSize, width);
+            uint32_t yEnd = glm::min(tile.y + m_TileSize, height);
+            for (uint32_t y = tile.y; y < yEnd; y++)
+                for (uint32_t x = tile.x; x < xEnd; x++)
+                    AccumulatePixel(x, y, m_Radiance[x + y*width]);
+
+            tile.NbSample++;
+            tile.Dirty = true;
+        }
+    });
 }
- 
\ No newline at end of file
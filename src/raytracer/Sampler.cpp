@@ -0,0 +1,110 @@
+#include "raytracer/Sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+#define BLUE_NOISE_PIXELS (BLUE_NOISE_SIZE * BLUE_NOISE_SIZE)
+#define BLUE_NOISE_SIGMA 1.5f
+
+
+namespace Utils {
+
+    //Energy of a point on the torus of the tile, a gaussian of the wrapped distance
+    static std::vector<float> EnergyKernel() {
+
+        std::vector<float> kernel(BLUE_NOISE_PIXELS);
+        for (int y = 0; y < BLUE_NOISE_SIZE; y++) {
+            for (int x = 0; x < BLUE_NOISE_SIZE; x++) {
+                int dx = std::min(x, BLUE_NOISE_SIZE - x);
+                int dy = std::min(y, BLUE_NOISE_SIZE - y);
+                kernel[x + y * BLUE_NOISE_SIZE] = std::exp(-(dx*dx + dy*dy) / (2.0f * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+            }
+        }
+        return kernel;
+    }
+
+    static void AddEnergy(std::vector<float>& energy, const std::vector<float>& kernel, int pixel, float sign) {
+        int px = pixel % BLUE_NOISE_SIZE, py = pixel / BLUE_NOISE_SIZE;
+        for (int y = 0; y < BLUE_NOISE_SIZE; y++) {
+            const float* row = &kernel[((y - py) & (BLUE_NOISE_SIZE - 1)) * BLUE_NOISE_SIZE];
+            for (int x = 0; x < BLUE_NOISE_SIZE; x++)
+                energy[x + y * BLUE_NOISE_SIZE] += sign * row[(x - px) & (BLUE_NOISE_SIZE - 1)];
+        }
+    }
+
+    //Set pixel of highest energy (tightest cluster) or unset one of lowest energy (largest void)
+    static int FindPixel(const std::vector<float>& energy, const std::vector<bool>& pattern, bool set) {
+        int best = -1;
+        for (int i = 0; i < BLUE_NOISE_PIXELS; i++) {
+            if (pattern[i] != set) continue;
+            if (best == -1 || (set ? energy[i] > energy[best] : energy[i] < energy[best])) best = i;
+        }
+        return best;
+    }
+}
+
+
+// Void and cluster (Ulichney 1993) : the points are ranked so that the first n of them are
+// spread as evenly as possible for every n
+static std::vector<uint16_t> BuildBlueNoise() {
+
+    std::vector<float> kernel = Utils::EnergyKernel();
+    std::vector<float> energy(BLUE_NOISE_PIXELS, 0.0f);
+    std::vector<bool> pattern(BLUE_NOISE_PIXELS, false);
+    std::vector<uint16_t> ranks(BLUE_NOISE_PIXELS);
+
+    //Initial pattern : a tenth of the pixels at random, then moved from the tightest cluster
+    //to the largest void until it is stable
+    int nbInitial = BLUE_NOISE_PIXELS / 10;
+    uint32_t seed = 0x5eed;
+    for (int n = 0; n < nbInitial; ) {
+        seed = SamplerUtils::PCG_Hash(seed);
+        int pixel = seed % BLUE_NOISE_PIXELS;
+        if (pattern[pixel]) continue;
+        pattern[pixel] = true;
+        Utils::AddEnergy(energy, kernel, pixel, 1.0f);
+        n++;
+    }
+
+    while (true) {
+        int cluster = Utils::FindPixel(energy, pattern, true);
+        pattern[cluster] = false;
+        Utils::AddEnergy(energy, kernel, cluster, -1.0f);
+
+        int gap = Utils::FindPixel(energy, pattern, false);
+        pattern[gap] = true;
+        Utils::AddEnergy(energy, kernel, gap, 1.0f);
+        if (gap == cluster) break;
+    }
+
+    //Ranks of the initial points, by removing the tightest cluster first
+    std::vector<bool> initial = pattern;
+    std::vector<float> initialEnergy = energy;
+    for (int rank = nbInitial - 1; rank >= 0; rank--) {
+        int cluster = Utils::FindPixel(energy, pattern, true);
+        pattern[cluster] = false;
+        Utils::AddEnergy(energy, kernel, cluster, -1.0f);
+        ranks[cluster] = rank;
+    }
+
+    //Then the others, by filling the largest void first
+    pattern = initial;
+    energy = initialEnergy;
+    for (int rank = nbInitial; rank < BLUE_NOISE_PIXELS; rank++) {
+        int gap = Utils::FindPixel(energy, pattern, false);
+        pattern[gap] = true;
+        Utils::AddEnergy(energy, kernel, gap, 1.0f);
+        ranks[gap] = rank;
+    }
+
+    return ranks;
+}
+
+
+const uint16_t* Sampler::BlueNoiseTile() {
+
+    static const std::vector<uint16_t> tile = BuildBlueNoise();
+    return tile.data();
+}
@@ -0,0 +1,320 @@
+#include "raytracer/SceneCache.h"
+#include "raytracer/AlignedVector.h"
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+
+#if BVH_WIDTH > 2
+    using CacheNode = WideBVHNode<BVH_WIDTH>;
+#else
+    using CacheNode = BVHNode;
+#endif
+
+#define CACHE_BYTE_ORDER 0x01020304u
+
+enum CacheSection {
+    SectionVertices = 0,
+    SectionIndices,
+    SectionTriangles,                     // V0, V1, V2 : one section per axis
+    SectionNodes = SectionTriangles + 9,
+    SectionCount
+};
+
+//First bytes of the file, the sections follow
+struct CacheHeader {
+    char Magic[8];
+    uint32_t Version;
+    uint32_t ByteOrder;     // CACHE_BYTE_ORDER as written by the machine
+    uint32_t BvhWidth;
+    uint32_t NodeSize;
+    uint64_t SourceHash;
+    uint64_t FileSize;
+
+    float Bounds[6];        // Min, max
+    float SAHCost;
+    uint32_t BinaryNodes;   // Node count of the binary tree (the wide one is collapsed from)
+    uint32_t RootNodeId;
+    uint32_t Padding;
+
+    struct {
+        uint64_t Offset;    // From the start of the file, multiple of CACHE_LINE_SIZE
+        uint64_t Count;     // Of elements
+    } Sections[SectionCount];
+};
+
+static const char CACHE_MAGIC[8] = {'R', 'T', 'S', 'C', 'A', 'C', 'H', 'E'};
+
+
+namespace Utils {
+
+    static inline uint64_t Mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    //Hash of a block of bytes, 8 at a time
+    static uint64_t HashBytes(const char* data, size_t size, uint64_t seed) {
+
+        const uint64_t m = 0xc6a4a7935bd1e995ull;
+        uint64_t h = seed ^ (size * m);
+
+        size_t nbWord = size / 8;
+        for (size_t i = 0; i < nbWord; i++) {
+            uint64_t k;
+            memcpy(&k, data + 8*i, 8);
+            k *= m;
+            k ^= k >> 47;
+            k *= m;
+            h ^= k;
+            h *= m;
+        }
+
+        uint64_t tail = 0;
+        memcpy(&tail, data + 8*nbWord, size - 8*nbWord);
+        return Mix(h ^ tail);
+    }
+
+    static size_t AlignSection(size_t offset) {
+        return (offset + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+    }
+
+    template<typename T>
+    static ArrayView<T> SectionView(const MappedFile& file, const CacheHeader& header, int section) {
+        return ArrayView<T>((const T*)(file.Data() + header.Sections[section].Offset), header.Sections[section].Count);
+    }
+
+    //Whether the nodes form a tree the traversals can walk : children after their parent and
+    //referenced once, leaves in the triangles, no deeper than the traversal stacks (64)
+    static bool ValidNodes(ArrayView<CacheNode> nodes, uint32_t rootNodeId, uint64_t nbTriangle) {
+
+        if (nodes.empty()) return nbTriangle == 0;
+        if (rootNodeId >= nodes.size()) return false;
+
+        //Depth of each node once referenced, 0 : not referenced yet
+        std::vector<uint8_t> depth(nodes.size(), 0);
+        depth[rootNodeId] = 1;
+
+        auto validChild = [&](size_t parent, uint64_t child) {
+            if (child <= parent || child >= nodes.size() || depth[child] != 0 || depth[parent] >= 64) return false;
+            depth[child] = depth[parent] + 1;
+            return true;
+        };
+        auto validLeaf = [&](uint64_t first, uint64_t nbShape) { return first <= nbTriangle && nbShape <= nbTriangle - first; };
+
+        for (size_t i = 0; i < nodes.size(); i++) {
+            if (depth[i] == 0) continue; //Never traversed
+            const CacheNode& node = nodes[i];
+#if BVH_WIDTH > 2
+            for (int c = 0; c < BVH_WIDTH; c++) {
+                if (node.nbShape[c] > 0) {
+                    if (!validLeaf(node.child[c], node.nbShape[c])) return false;
+                    continue;
+                }
+                //Empty slots have inverted bounds on every axis, so that they always miss
+                bool empty = true;
+                for (int a = 0; a < 3; a++) empty &= node.bounds[0][a][c] > node.bounds[1][a][c];
+                if (!empty && !validChild(i, node.child[c])) return false;
+            }
+#else
+            if (node.nbShape > 0) {
+                if (!validLeaf(node.LeftFirst, node.nbShape)) return false;
+            } else if (!validChild(i, node.LeftFirst) || !validChild(i, (uint64_t)node.LeftFirst + 1)) return false;
+#endif
+        }
+        return true;
+    }
+}
+
+
+uint64_t SceneCache::HashFile(const std::string& path) {
+
+    MappedFile file(path);
+
+    //Chunks are hashed in parallel, then their hashes are combined in order
+    size_t nbChunk = (file.Size() + SCENE_CACHE_HASH_CHUNK - 1) / SCENE_CACHE_HASH_CHUNK;
+    std::vector<uint64_t> chunkHashes(nbChunk);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, nbChunk, 1), [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t c = r.begin(); c < r.end(); c++) {
+            size_t begin = c * SCENE_CACHE_HASH_CHUNK;
+            size_t size = std::min<size_t>(SCENE_CACHE_HASH_CHUNK, file.Size() - begin);
+            chunkHashes[c] = Utils::HashBytes(file.Data() + begin, size, c);
+        }
+    });
+
+    uint64_t hash = Utils::Mix(file.Size());
+    for (uint64_t chunkHash : chunkHashes) hash = Utils::Mix(hash ^ chunkHash) * 0x9e3779b97f4a7c15ull;
+    return hash;
+}
+
+
+std::string SceneCache::CachePath(const std::string& sourcePath, uint64_t sourceHash) {
+
+    size_t nameBegin = sourcePath.find_last_of('/');
+    nameBegin = nameBegin == std::string::npos ? 0 : nameBegin + 1;
+    size_t nameEnd = sourcePath.find_last_of('.');
+    if (nameEnd == std::string::npos || nameEnd < nameBegin) nameEnd = sourcePath.size();
+
+    //The BVH width is part of the name so that builds of different widths keep their own cache
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "-%016llx-w%d.bin", (unsigned long long)sourceHash, BVH_WIDTH);
+
+    return std::string(SCENE_CACHE_DIR) + "/" + sourcePath.substr(nameBegin, nameEnd - nameBegin) + suffix;
+}
+
+
+std::shared_ptr<const MeshData> SceneCache::Load(const std::string& cachePath, uint64_t sourceHash) {
+
+    std::shared_ptr<const MappedFile> file;
+    try {
+        file = std::make_shared<const MappedFile>(cachePath, false);
+    } catch (const std::runtime_error&) {
+        return nullptr;
+    }
+
+    if (file->Size() < sizeof(CacheHeader)) return nullptr;
+    CacheHeader header;
+    memcpy(&header, file->Data(), sizeof(header));
+
+    if (memcmp(header.Magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) || header.Version != SCENE_CACHE_VERSION
+        || header.ByteOrder != CACHE_BYTE_ORDER || header.BvhWidth != BVH_WIDTH || header.NodeSize != sizeof(CacheNode)
+        || header.SourceHash != sourceHash || header.FileSize != file->Size())
+        return nullptr;
+
+    //Sections must lie in the file and agree on the triangle count (plus the padding)
+    const size_t elementSizes[SectionCount] = {sizeof(glm::vec3), sizeof(uint32_t),
+        4, 4, 4, 4, 4, 4, 4, 4, 4, sizeof(CacheNode)};
+    for (int s = 0; s < SectionCount; s++) {
+        uint64_t offset = header.Sections[s].Offset, count = header.Sections[s].Count;
+        if (offset % CACHE_LINE_SIZE || offset > file->Size() || count > (file->Size() - offset) / elementSizes[s])
+            return nullptr;
+    }
+    uint64_t nbTriangle = header.Sections[SectionIndices].Count / 3;
+    if (header.Sections[SectionIndices].Count != 3 * nbTriangle) return nullptr;
+    for (int s = SectionTriangles; s < SectionTriangles + 9; s++)
+        if (header.Sections[s].Count != nbTriangle + MESH_TRIANGLE_PADDING) return nullptr;
+
+    //Contents are checked too, a damaged file must not send a traversal out of the buffers :
+    //the indices in the vertices, the nodes in themselves and in the triangles
+    ArrayView<uint32_t> indices = Utils::SectionView<uint32_t>(*file, header, SectionIndices);
+    uint64_t nbVertex = header.Sections[SectionVertices].Count;
+    for (uint32_t index : indices)
+        if (index >= nbVertex) return nullptr;
+
+    ArrayView<CacheNode> nodes = Utils::SectionView<CacheNode>(*file, header, SectionNodes);
+#if BVH_WIDTH > 2
+    if (!Utils::ValidNodes(nodes, 0, nbTriangle)) return nullptr;
+#else
+    if (header.BinaryNodes > nodes.size() || !Utils::ValidNodes(nodes, header.RootNodeId, nbTriangle)) return nullptr;
+#endif
+
+    std::shared_ptr<MeshData> data = std::make_shared<MeshData>(file);
+
+    data->Vertices = Utils::SectionView<glm::vec3>(*file, header, SectionVertices);
+    data->Indices = indices;
+    for (int a = 0; a < 3; a++) {
+        data->V0[a] = Utils::SectionView<float>(*file, header, SectionTriangles + a);
+        data->V1[a] = Utils::SectionView<float>(*file, header, SectionTriangles + 3 + a);
+        data->V2[a] = Utils::SectionView<float>(*file, header, SectionTriangles + 6 + a);
+    }
+
+    data->Bounds.bmin = glm::vec3(header.Bounds[0], header.Bounds[1], header.Bounds[2]);
+    data->Bounds.bmax = glm::vec3(header.Bounds[3], header.Bounds[4], header.Bounds[5]);
+    data->SAHCost = header.SAHCost;
+    data->bvh.nodesUsed = header.BinaryNodes;
+    data->bvh.rootNodeId = header.RootNodeId;
+
+#if BVH_WIDTH > 2
+    data->wbvh.Attach(nodes);
+#else
+    //The binary tree owns its nodes (the scene one is refitted), they are copied
+    data->bvh.nodes.assign(nodes.begin(), nodes.end());
+#endif
+
+    return data;
+}
+
+
+bool SceneCache::Save(const std::string& cachePath, uint64_t sourceHash, const MeshData& data) {
+
+#if BVH_WIDTH > 2
+    ArrayView<CacheNode> nodes = data.wbvh.nodes;
+#else
+    ArrayView<CacheNode> nodes = data.bvh.nodes;
+#endif
+
+    const void* sections[SectionCount];
+    size_t sizes[SectionCount], counts[SectionCount];
+    auto setSection = [&](int s, const auto& view) {
+        sections[s] = view.data();
+        counts[s] = view.size();
+        sizes[s] = view.size() * sizeof(view[0]);
+    };
+    setSection(SectionVertices, data.Vertices);
+    setSection(SectionIndices, data.Indices);
+    for (int a = 0; a < 3; a++) {
+        setSection(SectionTriangles + a, data.V0[a]);
+        setSection(SectionTriangles + 3 + a, data.V1[a]);
+        setSection(SectionTriangles + 6 + a, data.V2[a]);
+    }
+    setSection(SectionNodes, nodes);
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.Magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.Version = SCENE_CACHE_VERSION;
+    header.ByteOrder = CACHE_BYTE_ORDER;
+    header.BvhWidth = BVH_WIDTH;
+    header.NodeSize = sizeof(CacheNode);
+    header.SourceHash = sourceHash;
+    for (int a = 0; a < 3; a++) {
+        header.Bounds[a] = data.Bounds.bmin[a];
+        header.Bounds[3 + a] = data.Bounds.bmax[a];
+    }
+    header.SAHCost = data.SAHCost;
+    header.BinaryNodes = data.bvh.nodesUsed;
+    header.RootNodeId = data.bvh.rootNodeId;
+
+    size_t offset = sizeof(CacheHeader);
+    for (int s = 0; s < SectionCount; s++) {
+        offset = Utils::AlignSection(offset);
+        header.Sections[s].Offset = offset;
+        header.Sections[s].Count = counts[s];
+        offset += sizes[s];
+    }
+    header.FileSize = offset;
+
+    mkdir(SCENE_CACHE_DIR, 0755);
+
+    //Written aside then renamed, so that a reader never maps a partial file
+    std::string tmpPath = cachePath + ".tmp";
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if (!file) return false;
+
+    static const char padding[CACHE_LINE_SIZE] = {};
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    size_t position = sizeof(header);
+    for (int s = 0; s < SectionCount && written; s++) {
+        size_t pad = header.Sections[s].Offset - position;
+        written = fwrite(padding, 1, pad, file) == pad && fwrite(sections[s], 1, sizes[s], file) == sizes[s];
+        position += pad + sizes[s];
+    }
+
+    if (fclose(file) != 0 || !written || rename(tmpPath.c_str(), cachePath.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,67 @@
+#include "raytracer/SceneLoader.h"
+#include "raytracer/Sphere.h"
+#include "raytracer/PlyLoader.h"
+#include "raytracer/SceneCache.h"
+
+
+void SceneLoader::ReadPLY(const std::string& path, std::vector<glm::vec3>& vertices, std::vector<uint32_t>& indices) {
+    PlyLoader::Load(path, vertices, indices);
+}
+
+
+Mesh* SceneLoader::LoadPLY(const std::string& path, int materialIndex, bool useCache) {
+
+    uint64_t hash = 0;
+    std::string cachePath;
+    if (useCache) {
+        hash = SceneCache::HashFile(path);
+        cachePath = SceneCache::CachePath(path, hash);
+        if (std::shared_ptr<const MeshData> data = SceneCache::Load(cachePath, hash)) {
+            printf("Mesh mapped from %s\n", cachePath.c_str());
+            return new Mesh(std::move(data), materialIndex);
+        }
+    }
+
+    std::vector<glm::vec3> vertices;
+    std::vector<uint32_t> indices;
+    ReadPLY(path, vertices, indices);
+
+    Mesh* mesh = new Mesh(std::move(vertices), std::move(indices), materialIndex);
+    if (useCache && !SceneCache::Save(cachePath, hash, *mesh->Data))
+        printf("Could not write the scene cache %s\n", cachePath.c_str());
+
+    return mesh;
+}
+
+
+void SceneLoader::LoadDefaultScene(Scene& scene, const std::string& plyPath, bool useCache) {
+
+    Material pinkSphere;
+    pinkSphere.Albedo = {1.0f, 0.0f, 1.0f};
+    pinkSphere.Roughness = 0.0f;
+    scene.Materials.push_back(pinkSphere);
+
+    Material blueSphere;
+    blueSphere.Albedo = {0.0f, 0.0f, 1.0f};
+    blueSphere.Roughness = .1f;
+    scene.Materials.push_back(blueSphere);
+
+
+    Sphere* sphere = new Sphere();
+    sphere->Position = {.0f, .0f, .0f};
+    sphere->Radius = 1.0f;
+    sphere->MaterialIndex = 0;
+    scene.Shapes.push_back(sphere);
+
+    Sphere* sphere2 = new Sphere();
+    sphere2->Position = {.0f, -201.0f, .0f};
+    sphere2->Radius = 200.0f;
+    sphere2->MaterialIndex = 1;
+    scene.Shapes.push_back(sphere2);
+
+    scene.Shapes.push_back(LoadPLY(plyPath, 0, useCache));
+
+    printf("File read\n");
+    scene.bvh.BuildBVH(scene.Shapes);
+    printf("BVHTree built\n");
+}
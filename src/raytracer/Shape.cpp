@@ -1,4 +1,5 @@
 #include "raytracer/Shape.h"
+#include "raytracer/RayPacket.h"
 #include "imgui.h"
 #include "font/forkawesome.h"
 #include <string>
@@ -9,6 +10,54 @@
 Shape::Shape() {}
 Shape::Shape(glm::vec3 pos, int i) : Position(pos), MaterialIndex(i) {}
 
+bool Shape::intersect(const Ray& ray, HitPayLoad& payload) const {
+
+    float t;
+    if (!intersect(ray, t) || t >= payload.HitDistance) return false;
+
+    payload.HitDistance = t;
+    return true;
+}
+
+bool Shape::Occluded(const TraversalRay& ray) const {
+
+    float t;
+    return intersect(ray, t) && t < ray.TMax;
+}
+
+bool Shape::SampleLight(const glm::vec3& p, glm::vec2 u, LightSample& sample) const {
+    return false;
+}
+
+float Shape::LightPdf(const Ray& ray, const HitPayLoad& payload) const {
+    return 0.0f;
+}
+
+uint64_t Shape::IntersectPacket(RayPacket& packet, uint32_t groups) const {
+
+    uint64_t hitMask = 0;
+    for (int i = 0; i < PACKET_SIZE; i++) {
+        if (!(groups & (1u << (i / SIMD_WIDTH)))) continue;
+
+        Ray ray;
+        ray.Origin = packet.Origin;
+        ray.Direction = glm::vec3(packet.Direction[0][i], packet.Direction[1][i], packet.Direction[2][i]);
+
+        HitPayLoad payload;
+        payload.HitDistance = packet.HitDistance[i];
+        payload.PrimitiveId = packet.PrimitiveId[i];
+        payload.Barycentric = glm::vec2(0.0f);
+        if (intersect(ray, payload)) {
+            packet.HitDistance[i] = payload.HitDistance;
+            packet.PrimitiveId[i] = payload.PrimitiveId;
+            packet.Barycentric[0][i] = payload.Barycentric.x;
+            packet.Barycentric[1][i] = payload.Barycentric.y;
+            hitMask |= 1ull << i;
+        }
+    }
+    return hitMask;
+}
+
 bool Shape::RenderUiMaterial(Scene& scene) {
 
         bool edited = false;
@@ -1,4 +1,5 @@
 #include "raytracer/Sphere.h"
+#include "raytracer/RayPacket.h"
 
 #include "imgui/imgui.h"
 #include "font/forkawesome.h"
@@ -40,6 +41,74 @@ bool Sphere::intersect(const Ray &ray, float& intersectT) const {
     return true;
 }
 
+uint64_t Sphere::IntersectPacket(RayPacket& packet, uint32_t groups) const {
+
+    //The origin is shared by the rays, so is c
+    glm::vec3 origin = packet.Origin - Position;
+    vfloatN ox(origin.x), oy(origin.y), oz(origin.z);
+    vfloatN c(glm::dot(origin, origin) - Radius*Radius);
+
+    uint64_t hitMask = 0;
+    for (int g = 0; g < PACKET_GROUPS; g++) {
+        if (!(groups & (1u << g))) continue;
+
+        vfloatN dx = vfloatN::load(&packet.Direction[0][g * SIMD_WIDTH]);
+        vfloatN dy = vfloatN::load(&packet.Direction[1][g * SIMD_WIDTH]);
+        vfloatN dz = vfloatN::load(&packet.Direction[2][g * SIMD_WIDTH]);
+
+        vfloatN a = dx*dx + dy*dy + dz*dz;
+        vfloatN b = vfloatN(2.0f) * (ox*dx + oy*dy + oz*dz);
+        vfloatN delta = b*b - vfloatN(4.0f) * a * c;
+
+        vfloatN t = (vfloatN(0.0f) - b - sqrt(max(delta, vfloatN(0.0f)))) / (vfloatN(2.0f) * a);
+
+        float* hitDistance = &packet.HitDistance[g * SIMD_WIDTH];
+        vfloatN hit = (delta >= vfloatN(0.0f)) & (t >= vfloatN(0.0f)) & (t < vfloatN::load(hitDistance));
+
+        int laneMask = movemask(hit);
+        if (!laneMask) continue;
+
+        select(hit, t, vfloatN::load(hitDistance)).store(hitDistance);
+        hitMask |= (uint64_t)laneMask << (g * SIMD_WIDTH);
+    }
+    return hitMask;
+}
+
+// The directions are drawn uniformly in the cone of the sphere seen from p, so that every
+// sample lands on its visible side
+bool Sphere::SampleLight(const glm::vec3& p, glm::vec2 u, LightSample& sample) const {
+
+    glm::vec3 toCenter = Position - p;
+    float distance2 = glm::dot(toCenter, toCenter);
+    if (distance2 <= Radius*Radius) return false; //Inside
+
+    float distance = glm::sqrt(distance2);
+    float cosMax = glm::sqrt(1.0f - Radius*Radius / distance2);
+    float cosTheta = 1.0f - u.x * (1.0f - cosMax);
+    float sinTheta = glm::sqrt(glm::max(0.0f, 1.0f - cosTheta*cosTheta));
+    float phi = 6.2831853f * u.y;
+
+    glm::vec3 w = toCenter / distance;
+    glm::vec3 a = glm::abs(w.x) > .9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::vec3 t = glm::normalize(glm::cross(a, w));
+    glm::vec3 b = glm::cross(w, t);
+
+    sample.Direction = glm::normalize(t * (sinTheta * glm::cos(phi)) + b * (sinTheta * glm::sin(phi)) + w * cosTheta);
+    sample.Distance = distance * cosTheta - glm::sqrt(glm::max(0.0f, Radius*Radius - distance2 * sinTheta*sinTheta));
+    sample.Pdf = 1.0f / (6.2831853f * (1.0f - cosMax));
+    return sample.Pdf < FLT_MAX;
+}
+
+float Sphere::LightPdf(const Ray& ray, const HitPayLoad& payload) const {
+
+    glm::vec3 toCenter = Position - ray.Origin;
+    float distance2 = glm::dot(toCenter, toCenter);
+    if (distance2 <= Radius*Radius) return 0.0f;
+
+    float cosMax = glm::sqrt(1.0f - Radius*Radius / distance2);
+    return 1.0f / (6.2831853f * (1.0f - cosMax));
+}
+
 void Sphere::ClosestHit(const Ray& ray, HitPayLoad& payload) {
 
     glm::vec3 origin = ray.Origin - Position;
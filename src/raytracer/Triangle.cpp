@@ -8,6 +8,8 @@
 
 #include "raytracer/Material.h"
 #include "raytracer/Sphere.h"
+#include "raytracer/TriangleKernel.h"
+#include <cfloat>
 
 
 Triangle::Triangle() {
@@ -22,18 +24,12 @@ Triangle::Triangle() {
 
 Triangle::Triangle(Vertex V0, Vertex V1, Vertex V2) {
     V[0] = V0; V[1] = V1; V[2] = V2;
-    E[0] = V1.Position - V0.Position; E[1] = V2.Position - V0.Position; E[2] = V2.Position - V1.Position;
-
-    Normal = glm::normalize(glm::cross(E[0], E[1])); 
-    Position = (V[0].Position + V[1].Position + V[2].Position)*0.3333f;
-    dPlane = - glm::dot(Normal, V[0].Position);
+    onVertexChange();
 }
 
 void Triangle::onVertexChange() {
     Position = (V[0].Position + V[1].Position + V[2].Position)*0.3333f;
-    E[0] = V[1].Position - V[0].Position; E[1] = V[2].Position - V[0].Position; E[2] = V[2].Position - V[1].Position;
-    Normal = glm::normalize(glm::cross(E[0], E[1])); 
-    dPlane = - glm::dot(Normal, V[0].Position);
+    Normal = glm::normalize(glm::cross(V[1].Position - V[0].Position, V[2].Position - V[0].Position)); 
 }
 
 
@@ -49,41 +45,41 @@ glm::vec3 Triangle::GetAABBMax() const {
 
  bool Triangle::intersect(const Ray& ray, float& intersectT) const {
 
-    //Back Face Culling
-    // if (glm::dot(ray.Direction, Normal) > 0)
-    //     return false; 
+    glm::vec2 barycentric;
+    return IntersectTriangleWatertight(TraversalRay(ray), V[0].Position, V[1].Position, V[2].Position, FLT_MAX, intersectT, barycentric);
+ }
 
+bool Triangle::intersect(const Ray& ray, HitPayLoad& payload) const {
 
-    //Parallel
-    float normalDirectionDot = dot(ray.Direction, Normal);
-    if(glm::abs(normalDirectionDot) < .0001) return false;
-    
-    //Intersection t of the ray (Origin + Direction*t) with the plane
-    float intersectPlaneT = -(glm::dot(Normal, ray.Origin) + dPlane) / normalDirectionDot;
+    return IntersectTriangleWatertight(TraversalRay(ray), V[0].Position, V[1].Position, V[2].Position,
+        payload.HitDistance, payload.HitDistance, payload.Barycentric);
+}
 
-    //Triangle is behind the ray
-    if (intersectPlaneT < 0.0f) return false; 
+// Points drawn uniformly over the area, the pdf is converted to solid angle
+bool Triangle::SampleLight(const glm::vec3& p, glm::vec2 u, LightSample& sample) const {
 
-    //Intersection point
-    glm::vec3 intersectionPoint = ray.Origin + intersectPlaneT*ray.Direction;
+    float su = glm::sqrt(u.x);
+    glm::vec3 point = V[0].Position * (1.0f - su) + V[1].Position * (su * (1.0f - u.y)) + V[2].Position * (su * u.y);
+    glm::vec3 cross = glm::cross(V[1].Position - V[0].Position, V[2].Position - V[0].Position);
+    float area = .5f * glm::length(cross);
 
-    //Outside edge 0
-    if (glm::dot(Normal, glm::cross(E[0], intersectionPoint - V[0].Position)) < 0) 
-        return false; 
- 
-    //Outside edge1
-    if (glm::dot(Normal, glm::cross(-E[1] , intersectionPoint - V[2].Position)) < 0) 
-        return false; 
+    glm::vec3 toPoint = point - p;
+    sample.Distance = glm::length(toPoint);
+    sample.Direction = toPoint / sample.Distance;
 
-    //Outside edge 2
-    if (glm::dot(Normal, glm::cross(E[2], intersectionPoint - V[1].Position)) < 0) 
-        return false; 
+    float cosine = glm::abs(glm::dot(cross, sample.Direction)) / (2.0f * area);
+    if (cosine <= 0.0f || area <= 0.0f) return false;
+    sample.Pdf = sample.Distance * sample.Distance / (cosine * area);
+    return true;
+}
 
-    intersectT = intersectPlaneT;
+float Triangle::LightPdf(const Ray& ray, const HitPayLoad& payload) const {
 
-    
-    return true;
- }
+    float area = .5f * glm::length(glm::cross(V[1].Position - V[0].Position, V[2].Position - V[0].Position));
+    float cosine = glm::abs(glm::dot(payload.WorldNormal, ray.Direction));
+    if (cosine <= 0.0f || area <= 0.0f) return 0.0f;
+    return payload.HitDistance * payload.HitDistance / (cosine * area);
+}
 
  void Triangle::ClosestHit(const Ray& ray, HitPayLoad& payload) {
 